@@ -0,0 +1,321 @@
+// ============================================================
+// broker/h2h_bench.cpp  —  throughput / fan-out latency for any MQTT broker
+// - N subscribers on h2h/bench/+/+, one publisher, numeric payloads
+//   (send time in ns, CLOCK_MONOTONIC: run on the broker host)
+// - reports publish rate, delivered msgs/s and latency percentiles
+// - same numbers for h2h_broker and mosquitto: only -p differs
+// - -5: MQTT 5 with topic aliases on both sides; bytes/sample shows the
+//   wire cost per sample (publisher and subscriber side)
+//
+// Build: g++ -O2 -std=c++17 -pthread -o h2h_bench broker/h2h_bench.cpp
+// Run:   ./h2h_bench [-H 127.0.0.1] [-p 1883] [-s 10] [-n 100000] [-r 0] [-q 0] [-5]
+// ============================================================
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <string>
+#include <thread>
+#include <vector>
+
+
+namespace {
+
+struct Options {
+  const char* host = "127.0.0.1";
+  uint16_t    port = 1883;
+  int         subscribers = 10;
+  uint32_t    messages = 100000;
+  uint32_t    rate = 0;                    // msgs/s, 0 = as fast as possible
+  uint8_t     qos = 0;
+  bool        v5 = false;
+  uint32_t    timeoutMs = 10000;           // after the last publish
+};
+
+static Options opt;
+
+static uint64_t now_ns() {
+  timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static int connect_tcp() {
+  const int fd = socket(AF_INET, SOCK_STREAM, 0);
+  sockaddr_in sa = {};
+  sa.sin_family = AF_INET;
+  sa.sin_port = htons(opt.port);
+  inet_pton(AF_INET, opt.host, &sa.sin_addr);
+  if (connect(fd, (sockaddr*)&sa, sizeof(sa)) < 0) { perror("connect"); exit(1); }
+  const int one = 1;
+  setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+  return fd;
+}
+
+static void put_str(std::string& p, const std::string& s) {
+  p.push_back((char)(s.size() >> 8));
+  p.push_back((char)s.size());
+  p += s;
+}
+
+static std::string packet(uint8_t head, const std::string& body) {
+  std::string p(1, (char)head);
+  uint32_t len = (uint32_t)body.size();
+  do {
+    uint8_t b = len & 0x7F;
+    len >>= 7;
+    if (len) b |= 0x80;
+    p.push_back((char)b);
+  } while (len);
+  return p + body;
+}
+
+static void send_all(int fd, const std::string& p) {
+  size_t off = 0;
+  while (off < p.size()) {
+    const ssize_t w = send(fd, p.data() + off, p.size() - off, MSG_NOSIGNAL);
+    if (w <= 0) { perror("send"); exit(1); }
+    off += (size_t)w;
+  }
+}
+
+// blocking reader: one packet at a time, buffered
+struct Conn {
+  int fd = -1;
+  std::vector<uint8_t> buf;
+  size_t off = 0;
+
+  // false on EOF / timeout
+  bool next(uint8_t& head, const uint8_t*& body, uint32_t& len) {
+    for (;;) {
+      const size_t avail = buf.size() - off;
+      if (avail >= 2) {
+        uint32_t rem = 0;
+        size_t i = 1;
+        bool complete = false;
+        for (int shift = 0; i < avail && shift <= 21; shift += 7) {
+          const uint8_t b = buf[off + i++];
+          rem |= (uint32_t)(b & 0x7F) << shift;
+          if (!(b & 0x80)) { complete = true; break; }
+        }
+        if (complete && avail >= i + rem) {
+          head = buf[off];
+          body = buf.data() + off + i;
+          len = rem;
+          off += i + rem;
+          return true;
+        }
+      }
+      if (off > 0) {
+        buf.erase(buf.begin(), buf.begin() + off);
+        off = 0;
+      }
+      const size_t old = buf.size();
+      buf.resize(old + 65536);
+      const ssize_t r = recv(fd, buf.data() + old, 65536, 0);
+      if (r <= 0) { buf.resize(old); return false; }
+      buf.resize(old + (size_t)r);
+    }
+  }
+};
+
+static void mqtt_connect(Conn& c, const std::string& id) {
+  c.fd = connect_tcp();
+  std::string b;
+  put_str(b, "MQTT");
+  b.push_back(opt.v5 ? 5 : 4);
+  b.push_back(0x02);                       // clean session
+  b.push_back(0);
+  b.push_back(60);
+  if (opt.v5) {
+    const char props[] = { 3, 0x22, 0, 16 };  // topic alias maximum 16
+    b.append(props, sizeof(props));
+  }
+  put_str(b, id);
+  send_all(c.fd, packet(0x10, b));
+
+  uint8_t head; const uint8_t* body; uint32_t len;
+  if (!c.next(head, body, len) || (head >> 4) != 2 || len < 2 || body[1] != 0) {
+    fprintf(stderr, "%s: CONNACK failed\n", id.c_str());
+    exit(1);
+  }
+}
+
+struct SubResult {
+  std::vector<uint32_t> latUs;
+  uint64_t bytes = 0;                      // PUBLISH packets as received
+  uint64_t firstNs = 0;
+  uint64_t lastNs = 0;
+};
+
+static std::atomic<int> subsReady{0};
+
+static void subscriber(int idx, SubResult* res) {
+  Conn c;
+  mqtt_connect(c, "h2h-bench-sub-" + std::to_string(idx));
+
+  std::string b;
+  b.push_back(0);
+  b.push_back(1);
+  if (opt.v5) b.push_back(0);
+  put_str(b, "h2h/bench/+/+");
+  b.push_back((char)opt.qos);
+  send_all(c.fd, packet(0x82, b));
+
+  timeval tv = { (time_t)(opt.timeoutMs / 1000), 0 };
+  setsockopt(c.fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+
+  res->latUs.reserve(opt.messages);
+  uint8_t head; const uint8_t* body; uint32_t len;
+  while (res->latUs.size() < opt.messages && c.next(head, body, len)) {
+    const uint8_t type = head >> 4;
+    if (type == 9) { subsReady++; continue; }           // SUBACK
+    if (type != 3) continue;
+
+    const uint64_t t = now_ns();
+    const uint8_t q = (head >> 1) & 3;
+    const uint32_t tlen = (uint32_t)((body[0] << 8) | body[1]);
+    uint32_t p = 2 + tlen;
+    if (q) {
+      const std::string ack = packet(0x40, std::string((const char*)body + p, 2));
+      send_all(c.fd, ack);
+      p += 2;
+    }
+    if (opt.v5) {                          // skip properties (topic alias)
+      uint32_t plen = 0;
+      for (int shift = 0; ; shift += 7) {
+        const uint8_t x = body[p++];
+        plen |= (uint32_t)(x & 0x7F) << shift;
+        if (!(x & 0x80)) break;
+      }
+      p += plen;
+    }
+    res->bytes += 1 + (len < 128 ? 1 : 2) + len;
+    uint64_t sent = 0;
+    for (; p < len; p++) sent = sent * 10 + (body[p] - '0');
+
+    if (!res->firstNs) res->firstNs = t;
+    res->lastNs = t;
+    res->latUs.push_back((uint32_t)((t - sent) / 1000));
+  }
+  send_all(c.fd, packet(0xE0, std::string()));
+  close(c.fd);
+}
+
+static double pct(const std::vector<uint32_t>& v, double p) {
+  if (v.empty()) return 0;
+  const size_t i = std::min(v.size() - 1, (size_t)(p / 100.0 * v.size()));
+  return v[i];
+}
+
+static void usage(const char* argv0) {
+  fprintf(stderr, "usage: %s [-H host] [-p port] [-s subscribers] [-n messages] [-r rate] [-q qos] [-5]\n", argv0);
+}
+
+} // namespace
+
+
+int main(int argc, char** argv) {
+  int o;
+  while ((o = getopt(argc, argv, "H:p:s:n:r:q:t:5h")) != -1) {
+    switch (o) {
+      case 'H': opt.host = optarg; break;
+      case 'p': opt.port = (uint16_t)atoi(optarg); break;
+      case 's': opt.subscribers = atoi(optarg); break;
+      case 'n': opt.messages = (uint32_t)atoi(optarg); break;
+      case 'r': opt.rate = (uint32_t)atoi(optarg); break;
+      case 'q': opt.qos = (uint8_t)(atoi(optarg) ? 1 : 0); break;
+      case 't': opt.timeoutMs = (uint32_t)atoi(optarg); break;
+      case '5': opt.v5 = true; break;
+      default: usage(argv[0]); return 2;
+    }
+  }
+
+  std::vector<SubResult> results(opt.subscribers);
+  std::vector<std::thread> subs;
+  for (int i = 0; i < opt.subscribers; i++) subs.emplace_back(subscriber, i, &results[i]);
+  while (subsReady.load() < opt.subscribers) usleep(1000);
+
+  Conn pub;
+  mqtt_connect(pub, "h2h-bench-pub");
+  std::thread acks([&pub] {                // drain PUBACKs so the socket never stalls
+    uint8_t head; const uint8_t* body; uint32_t len;
+    while (pub.next(head, body, len)) {}
+  });
+
+  static const char* ROOMS[] = { "stube", "kueche", "bad", "wc", "keller", "flur", "buero", "garten" };
+  const uint64_t t0 = now_ns();
+  std::string batch;
+  uint64_t pubBytes = 0;
+  uint16_t pid = 0;
+  for (uint32_t i = 0; i < opt.messages; i++) {
+    if (opt.rate) {
+      const uint64_t due = t0 + (uint64_t)i * 1000000000ULL / opt.rate;
+      while (now_ns() < due) {}
+    }
+    std::string b;
+    // v5: alias 1..8 per room, topic string only the first time
+    const bool withTopic = !opt.v5 || i < 8;
+    put_str(b, withTopic ? std::string("h2h/bench/") + ROOMS[i & 7] + "/value" : std::string());
+    if (opt.qos) {
+      if (++pid == 0) pid = 1;
+      b.push_back((char)(pid >> 8));
+      b.push_back((char)pid);
+    }
+    if (opt.v5) {
+      const char props[] = { 3, 0x23, 0, (char)((i & 7) + 1) };
+      b.append(props, sizeof(props));
+    }
+    b += std::to_string(now_ns());
+    const std::string pk = packet((uint8_t)(0x30 | (opt.qos << 1)), b);
+    pubBytes += pk.size();
+    batch += pk;
+    if (opt.rate || batch.size() > 16384) {
+      send_all(pub.fd, batch);
+      batch.clear();
+    }
+  }
+  send_all(pub.fd, batch);
+  const uint64_t t1 = now_ns();
+
+  for (auto& t : subs) t.join();
+  send_all(pub.fd, packet(0xE0, std::string()));
+  shutdown(pub.fd, SHUT_RDWR);
+  acks.join();
+  close(pub.fd);
+
+  std::vector<uint32_t> all;
+  uint64_t last = 0, subBytes = 0;
+  for (auto& r : results) {
+    all.insert(all.end(), r.latUs.begin(), r.latUs.end());
+    last = std::max(last, r.lastNs);
+    subBytes += r.bytes;
+  }
+  std::sort(all.begin(), all.end());
+
+  const uint64_t expected = (uint64_t)opt.messages * opt.subscribers;
+  const double pubSec = (t1 - t0) / 1e9;
+  const double allSec = last > t0 ? (last - t0) / 1e9 : 0;
+  printf("broker      %s:%u\n", opt.host, opt.port);
+  printf("fan-out     1 -> %d subscribers, qos %u, %u msgs, mqtt %s\n", opt.subscribers, opt.qos, opt.messages,
+         opt.v5 ? "5 (topic aliases)" : "3.1.1");
+  printf("publish     %.0f msgs/s\n", pubSec > 0 ? opt.messages / pubSec : 0);
+  printf("delivered   %zu / %llu (%.0f msgs/s)\n", all.size(), (unsigned long long)expected,
+         allSec > 0 ? all.size() / allSec : 0);
+  printf("bytes/sample pub %.1f  sub %.1f  (payload %zu)\n",
+         opt.messages ? (double)pubBytes / opt.messages : 0.0,
+         all.empty() ? 0.0 : (double)subBytes / all.size(), std::to_string(now_ns()).size());
+  printf("latency us  p50 %.0f  p90 %.0f  p99 %.0f  max %.0f\n",
+         pct(all, 50), pct(all, 90), pct(all, 99), all.empty() ? 0.0 : (double)all.back());
+  return all.size() == expected ? 0 : 1;
+}
@@ -0,0 +1,1044 @@
+// ============================================================
+// broker/h2h_broker.cpp  —  small MQTT 3.1.1 broker for one house (Linux)
+// - no cloud: runs on any Linux box in the LAN (Pi, NAS, router)
+// - single thread, epoll, non-blocking sockets, TCP_NODELAY
+// - topic trie shaped for h2h/<house>/<room>/<metric>: few children per
+//   level, linear scan beats hashing; retained messages live in the nodes
+// - zero-copy fan-out: a PUBLISH is encoded once ([len][topic][payload]),
+//   every receiver gets iovecs into that shared buffer plus a few private
+//   header bytes (fixed header, packet id); writev() per flush
+// - QoS 0/1; inbound QoS 2 is acknowledged and forwarded as QoS 1
+// - clean sessions only (no offline queues), last will, keepalive
+//   via h2h_timer.h, optional single user:pass
+// - MQTT 5 clients: topic aliases both ways (per connection). Outgoing
+//   aliases are private header bytes, the shared body stays shared.
+//   User properties (e.g. the MAC of h2h_mac.h) are kept with the message
+//   (also will and retained) and forwarded to v5 subscribers; other v5
+//   properties are accepted and not forwarded
+//
+// Build: g++ -O2 -std=c++17 -o h2h_broker broker/h2h_broker.cpp
+// Run:   ./h2h_broker [-p 1883] [-b 0.0.0.0] [-u user:pass] [-s 10] [-a 64]
+// ============================================================
+
+#include <arpa/inet.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <deque>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+#include "../h2h_timer.h"
+#include "../h2h_mqtt.h"     // v5 property walker
+
+
+namespace {
+
+// ============================================================
+//  CONFIG / STATS
+// ============================================================
+
+struct Config {
+  uint16_t    port       = 1883;
+  const char* bind       = "0.0.0.0";
+  std::string user;                        // empty = no auth
+  std::string pass;
+  uint32_t    maxPacket  = 64 * 1024;
+  size_t      maxQueued  = 1024 * 1024;    // per client; beyond that publishes are dropped
+  uint32_t    statsSec   = 0;              // 0 = quiet
+  uint16_t    aliasMax   = 64;             // v5 topic aliases accepted per client
+};
+
+struct Stats {
+  uint64_t msgsIn = 0;
+  uint64_t msgsOut = 0;
+  uint64_t bytesOut = 0;
+  uint64_t dropped = 0;                    // slow consumers
+  uint64_t writevCalls = 0;
+  uint64_t aliasedOut = 0;                 // v5 publishes sent without topic string
+};
+
+static Config cfg;
+static Stats  stats;
+
+static uint32_t now_ms() {
+  timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint32_t)(ts.tv_sec * 1000 + ts.tv_nsec / 1000000);
+}
+
+
+// ============================================================
+//  PACKETS
+// ============================================================
+
+enum PacketType : uint8_t {
+  CONNECT = 1, CONNACK, PUBLISH, PUBACK, PUBREC, PUBREL, PUBCOMP,
+  SUBSCRIBE, SUBACK, UNSUBSCRIBE, UNSUBACK, PINGREQ, PINGRESP, DISCONNECT
+};
+
+// Shared PUBLISH body: [topic len (2)][topic][payload]
+struct Msg {
+  std::vector<uint8_t> buf;
+  std::vector<uint8_t> props;              // v5 user properties, encoded (0x26 ...)
+  uint16_t topicLen = 0;
+  uint8_t  qos = 0;
+
+  std::string topic() const { return std::string((const char*)buf.data() + 2, topicLen); }
+  size_t topic_part() const { return 2 + (size_t)topicLen; }
+  size_t payload_len() const { return buf.size() - topic_part(); }
+};
+using MsgRef = std::shared_ptr<const Msg>;
+
+static MsgRef make_msg(const uint8_t* topic, size_t tlen, const uint8_t* payload, size_t plen, uint8_t qos,
+                       std::vector<uint8_t> props = {}) {
+  auto m = std::make_shared<Msg>();
+  m->props = std::move(props);
+  m->buf.resize(2 + tlen + plen);
+  m->buf[0] = (uint8_t)(tlen >> 8);
+  m->buf[1] = (uint8_t)tlen;
+  memcpy(m->buf.data() + 2, topic, tlen);
+  if (plen) memcpy(m->buf.data() + 2 + tlen, payload, plen);
+  m->topicLen = (uint16_t)tlen;
+  m->qos = qos;
+  return m;
+}
+
+static size_t put_varlen(uint8_t* out, uint32_t len) {
+  size_t n = 0;
+  do {
+    uint8_t b = len & 0x7F;
+    len >>= 7;
+    if (len) b |= 0x80;
+    out[n++] = b;
+  } while (len);
+  return n;
+}
+
+// One queued outgoing packet.
+// PUBLISH: head + (shared topic | empty topic) + mid (pid, v5 props) + [shared user props] + shared payload
+struct Out {
+  MsgRef   msg;
+  uint8_t  head[5];
+  uint8_t  headLen = 0;
+  bool     withTopic = true;               // false: v5 alias, topic length 0
+  uint8_t  mid[10];
+  uint8_t  midLen = 0;
+  bool     withProps = false;              // v5 receiver: msg->props follow mid
+  std::vector<uint8_t> ctrl;               // control packets (msg == nullptr)
+  size_t   total = 0;
+  size_t   sent = 0;
+};
+
+
+// ============================================================
+//  TOPIC TRIE
+// ============================================================
+
+struct Client;
+
+struct Sub {
+  Client* c;
+  uint8_t qos;
+};
+
+struct TrieNode {
+  std::string level;
+  TrieNode*   parent = nullptr;
+  std::vector<std::unique_ptr<TrieNode>> kids;   // includes literal "+" / "#" filter nodes
+  std::vector<Sub> subs;                         // filters ending here
+  MsgRef      retained;
+
+  TrieNode* find(const char* s, size_t n) const {
+    for (auto& k : kids) {
+      if (k->level.size() == n && memcmp(k->level.data(), s, n) == 0) return k.get();
+    }
+    return nullptr;
+  }
+
+  TrieNode* get(const char* s, size_t n) {
+    if (TrieNode* k = find(s, n)) return k;
+    kids.emplace_back(new TrieNode);
+    TrieNode* k = kids.back().get();
+    k->level.assign(s, n);
+    k->parent = this;
+    return k;
+  }
+
+  bool empty() const { return kids.empty() && subs.empty() && !retained; }
+};
+
+static TrieNode trieRoot;
+
+// split "a/b/c" into level views (empty levels are valid in MQTT)
+static void split_levels(const std::string& t, std::vector<std::pair<const char*, size_t>>& out) {
+  out.clear();
+  size_t start = 0;
+  for (size_t i = 0; i <= t.size(); i++) {
+    if (i == t.size() || t[i] == '/') {
+      out.emplace_back(t.data() + start, i - start);
+      start = i + 1;
+    }
+  }
+}
+
+static bool is_level(const std::pair<const char*, size_t>& l, char c) {
+  return l.second == 1 && l.first[0] == c;
+}
+
+static TrieNode* trie_node(const std::string& topicOrFilter) {
+  std::vector<std::pair<const char*, size_t>> lv;
+  split_levels(topicOrFilter, lv);
+  TrieNode* n = &trieRoot;
+  for (auto& l : lv) n = n->get(l.first, l.second);
+  return n;
+}
+
+static void trie_prune(TrieNode* n) {
+  while (n != &trieRoot && n->empty()) {
+    TrieNode* p = n->parent;
+    for (size_t i = 0; i < p->kids.size(); i++) {
+      if (p->kids[i].get() == n) { p->kids.erase(p->kids.begin() + i); break; }
+    }
+    n = p;
+  }
+}
+
+static bool valid_filter(const std::string& f) {
+  if (f.empty()) return false;
+  std::vector<std::pair<const char*, size_t>> lv;
+  split_levels(f, lv);
+  for (size_t i = 0; i < lv.size(); i++) {
+    const auto& l = lv[i];
+    for (size_t k = 0; k < l.second; k++) {
+      const char ch = l.first[k];
+      if ((ch == '+' || ch == '#') && l.second != 1) return false;
+    }
+    if (is_level(l, '#') && i != lv.size() - 1) return false;
+  }
+  return true;
+}
+
+static bool valid_topic(const uint8_t* t, size_t n) {
+  if (n == 0) return false;
+  for (size_t i = 0; i < n; i++) if (t[i] == '+' || t[i] == '#' || t[i] == 0) return false;
+  return true;
+}
+
+
+// ============================================================
+//  CLIENTS
+// ============================================================
+
+struct Client {
+  int         fd = -1;
+  uint32_t    id = 0;
+  std::string clientId;
+  bool        connected = false;
+  bool        closing = false;
+  bool        dirty = false;               // has queued output, flush at end of loop
+  bool        wantOut = false;             // EPOLLOUT armed
+
+  std::vector<uint8_t> in;
+  size_t      inOff = 0;
+
+  std::deque<Out> out;
+  size_t      queued = 0;                  // bytes
+
+  uint16_t    keepAlive = 0;
+  h2h::TimerNode kaTimer;
+
+  MsgRef      will;
+  bool        willRetain = false;
+
+  uint16_t    nextPid = 1;
+  std::vector<TrieNode*> filters;          // where our Subs live (cleanup)
+
+  uint8_t     version = 4;                 // 4 = 3.1.1, 5 = MQTT 5
+  uint16_t    aliasMaxOut = 0;             // v5: aliases the client accepts from us
+  std::deque<std::string> aliasTopics;     // owns the keys of aliasOut
+  std::unordered_map<std::string_view, uint16_t> aliasOut;
+  std::vector<std::string> aliasIn;        // v5: client's aliases, index = alias
+
+  uint32_t    matchEpoch = 0;              // fan-out de-duplication
+  uint8_t     matchQos = 0;
+};
+
+static int epfd = -1;
+static uint32_t nextClientId = 1;
+static std::unordered_map<uint32_t, Client*> clientsById;
+static std::unordered_map<std::string, Client*> clientsByName;
+static std::vector<Client*> dirtyClients;
+static std::vector<Client*> closingClients;
+static h2h::TimerWheel<> wheel(100);       // keepalive deadlines
+static uint32_t fanoutEpoch = 0;
+
+static void mark_dirty(Client* c) {
+  if (!c->dirty) { c->dirty = true; dirtyClients.push_back(c); }
+}
+
+static void mark_closing(Client* c) {
+  if (!c->closing) { c->closing = true; closingClients.push_back(c); }
+}
+
+static void enqueue_ctrl(Client* c, const uint8_t* p, size_t n) {
+  Out o;
+  o.ctrl.assign(p, p + n);
+  o.total = n;
+  c->queued += n;
+  c->out.push_back(std::move(o));
+  mark_dirty(c);
+}
+
+static void enqueue_publish(Client* c, const MsgRef& m, uint8_t qos, bool retain) {
+  if (c->closing || !c->connected) return;
+  if (c->queued > cfg.maxQueued) { stats.dropped++; return; }
+
+  Out o;
+  o.msg = m;
+  if (qos) {
+    if (c->nextPid == 0) c->nextPid = 1;
+    const uint16_t pid = c->nextPid++;
+    o.mid[o.midLen++] = (uint8_t)(pid >> 8);
+    o.mid[o.midLen++] = (uint8_t)pid;
+  }
+  if (c->version == 5) {
+    uint16_t alias = 0;
+    if (c->aliasMaxOut) {
+      const std::string_view topic((const char*)m->buf.data() + 2, m->topicLen);
+      auto it = c->aliasOut.find(topic);
+      if (it != c->aliasOut.end()) {
+        alias = it->second;
+        o.withTopic = false;
+        stats.aliasedOut++;
+      } else if (c->aliasOut.size() < c->aliasMaxOut) {
+        // first come, first served: the periodic h2h topics fill the table early
+        c->aliasTopics.emplace_back(topic);
+        alias = (uint16_t)(c->aliasOut.size() + 1);
+        c->aliasOut.emplace(c->aliasTopics.back(), alias);
+      }
+    }
+    o.withProps = !m->props.empty();
+    o.midLen += (uint8_t)put_varlen(o.mid + o.midLen, (alias ? 3 : 0) + (uint32_t)m->props.size());   // property length
+    if (alias) {
+      o.mid[o.midLen++] = h2h::MQTT_PROP_TOPIC_ALIAS;
+      o.mid[o.midLen++] = (uint8_t)(alias >> 8);
+      o.mid[o.midLen++] = (uint8_t)alias;
+    }
+  }
+  const uint32_t rem = (uint32_t)((o.withTopic ? m->topic_part() : 2) + o.midLen +
+                                   (o.withProps ? m->props.size() : 0) + m->payload_len());
+  o.head[0] = (uint8_t)((PUBLISH << 4) | (qos << 1) | (retain ? 1 : 0));
+  o.headLen = (uint8_t)(1 + put_varlen(o.head + 1, rem));
+  o.total = o.headLen + rem;
+  c->queued += o.total;
+  c->out.push_back(std::move(o));
+  stats.msgsOut++;
+  mark_dirty(c);
+}
+
+// writev as much of the queue as the socket takes
+static void flush(Client* c) {
+  while (!c->out.empty()) {
+    iovec iov[64];
+    int n = 0;
+    for (auto it = c->out.begin(); it != c->out.end() && n + 4 <= 64; ++it) {
+      const Out& o = *it;
+      size_t skip = o.sent;
+      auto add = [&](const void* p, size_t len) {
+        if (skip >= len) { skip -= len; return; }
+        iov[n].iov_base = (void*)((const uint8_t*)p + skip);
+        iov[n].iov_len = len - skip;
+        skip = 0;
+        n++;
+      };
+      if (o.msg) {
+        static const uint8_t NO_TOPIC[2] = { 0, 0 };
+        add(o.head, o.headLen);
+        if (o.withTopic) add(o.msg->buf.data(), o.msg->topic_part());
+        else             add(NO_TOPIC, 2);
+        if (o.midLen) add(o.mid, o.midLen);
+        if (o.withProps) add(o.msg->props.data(), o.msg->props.size());
+        add(o.msg->buf.data() + o.msg->topic_part(), o.msg->payload_len());
+      } else {
+        add(o.ctrl.data(), o.ctrl.size());
+      }
+    }
+
+    const ssize_t w = writev(c->fd, iov, n);
+    stats.writevCalls++;
+    if (w < 0) {
+      if (errno == EAGAIN || errno == EWOULDBLOCK) break;
+      if (errno == EINTR) continue;
+      mark_closing(c);
+      return;
+    }
+    stats.bytesOut += (uint64_t)w;
+
+    size_t left = (size_t)w;
+    while (left && !c->out.empty()) {
+      Out& o = c->out.front();
+      const size_t need = o.total - o.sent;
+      if (left >= need) {
+        left -= need;
+        c->queued -= o.total;
+        c->out.pop_front();
+      } else {
+        o.sent += left;
+        left = 0;
+      }
+    }
+  }
+
+  const bool want = !c->out.empty();
+  if (want != c->wantOut) {
+    epoll_event ev = {};
+    ev.events = EPOLLIN | (want ? (uint32_t)EPOLLOUT : 0u);
+    ev.data.ptr = c;
+    epoll_ctl(epfd, EPOLL_CTL_MOD, c->fd, &ev);
+    c->wantOut = want;
+  }
+}
+
+
+// ============================================================
+//  FAN-OUT / RETAINED
+// ============================================================
+
+static std::vector<Client*> matched;
+
+static void collect(TrieNode* n, const std::vector<std::pair<const char*, size_t>>& lv, size_t i) {
+  auto take = [](const std::vector<Sub>& subs) {
+    for (const Sub& s : subs) {
+      Client* c = s.c;
+      if (c->matchEpoch != fanoutEpoch) {
+        c->matchEpoch = fanoutEpoch;
+        c->matchQos = s.qos;
+        matched.push_back(c);
+      } else if (s.qos > c->matchQos) {
+        c->matchQos = s.qos;
+      }
+    }
+  };
+
+  // "$SYS/..." style topics never match a leading wildcard
+  const bool dollar = (i == 0 && lv[0].second > 0 && lv[0].first[0] == '$');
+
+  if (!dollar) {
+    if (TrieNode* h = n->find("#", 1)) take(h->subs);   // also matches the parent level
+  }
+  if (i == lv.size()) {
+    take(n->subs);
+    return;
+  }
+  if (TrieNode* k = n->find(lv[i].first, lv[i].second)) collect(k, lv, i + 1);
+  if (!dollar) {
+    if (TrieNode* p = n->find("+", 1)) collect(p, lv, i + 1);
+  }
+}
+
+static void fan_out(const MsgRef& m) {
+  static std::vector<std::pair<const char*, size_t>> lv;
+  const std::string topic = m->topic();
+  split_levels(topic, lv);
+
+  fanoutEpoch++;
+  matched.clear();
+  collect(&trieRoot, lv, 0);
+  for (Client* c : matched) {
+    const uint8_t q = m->qos < c->matchQos ? m->qos : c->matchQos;
+    enqueue_publish(c, m, q, false);
+  }
+}
+
+static void store_retained(const MsgRef& m) {
+  TrieNode* n = trie_node(m->topic());
+  if (m->payload_len() == 0) {
+    n->retained.reset();
+    trie_prune(n);
+  } else {
+    n->retained = m;
+  }
+}
+
+// retained messages below n that match the rest of the filter
+static void send_retained(Client* c, TrieNode* n, const std::vector<std::pair<const char*, size_t>>& lv, size_t i, uint8_t qos) {
+  auto deliver = [&](TrieNode* t) {
+    if (t->retained) enqueue_publish(c, t->retained, t->retained->qos < qos ? t->retained->qos : qos, true);
+  };
+  auto is_wild = [](const TrieNode* k) { return k->level == "+" || k->level == "#"; };
+
+  if (i == lv.size()) { deliver(n); return; }
+
+  if (is_level(lv[i], '#')) {
+    // n itself and everything below (no "$" topics for a leading '#')
+    if (i > 0) deliver(n);
+    std::vector<TrieNode*> stack;
+    for (auto& k : n->kids) {
+      if (is_wild(k.get())) continue;
+      if (i == 0 && !k->level.empty() && k->level[0] == '$') continue;
+      stack.push_back(k.get());
+    }
+    while (!stack.empty()) {
+      TrieNode* t = stack.back();
+      stack.pop_back();
+      deliver(t);
+      for (auto& k : t->kids) if (!is_wild(k.get())) stack.push_back(k.get());
+    }
+    return;
+  }
+
+  if (is_level(lv[i], '+')) {
+    for (auto& k : n->kids) {
+      if (is_wild(k.get())) continue;
+      if (i == 0 && !k->level.empty() && k->level[0] == '$') continue;
+      send_retained(c, k.get(), lv, i + 1, qos);
+    }
+    return;
+  }
+
+  if (TrieNode* k = n->find(lv[i].first, lv[i].second)) send_retained(c, k, lv, i + 1, qos);
+}
+
+
+// ============================================================
+//  CONNECTION LIFECYCLE
+// ============================================================
+
+static void keepalive_expired(h2h::TimerNode& t) {
+  auto it = clientsById.find(t.id);
+  if (it != clientsById.end()) mark_closing(it->second);
+}
+
+static void touch(Client* c) {
+  if (c->keepAlive) wheel.schedule(c->kaTimer, c->keepAlive * 1500u);   // 1.5 x keepalive
+}
+
+static void unsubscribe_all(Client* c) {
+  for (TrieNode* n : c->filters) {
+    for (size_t i = 0; i < n->subs.size(); i++) {
+      if (n->subs[i].c == c) { n->subs.erase(n->subs.begin() + i); break; }
+    }
+    trie_prune(n);
+  }
+  c->filters.clear();
+}
+
+static void publish_in(const MsgRef& m, bool retain) {
+  stats.msgsIn++;
+  if (retain) store_retained(m);
+  fan_out(m);
+}
+
+// abnormal = will is published
+static void destroy(Client* c, bool abnormal) {
+  if (abnormal && c->will && c->connected) {
+    publish_in(c->will, c->willRetain);
+  }
+  wheel.cancel(c->kaTimer);
+  unsubscribe_all(c);
+  auto byName = clientsByName.find(c->clientId);
+  if (byName != clientsByName.end() && byName->second == c) clientsByName.erase(byName);
+  clientsById.erase(c->id);
+  epoll_ctl(epfd, EPOLL_CTL_DEL, c->fd, nullptr);
+  close(c->fd);
+  delete c;
+}
+
+
+// ============================================================
+//  PACKET HANDLERS
+// ============================================================
+
+struct Reader {
+  const uint8_t* p;
+  size_t n;
+  size_t off = 0;
+  bool ok = true;
+
+  uint8_t u8() { if (off + 1 > n) { ok = false; return 0; } return p[off++]; }
+  uint16_t u16() { if (off + 2 > n) { ok = false; return 0; } uint16_t v = (uint16_t)((p[off] << 8) | p[off + 1]); off += 2; return v; }
+  std::string str() {
+    const uint16_t len = u16();
+    if (!ok || off + len > n) { ok = false; return std::string(); }
+    std::string s((const char*)p + off, len);
+    off += len;
+    return s;
+  }
+  size_t left() const { return n - off; }
+
+  // v5 property block, fn(prop) for each; false = malformed
+  template <class F> bool props(F fn) {
+    const uint8_t* q = p + off;
+    const uint8_t* end = p + n;
+    uint32_t len;
+    if (!h2h::mqtt_varint(q, end, len) || len > (uint32_t)(end - q)) { ok = false; return false; }
+    const uint8_t* pend = q + len;
+    h2h::MqttProp pr;
+    while (q < pend) {
+      if (!h2h::mqtt_prop_next(q, pend, pr)) { ok = false; return false; }
+      fn(pr);
+    }
+    off = (size_t)(pend - p);
+    return true;
+  }
+};
+
+// user property as received (id + both strings), for forwarding
+static void keep_user_prop(std::vector<uint8_t>& out, const h2h::MqttProp& pr) {
+  out.push_back(h2h::MQTT_PROP_USER);
+  out.insert(out.end(), pr.data, pr.data + pr.len);
+}
+
+// rc3 / rc5: return code for 3.1.1 / reason code for v5
+static void send_connack(Client* c, uint8_t rc3, uint8_t rc5) {
+  if (c->version != 5) {
+    const uint8_t p[4] = { CONNACK << 4, 2, 0, rc3 };
+    enqueue_ctrl(c, p, sizeof(p));
+  } else if (rc5 != 0) {
+    const uint8_t p[5] = { CONNACK << 4, 3, 0, rc5, 0 };
+    enqueue_ctrl(c, p, sizeof(p));
+  } else {
+    const uint8_t p[8] = { CONNACK << 4, 6, 0, 0, 3, h2h::MQTT_PROP_TOPIC_ALIAS_MAX,
+                           (uint8_t)(cfg.aliasMax >> 8), (uint8_t)cfg.aliasMax };
+    enqueue_ctrl(c, p, sizeof(p));
+  }
+}
+
+static void on_connect(Client* c, Reader& r) {
+  if (c->connected) { mark_closing(c); return; }   // second CONNECT is a protocol error
+
+  const std::string proto = r.str();
+  const uint8_t level = r.u8();
+  const uint8_t flags = r.u8();
+  const uint16_t ka = r.u16();
+  if (!r.ok) { mark_closing(c); return; }
+  if (proto != "MQTT" || (level != 4 && level != 5)) { send_connack(c, 1, 0x84); mark_closing(c); return; }
+
+  if (level == 5) {
+    c->version = 5;
+    r.props([c](const h2h::MqttProp& pr) {
+      if (pr.id == h2h::MQTT_PROP_TOPIC_ALIAS_MAX) c->aliasMaxOut = (uint16_t)pr.num;
+    });
+    c->aliasIn.assign(cfg.aliasMax + 1, std::string());
+  }
+
+  std::string cid = r.str();
+  std::string willTopic, willMsg;
+  std::vector<uint8_t> willProps;
+  if (flags & 0x04) {
+    if (c->version == 5) r.props([&willProps](const h2h::MqttProp& pr) {   // will delay etc.: ignored
+      if (pr.id == h2h::MQTT_PROP_USER) keep_user_prop(willProps, pr);
+    });
+    willTopic = r.str();
+    willMsg = r.str();
+  }
+  std::string user, pass;
+  if (flags & 0x80) user = r.str();
+  if (flags & 0x40) pass = r.str();
+  if (!r.ok) { mark_closing(c); return; }
+
+  if (cid.empty()) {
+    if (!(flags & 0x02)) { send_connack(c, 2, 0x85); mark_closing(c); return; }
+    cid = "h2h-anon-" + std::to_string(c->id);
+  }
+  if (!cfg.user.empty() && (user != cfg.user || pass != cfg.pass)) {
+    send_connack(c, 4, 0x86);
+    mark_closing(c);
+    return;
+  }
+
+  // same client id: the new connection wins
+  auto old = clientsByName.find(cid);
+  if (old != clientsByName.end() && old->second != c) mark_closing(old->second);
+
+  c->clientId = cid;
+  clientsByName[cid] = c;
+  c->keepAlive = ka;
+  if (!ka) wheel.cancel(c->kaTimer);        // keepalive off: drop the pre-CONNECT deadline
+  if (flags & 0x04) {
+    const uint8_t wq = (flags >> 3) & 3;
+    c->will = make_msg((const uint8_t*)willTopic.data(), willTopic.size(),
+                       (const uint8_t*)willMsg.data(), willMsg.size(), wq > 1 ? 1 : wq, std::move(willProps));
+    c->willRetain = (flags & 0x20) != 0;
+  }
+  c->connected = true;
+  touch(c);
+  send_connack(c, 0, 0);
+}
+
+static void on_publish(Client* c, uint8_t flags, Reader& r) {
+  const uint8_t qos = (flags >> 1) & 3;
+  const bool retain = flags & 1;
+  const uint16_t tlen = r.u16();
+  if (!r.ok || qos == 3 || r.left() < tlen) { mark_closing(c); return; }
+  const uint8_t* topic = r.p + r.off;
+  size_t topicLen = tlen;
+  r.off += tlen;
+
+  uint16_t pid = 0;
+  if (qos) pid = r.u16();
+  if (!r.ok) { mark_closing(c); return; }
+
+  std::vector<uint8_t> userProps;
+  if (c->version == 5) {
+    uint32_t alias = 0;
+    if (!r.props([&alias, &userProps](const h2h::MqttProp& pr) {
+          if (pr.id == h2h::MQTT_PROP_TOPIC_ALIAS) alias = pr.num;
+          else if (pr.id == h2h::MQTT_PROP_USER) keep_user_prop(userProps, pr);
+        })) { mark_closing(c); return; }
+    if (alias) {
+      if (alias > cfg.aliasMax) { mark_closing(c); return; }
+      std::string& known = c->aliasIn[alias];
+      if (topicLen) {
+        known.assign((const char*)topic, topicLen);
+      } else {
+        topic = (const uint8_t*)known.data();
+        topicLen = known.size();
+      }
+    }
+  }
+  if (!valid_topic(topic, topicLen)) { mark_closing(c); return; }
+
+  const MsgRef m = make_msg(topic, topicLen, r.p + r.off, r.left(), qos > 1 ? 1 : qos, std::move(userProps));
+  publish_in(m, retain);
+
+  if (qos == 1) {
+    const uint8_t p[4] = { PUBACK << 4, 2, (uint8_t)(pid >> 8), (uint8_t)pid };
+    enqueue_ctrl(c, p, sizeof(p));
+  } else if (qos == 2) {
+    const uint8_t p[4] = { PUBREC << 4, 2, (uint8_t)(pid >> 8), (uint8_t)pid };
+    enqueue_ctrl(c, p, sizeof(p));
+  }
+}
+
+static void on_subscribe(Client* c, Reader& r) {
+  const uint16_t pid = r.u16();
+  if (c->version == 5) r.props([](const h2h::MqttProp&) {});
+  std::vector<std::pair<std::string, uint8_t>> req;
+  while (r.ok && r.left() > 0) {
+    std::string f = r.str();
+    uint8_t q = r.u8();
+    if (c->version == 5) q &= 3;           // v5 options: no-local, retain handling ignored
+    if (r.ok) req.emplace_back(std::move(f), q);
+  }
+  if (!r.ok || req.empty()) { mark_closing(c); return; }
+
+  const bool v5 = c->version == 5;
+  std::vector<uint8_t> ack;
+  ack.push_back(SUBACK << 4);
+  uint8_t len[4];
+  const size_t ll = put_varlen(len, (uint32_t)(2 + (v5 ? 1 : 0) + req.size()));
+  ack.insert(ack.end(), len, len + ll);
+  ack.push_back((uint8_t)(pid >> 8));
+  ack.push_back((uint8_t)pid);
+  if (v5) ack.push_back(0);                // no properties
+
+  std::vector<std::pair<std::string, uint8_t>> granted;
+  for (auto& q : req) {
+    if (!valid_filter(q.first) || q.second > 2) { ack.push_back(0x80); continue; }
+    const uint8_t g = q.second > 1 ? 1 : q.second;
+    TrieNode* n = trie_node(q.first);
+    bool found = false;
+    for (Sub& s : n->subs) if (s.c == c) { s.qos = g; found = true; }
+    if (!found) {
+      n->subs.push_back({ c, g });
+      c->filters.push_back(n);
+    }
+    ack.push_back(g);
+    granted.emplace_back(q.first, g);
+  }
+  enqueue_ctrl(c, ack.data(), ack.size());
+
+  // retained messages after the SUBACK
+  std::vector<std::pair<const char*, size_t>> lv;
+  for (auto& g : granted) {
+    split_levels(g.first, lv);
+    send_retained(c, &trieRoot, lv, 0, g.second);
+  }
+}
+
+static void on_unsubscribe(Client* c, Reader& r) {
+  const uint16_t pid = r.u16();
+  if (c->version == 5) r.props([](const h2h::MqttProp&) {});
+  std::vector<uint8_t> codes;              // v5: one reason code per filter
+  while (r.ok && r.left() > 0) {
+    const std::string f = r.str();
+    if (!r.ok) break;
+    std::vector<std::pair<const char*, size_t>> lv;
+    split_levels(f, lv);
+    TrieNode* n = &trieRoot;
+    for (auto& l : lv) { n = n->find(l.first, l.second); if (!n) break; }
+    uint8_t code = 0x11;                   // no subscription existed
+    if (n) {
+      for (size_t i = 0; i < n->subs.size(); i++) {
+        if (n->subs[i].c == c) { n->subs.erase(n->subs.begin() + i); code = 0; break; }
+      }
+      for (size_t i = 0; i < c->filters.size(); i++) {
+        if (c->filters[i] == n) { c->filters.erase(c->filters.begin() + i); break; }
+      }
+      trie_prune(n);
+    }
+    codes.push_back(code);
+  }
+  if (!r.ok) { mark_closing(c); return; }
+
+  if (c->version != 5) {
+    const uint8_t p[4] = { UNSUBACK << 4, 2, (uint8_t)(pid >> 8), (uint8_t)pid };
+    enqueue_ctrl(c, p, sizeof(p));
+    return;
+  }
+  std::vector<uint8_t> ack;
+  ack.push_back(UNSUBACK << 4);
+  uint8_t len[4];
+  const size_t ll = put_varlen(len, (uint32_t)(3 + codes.size()));
+  ack.insert(ack.end(), len, len + ll);
+  ack.push_back((uint8_t)(pid >> 8));
+  ack.push_back((uint8_t)pid);
+  ack.push_back(0);
+  ack.insert(ack.end(), codes.begin(), codes.end());
+  enqueue_ctrl(c, ack.data(), ack.size());
+}
+
+static void on_packet(Client* c, uint8_t type, uint8_t flags, const uint8_t* body, size_t len) {
+  Reader r{ body, len };
+  if (!c->connected && type != CONNECT) { mark_closing(c); return; }
+  touch(c);
+
+  switch (type) {
+    case CONNECT:     on_connect(c, r); break;
+    case PUBLISH:     on_publish(c, flags, r); break;
+    case SUBSCRIBE:   on_subscribe(c, r); break;
+    case UNSUBSCRIBE: on_unsubscribe(c, r); break;
+    case PUBREL: {
+      const uint16_t pid = r.u16();
+      const uint8_t p[4] = { PUBCOMP << 4, 2, (uint8_t)(pid >> 8), (uint8_t)pid };
+      enqueue_ctrl(c, p, sizeof(p));
+      break;
+    }
+    case PINGREQ: {
+      const uint8_t p[2] = { PINGRESP << 4, 0 };
+      enqueue_ctrl(c, p, sizeof(p));
+      break;
+    }
+    case DISCONNECT:
+      // clean disconnect: no will (v5 reason 0x04 asks for it anyway)
+      if (!(c->version == 5 && len > 0 && body[0] == 0x04)) c->will.reset();
+      mark_closing(c);
+      break;
+    case PUBACK:                           // our QoS 1 deliveries: clean sessions,
+    case PUBREC:                           // TCP is the retransmission
+    case PUBCOMP:
+      break;
+    default:
+      mark_closing(c);
+  }
+}
+
+// parse every complete packet in c->in
+static void parse(Client* c) {
+  for (;;) {
+    const size_t avail = c->in.size() - c->inOff;
+    if (avail < 2) break;
+    const uint8_t* p = c->in.data() + c->inOff;
+
+    uint32_t rem = 0;
+    size_t i = 1;
+    for (int shift = 0; ; shift += 7) {
+      if (i >= avail) return;              // length incomplete
+      if (shift > 21) { mark_closing(c); return; }
+      const uint8_t b = p[i++];
+      rem |= (uint32_t)(b & 0x7F) << shift;
+      if (!(b & 0x80)) break;
+    }
+    if (rem > cfg.maxPacket) { mark_closing(c); return; }
+    if (avail < i + rem) break;
+
+    on_packet(c, p[0] >> 4, p[0] & 0x0F, p + i, rem);
+    c->inOff += i + rem;
+    if (c->closing) return;
+  }
+
+  if (c->inOff == c->in.size()) {
+    c->in.clear();
+    c->inOff = 0;
+  } else if (c->inOff > 4096) {
+    c->in.erase(c->in.begin(), c->in.begin() + c->inOff);
+    c->inOff = 0;
+  }
+}
+
+static void on_readable(Client* c) {
+  for (int rounds = 0; rounds < 16; rounds++) {
+    const size_t old = c->in.size();
+    c->in.resize(old + 4096);
+    const ssize_t r = read(c->fd, c->in.data() + old, 4096);
+    if (r <= 0) {
+      c->in.resize(old);
+      if (r < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) break;
+      if (r < 0 && errno == EINTR) continue;
+      mark_closing(c);                     // EOF or error: abnormal, will fires
+      return;
+    }
+    c->in.resize(old + (size_t)r);
+    if ((size_t)r < 4096) break;
+  }
+  parse(c);
+}
+
+
+// ============================================================
+//  MAIN LOOP
+// ============================================================
+
+static int listen_on(const char* addr, uint16_t port) {
+  const int fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK, 0);
+  if (fd < 0) return -1;
+  const int one = 1;
+  setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+  sockaddr_in sa = {};
+  sa.sin_family = AF_INET;
+  sa.sin_port = htons(port);
+  if (inet_pton(AF_INET, addr, &sa.sin_addr) != 1) { close(fd); return -1; }
+  if (bind(fd, (sockaddr*)&sa, sizeof(sa)) < 0 || listen(fd, 128) < 0) { close(fd); return -1; }
+  return fd;
+}
+
+static void accept_all(int lfd) {
+  for (;;) {
+    const int fd = accept4(lfd, nullptr, nullptr, SOCK_NONBLOCK);
+    if (fd < 0) return;
+    const int one = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+
+    Client* c = new Client;
+    c->fd = fd;
+    c->id = nextClientId++;
+    c->kaTimer.id = c->id;
+    c->kaTimer.fn = keepalive_expired;
+    c->keepAlive = 10;                     // until CONNECT arrives
+    touch(c);
+    clientsById[c->id] = c;
+
+    epoll_event ev = {};
+    ev.events = EPOLLIN;
+    ev.data.ptr = c;
+    epoll_ctl(epfd, EPOLL_CTL_ADD, fd, &ev);
+  }
+}
+
+static void print_stats() {
+  static uint64_t lastIn = 0, lastOut = 0;
+  fprintf(stderr, "clients=%zu in=%llu (%.0f/s) out=%llu (%.0f/s) bytes_out=%llu (%.1f/msg) aliased=%llu dropped=%llu writev=%llu\n",
+          clientsById.size(),
+          (unsigned long long)stats.msgsIn,  (double)(stats.msgsIn - lastIn) / cfg.statsSec,
+          (unsigned long long)stats.msgsOut, (double)(stats.msgsOut - lastOut) / cfg.statsSec,
+          (unsigned long long)stats.bytesOut, stats.msgsOut ? (double)stats.bytesOut / stats.msgsOut : 0.0,
+          (unsigned long long)stats.aliasedOut, (unsigned long long)stats.dropped,
+          (unsigned long long)stats.writevCalls);
+  lastIn = stats.msgsIn;
+  lastOut = stats.msgsOut;
+}
+
+static void usage(const char* argv0) {
+  fprintf(stderr, "usage: %s [-p port] [-b bind_addr] [-u user:pass] [-m max_packet] [-s stats_sec] [-a topic_aliases]\n", argv0);
+}
+
+} // namespace
+
+
+int main(int argc, char** argv) {
+  int opt;
+  while ((opt = getopt(argc, argv, "p:b:u:m:s:a:h")) != -1) {
+    switch (opt) {
+      case 'p': cfg.port = (uint16_t)atoi(optarg); break;
+      case 'b': cfg.bind = optarg; break;
+      case 'u': {
+        const char* colon = strchr(optarg, ':');
+        if (!colon) { usage(argv[0]); return 2; }
+        cfg.user.assign(optarg, colon - optarg);
+        cfg.pass.assign(colon + 1);
+        break;
+      }
+      case 'm': cfg.maxPacket = (uint32_t)atoi(optarg); break;
+      case 's': cfg.statsSec = (uint32_t)atoi(optarg); break;
+      case 'a': cfg.aliasMax = (uint16_t)atoi(optarg); break;
+      default: usage(argv[0]); return 2;
+    }
+  }
+
+  signal(SIGPIPE, SIG_IGN);
+
+  const int lfd = listen_on(cfg.bind, cfg.port);
+  if (lfd < 0) { perror("listen"); return 1; }
+  epfd = epoll_create1(0);
+  epoll_event lev = {};
+  lev.events = EPOLLIN;
+  lev.data.ptr = nullptr;                  // nullptr = listener
+  epoll_ctl(epfd, EPOLL_CTL_ADD, lfd, &lev);
+
+  fprintf(stderr, "h2h_broker: listening on %s:%u\n", cfg.bind, cfg.port);
+
+  wheel.start(now_ms());
+  h2h::TimerNode statsTimer;
+  statsTimer.fn = [](h2h::TimerNode&) { print_stats(); };
+  if (cfg.statsSec) wheel.every(statsTimer, cfg.statsSec * 1000, cfg.statsSec * 1000);
+
+  epoll_event evs[256];
+  for (;;) {
+    uint32_t waitMs = wheel.next_ms(now_ms());
+    if (waitMs > 1000) waitMs = 1000;
+    const int n = epoll_wait(epfd, evs, 256, (int)waitMs);
+    if (n < 0 && errno != EINTR) { perror("epoll_wait"); return 1; }
+
+    for (int i = 0; i < n; i++) {
+      Client* c = (Client*)evs[i].data.ptr;
+      if (!c) { accept_all(lfd); continue; }
+      if (c->closing) continue;
+      if (evs[i].events & (EPOLLERR | EPOLLHUP)) { mark_closing(c); continue; }
+      if (evs[i].events & EPOLLIN)  on_readable(c);
+      if (evs[i].events & EPOLLOUT) mark_dirty(c);
+    }
+
+    wheel.advance(now_ms());
+
+    // close first (wills fan out to the remaining clients), then flush
+    while (!closingClients.empty()) {
+      std::vector<Client*> batch;
+      batch.swap(closingClients);
+      for (Client* c : batch) {
+        if (c->dirty) flush(c);            // e.g. a CONNACK with an error code
+        for (size_t k = 0; k < dirtyClients.size(); k++) {
+          if (dirtyClients[k] == c) { dirtyClients.erase(dirtyClients.begin() + k); break; }
+        }
+        destroy(c, c->will != nullptr);
+      }
+    }
+    for (Client* c : dirtyClients) {
+      c->dirty = false;
+      flush(c);
+    }
+    dirtyClients.clear();
+    // flush() may have found dead sockets
+    while (!closingClients.empty()) {
+      std::vector<Client*> batch;
+      batch.swap(closingClients);
+      for (Client* c : batch) destroy(c, c->will != nullptr);
+    }
+  }
+}
@@ -0,0 +1,424 @@
+// ============================================================
+// broker/h2h_delta.cpp  —  delta patches for the node firmware (host)
+// - diff: old.bin + new.bin -> patch (format and applier: h2h_delta.h)
+//   bsdiff-like: hash-chained 8-byte seeds in the old image, matches
+//   extended with mismatches allowed (moved code, changed addresses) ->
+//   ADD with a mostly-zero diff; what has no match goes out as LIT
+// - the command stream is LZSS-compressed for the 4 KB device window
+// - apply: the device's DeltaApplier on files, patch fed in random chunk
+//   sizes (as it arrives over the network): what passes here passes on
+//   the node, byte for byte
+// - old.bin must be the image the node runs (the .bin of its last flash
+//   or OTA); the node refuses a patch whose old CRC it does not have
+// - diff signs with H2H_OTA_KEY (32 hex, environment: not in the shell
+//   history), apply and info verify with it; the node refuses unsigned
+//   patches and the all-zero key
+// - trigger: publishes "1" on h2h/<house>/sys/ota over MQTT 5 with a MAC
+//   under H2H_MAC_KEY (= MQTT_MAC_KEY); nodes ignore unsigned triggers
+//
+// Build: g++ -O2 -std=c++17 -I. -o h2h_delta broker/h2h_delta.cpp
+// Run:   export H2H_OTA_KEY=<32 hex> H2H_MAC_KEY=<32 hex>
+//        ./h2h_delta diff old.bin new.bin out.h2hd
+//        ./h2h_delta apply old.bin patch.h2hd out.bin
+//        ./h2h_delta info patch.h2hd
+//        ./h2h_delta trigger broker.local[:1883] haus1
+// ============================================================
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <vector>
+
+#include "h2h_delta.h"
+#include "h2h_mac.h"
+#include "h2h_mqtt.h"
+
+
+namespace {
+
+using Bytes = std::vector<uint8_t>;
+
+static const size_t   SEED       = 8;        // bytes hashed per old position
+static const int      HASH_BITS  = 20;
+static const int      CHAIN_MAX  = 32;       // candidates per position
+static const size_t   GIVE_UP    = 64;       // approximate extension: bytes without gain
+static const int      MIN_SCORE  = 24;       // 2 * equal - length, below: literal is cheaper
+
+static bool read_file(const char* path, Bytes& out) {
+  FILE* f = fopen(path, "rb");
+  if (!f) { perror(path); return false; }
+  uint8_t buf[65536];
+  size_t n;
+  while ((n = fread(buf, 1, sizeof(buf), f)) > 0) out.insert(out.end(), buf, buf + n);
+  fclose(f);
+  return true;
+}
+
+static bool write_file(const char* path, const Bytes& data) {
+  FILE* f = fopen(path, "wb");
+  if (!f) { perror(path); return false; }
+  const bool ok = fwrite(data.data(), 1, data.size(), f) == data.size();
+  return fclose(f) == 0 && ok;
+}
+
+static bool ota_key(uint8_t key[h2h::DELTA_KEY_LEN]) {
+  if (h2h::delta_key_from_hex(getenv("H2H_OTA_KEY"), key)) return true;
+  fprintf(stderr, "H2H_OTA_KEY: 32 hex chars expected (not all zero)\n");
+  return false;
+}
+
+static double now_s() {
+  timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static void put_varint(Bytes& out, uint32_t v) {
+  while (v >= 0x80) { out.push_back((uint8_t)(v | 0x80)); v >>= 7; }
+  out.push_back((uint8_t)v);
+}
+
+static uint32_t seed_hash(const uint8_t* p) {
+  uint64_t v;
+  memcpy(&v, p, 8);
+  return (uint32_t)((v * 0x9E3779B97F4A7C15ULL) >> (64 - HASH_BITS));
+}
+
+
+// ============================================================
+//  DIFF (command stream)
+// ============================================================
+
+struct DiffStats {
+  size_t copies = 0, adds = 0, lits = 0;
+  size_t copied = 0, added = 0, literal = 0;
+};
+
+class Differ {
+public:
+  Differ(const Bytes& o, const Bytes& n) : old_(o), new_(n) {}
+
+  Bytes run(DiffStats& st) {
+    index();
+    Bytes cmd;
+    size_t i = 0, litStart = 0;
+    size_t oldCursor = 0;                    // applier's old position after the last COPY/ADD
+    size_t lastOld = 0, lastNew = 0;         // end of the last match: the "same place" guess
+
+    while (i + SEED <= new_.size()) {
+      size_t bestPos = 0, bestLen = 0;
+      int bestScore = 0;
+
+      // same offset as the last match: code after an insertion
+      const size_t aligned = lastOld + (i - lastNew);
+      if (aligned < old_.size()) consider(aligned, i, bestPos, bestLen, bestScore);
+
+      // exact seed matches, longest exact run gets the approximate extension
+      size_t exactPos = 0, exactLen = 0;
+      int steps = 0;
+      for (int32_t c = head_[seed_hash(&new_[i])]; c >= 0 && steps < CHAIN_MAX; c = prev_[c], steps++) {
+        const size_t e = exact(c, i);
+        if (e > exactLen) { exactLen = e; exactPos = (size_t)c; }
+      }
+      if (exactLen >= SEED && exactPos != aligned) consider(exactPos, i, bestPos, bestLen, bestScore);
+
+      if (bestScore < MIN_SCORE) { i++; continue; }
+
+      if (i > litStart) emit_lit(cmd, litStart, i, st);
+      emit_match(cmd, bestPos, i, bestLen, oldCursor, st);
+      oldCursor = bestPos + bestLen;
+      i += bestLen;
+      litStart = i;
+      lastOld = bestPos + bestLen;
+      lastNew = i;
+    }
+    if (new_.size() > litStart) emit_lit(cmd, litStart, new_.size(), st);
+    cmd.push_back(h2h::DELTA_END);
+    return cmd;
+  }
+
+private:
+  void index() {
+    head_.assign((size_t)1 << HASH_BITS, -1);
+    prev_.assign(old_.size(), -1);
+    for (size_t p = 0; p + SEED <= old_.size(); p++) {
+      const uint32_t h = seed_hash(&old_[p]);
+      prev_[p] = head_[h];
+      head_[h] = (int32_t)p;
+    }
+  }
+
+  size_t exact(size_t o, size_t n) const {
+    size_t k = 0;
+    while (o + k < old_.size() && n + k < new_.size() && old_[o + k] == new_[n + k]) k++;
+    return k;
+  }
+
+  // bsdiff's forward extension: the prefix with the best 2 * equal - length
+  void consider(size_t o, size_t n, size_t& bestPos, size_t& bestLen, int& bestScore) const {
+    int s = 0, sf = 0;
+    size_t lenf = 0;
+    for (size_t k = 0; o + k < old_.size() && n + k < new_.size(); k++) {
+      if (old_[o + k] == new_[n + k]) s++;
+      if (2 * s - (int)(k + 1) > 2 * sf - (int)lenf) { sf = s; lenf = k + 1; }
+      if (k + 1 - lenf > GIVE_UP) break;
+    }
+    const int score = 2 * sf - (int)lenf;
+    if (score > bestScore) { bestScore = score; bestPos = o; bestLen = lenf; }
+  }
+
+  void emit_lit(Bytes& cmd, size_t from, size_t to, DiffStats& st) {
+    cmd.push_back(h2h::DELTA_LIT);
+    put_varint(cmd, (uint32_t)(to - from));
+    cmd.insert(cmd.end(), new_.begin() + from, new_.begin() + to);
+    st.lits++;
+    st.literal += to - from;
+  }
+
+  void emit_match(Bytes& cmd, size_t o, size_t n, size_t len, size_t cursor, DiffStats& st) {
+    bool same = true;
+    for (size_t k = 0; k < len && same; k++) same = old_[o + k] == new_[n + k];
+    const int64_t seek = (int64_t)o - (int64_t)cursor;
+    cmd.push_back(same ? h2h::DELTA_COPY : h2h::DELTA_ADD);
+    put_varint(cmd, (uint32_t)len);
+    put_varint(cmd, (uint32_t)(((uint64_t)seek << 1) ^ (uint64_t)(seek >> 63)));   // zigzag
+    if (same) {
+      st.copies++;
+      st.copied += len;
+      return;
+    }
+    for (size_t k = 0; k < len; k++) cmd.push_back((uint8_t)(new_[n + k] - old_[o + k]));
+    st.adds++;
+    st.added += len;
+  }
+
+  const Bytes& old_;
+  const Bytes& new_;
+  std::vector<int32_t> head_, prev_;
+};
+
+
+// ============================================================
+//  LZSS (inverse of DeltaApplier::lz)
+// ============================================================
+
+static Bytes lzss(const Bytes& in) {
+  static const int LZ_BITS = 14;
+  static const int LZ_CHAIN = 128;
+  Bytes out;
+  std::vector<int32_t> head((size_t)1 << LZ_BITS, -1), prev(in.size(), -1);
+  auto h3 = [&](size_t p) {
+    return (uint32_t)((in[p] << 16 | in[p + 1] << 8 | in[p + 2]) * 2654435761u) >> (32 - LZ_BITS);
+  };
+  auto insert = [&](size_t p) {
+    if (p + 3 > in.size()) return;
+    const uint32_t h = h3(p);
+    prev[p] = head[h];
+    head[h] = (int32_t)p;
+  };
+
+  size_t flagAt = 0;
+  int items = 8;
+  size_t i = 0;
+  while (i < in.size()) {
+    if (items == 8) { flagAt = out.size(); out.push_back(0); items = 0; }
+
+    size_t bestLen = 0, bestOff = 0;
+    if (i + h2h::DELTA_MIN_MATCH <= in.size()) {
+      int steps = 0;
+      for (int32_t c = head[h3(i)]; c >= 0 && steps < LZ_CHAIN; c = prev[c], steps++) {
+        const size_t off = i - (size_t)c;
+        if (off > h2h::DELTA_WINDOW) break;
+        size_t k = 0;
+        while (k < h2h::DELTA_MAX_MATCH && i + k < in.size() && in[c + k] == in[i + k]) k++;
+        if (k > bestLen) { bestLen = k; bestOff = off; }
+        if (k == h2h::DELTA_MAX_MATCH) break;
+      }
+    }
+
+    if (bestLen >= h2h::DELTA_MIN_MATCH) {
+      out[flagAt] |= (uint8_t)(0x80 >> items);
+      const size_t o = bestOff - 1;
+      const bool ext = bestLen >= 18;
+      out.push_back((uint8_t)(o >> 4));
+      out.push_back((uint8_t)((o & 15) << 4 | (ext ? 15 : bestLen - h2h::DELTA_MIN_MATCH)));
+      if (ext) out.push_back((uint8_t)(bestLen - 18));
+      for (size_t k = 0; k < bestLen; k++) insert(i + k);
+      i += bestLen;
+    } else {
+      out.push_back(in[i]);
+      insert(i);
+      i++;
+    }
+    items++;
+  }
+  return out;
+}
+
+
+// ============================================================
+//  APPLY (device code on files)
+// ============================================================
+
+struct FileOld {
+  const Bytes& data;
+  bool read(uint32_t off, uint8_t* buf, size_t n) {
+    if (off + n > data.size()) return false;
+    memcpy(buf, data.data() + off, n);
+    return true;
+  }
+};
+
+struct FileOut {
+  Bytes data;
+  bool begin(uint32_t size) { data.clear(); data.reserve(size); return true; }
+  bool write(const uint8_t* p, size_t n) { data.insert(data.end(), p, p + n); return true; }
+};
+
+static int cmd_diff(const char* oldPath, const char* newPath, const char* outPath) {
+  uint8_t key[h2h::DELTA_KEY_LEN];
+  if (!ota_key(key)) return 1;
+  Bytes o, n;
+  if (!read_file(oldPath, o) || !read_file(newPath, n)) return 1;
+
+  const double t0 = now_s();
+  DiffStats st;
+  Differ d(o, n);
+  const Bytes cmd = d.run(st);
+  const Bytes packed = lzss(cmd);
+
+  h2h::DeltaHeader h;
+  h.oldSize = (uint32_t)o.size();
+  h.oldCrc  = h2h::delta_crc32(0, o.data(), o.size());
+  h.newSize = (uint32_t)n.size();
+  h.newCrc  = h2h::delta_crc32(0, n.data(), n.size());
+  h2h::Sha256 sha;
+  sha.update(n.data(), n.size());
+  sha.finish(h.newSha);
+  Bytes patch(h2h::DELTA_HEADER_LEN);
+  h2h::delta_write_header(patch.data(), h);
+  h2h::delta_sign_header(patch.data(), key);
+  patch.insert(patch.end(), packed.begin(), packed.end());
+  if (!write_file(outPath, patch)) return 1;
+
+  printf("old %zu B, new %zu B -> patch %zu B (%.1f %% of new), %.2f s\n",
+         o.size(), n.size(), patch.size(), 100.0 * patch.size() / (n.size() ? n.size() : 1), now_s() - t0);
+  printf("  copy %zu x / %zu B, add %zu x / %zu B, literal %zu x / %zu B, commands %zu B -> lzss %zu B\n",
+         st.copies, st.copied, st.adds, st.added, st.lits, st.literal, cmd.size(), packed.size());
+  return 0;
+}
+
+static int cmd_apply(const char* oldPath, const char* patchPath, const char* outPath) {
+  uint8_t key[h2h::DELTA_KEY_LEN];
+  if (!ota_key(key)) return 1;
+  Bytes o, p;
+  if (!read_file(oldPath, o) || !read_file(patchPath, p)) return 1;
+
+  FileOld src{o};
+  FileOut dst;
+  auto* a = new h2h::DeltaApplier<FileOld, FileOut>(src, dst, key);   // as on the device: not on the stack
+  srand((unsigned)time(nullptr));
+  size_t off = 0;
+  h2h::DeltaStatus s = h2h::DELTA_MORE;
+  while (off < p.size() && s == h2h::DELTA_MORE) {
+    const size_t k = std::min(p.size() - off, (size_t)(1 + rand() % 1460));   // one TCP segment or less
+    s = a->write(p.data() + off, k);
+    off += k;
+  }
+  delete a;
+  printf("%s (%zu of %zu patch bytes used)\n", h2h::delta_status_str(s), off, p.size());
+  if (s != h2h::DELTA_DONE) return 1;
+  return write_file(outPath, dst.data) ? 0 : 1;
+}
+
+static int cmd_info(const char* patchPath) {
+  Bytes p;
+  if (!read_file(patchPath, p)) return 1;
+  h2h::DeltaHeader h;
+  if (p.size() < h2h::DELTA_HEADER_LEN || !h2h::delta_read_header(p.data(), h)) {
+    fprintf(stderr, "%s: not a delta patch\n", patchPath);
+    return 1;
+  }
+  printf("old %u B crc %08x -> new %u B crc %08x, patch %zu B\n",
+         h.oldSize, h.oldCrc, h.newSize, h.newCrc, p.size());
+  printf("new sha256 ");
+  for (uint8_t b : h.newSha) printf("%02x", b);
+  uint8_t key[h2h::DELTA_KEY_LEN];
+  const bool haveKey = h2h::delta_key_from_hex(getenv("H2H_OTA_KEY"), key);
+  const bool ok = haveKey && h2h::delta_verify_header(p.data(), key);
+  printf("\nsignature %s\n", !haveKey ? "not checked (no H2H_OTA_KEY)" : ok ? "ok" : "BAD");
+  return haveKey && !ok ? 1 : 0;
+}
+
+static h2h::MacSigner macSigner;
+
+static size_t mac_props(const char* topic, size_t tlen, const void* payload, size_t len, uint8_t* out, size_t cap) {
+  return macSigner.prop(topic, tlen, payload, len, out, cap);
+}
+
+// signed "1" on h2h/<house>/sys/ota, QoS 1: returns once the broker has it
+static int cmd_trigger(const char* hostPort, const char* house) {
+  if (!macSigner.begin(getenv("H2H_MAC_KEY"))) {
+    fprintf(stderr, "H2H_MAC_KEY: 32 hex chars expected\n");
+    return 1;
+  }
+  char host[128];
+  snprintf(host, sizeof(host), "%s", hostPort);
+  uint16_t port = 1883;
+  if (char* c = strrchr(host, ':')) {
+    *c = 0;
+    port = (uint16_t)atoi(c + 1);
+  }
+  h2h::PosixClient net;
+  h2h::MqttClient<h2h::PosixClient> mqtt(net);
+  mqtt.set_server(host, port);
+  mqtt.set_protocol(5);                       // the MAC is a v5 user property
+  mqtt.set_publish_props(mac_props);
+  char clientId[32];
+  snprintf(clientId, sizeof(clientId), "h2h-delta-%d", (int)getpid());
+  macSigner.next_epoch();
+  if (!mqtt.connect(clientId)) {
+    fprintf(stderr, "connect %s:%u failed\n", host, port);
+    return 1;
+  }
+  char topic[64];
+  snprintf(topic, sizeof(topic), "h2h/%s/sys/ota", house);
+  bool sent = false;
+  for (int i = 0; i < 500; i++) {             // 5 s for CONNACK + PUBACK
+    mqtt.loop();
+    if (mqtt.connected() && !sent) sent = mqtt.publish(topic, "1", false, 1);
+    if (sent && mqtt.inflight() == 0) {
+      printf("%s <- 1 (signed, epoch %u)\n", topic, (unsigned)macSigner.epoch());
+      mqtt.disconnect();
+      return 0;
+    }
+    usleep(10000);
+  }
+  fprintf(stderr, "%s: no PUBACK\n", topic);
+  return 1;
+}
+
+static void usage(const char* argv0) {
+  fprintf(stderr, "usage: %s diff old.bin new.bin out.h2hd\n"
+                  "       %s apply old.bin patch.h2hd out.bin\n"
+                  "       %s info patch.h2hd\n"
+                  "       %s trigger host[:port] house\n"
+                  "H2H_OTA_KEY signs/verifies patches, H2H_MAC_KEY the trigger\n", argv0, argv0, argv0, argv0);
+}
+
+} // namespace
+
+
+int main(int argc, char** argv) {
+  if (argc == 5 && !strcmp(argv[1], "diff"))  return cmd_diff(argv[2], argv[3], argv[4]);
+  if (argc == 5 && !strcmp(argv[1], "apply")) return cmd_apply(argv[2], argv[3], argv[4]);
+  if (argc == 3 && !strcmp(argv[1], "info"))  return cmd_info(argv[2]);
+  if (argc == 4 && !strcmp(argv[1], "trigger")) return cmd_trigger(argv[2], argv[3]);
+  usage(argv[0]);
+  return 2;
+}
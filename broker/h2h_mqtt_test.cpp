@@ -0,0 +1,180 @@
+// ============================================================
+// broker/h2h_mqtt_test.cpp  —  h2h_mqtt.h (PosixClient) against a broker
+// - two clients, subscriber on h2h/test/#, once with 3.1.1 and once with 5
+// - round trip QoS 0/1, PUBACK clears the in-flight slot
+// - v5 topic aliases both ways: publisher sends the topic once, the
+//   subscriber resolves the broker's aliases (fewer bytes per sample)
+// - QoS 1 re-send: connection lost before the PUBACK was read, the
+//   message goes out again (DUP) after the reconnect
+// - a packet larger than RX_SIZE is skipped, the next one arrives intact
+// - exit code 0 = all passed; meant for h2h_broker, mosquitto works too
+//
+// Build: g++ -O2 -std=c++17 -I. -o h2h_mqtt_test broker/h2h_mqtt_test.cpp
+// Run:   ./h2h_broker -p 18830 & ./h2h_mqtt_test -p 18830
+// ============================================================
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <string>
+#include <vector>
+
+#include "h2h_mqtt.h"
+
+
+namespace {
+
+const char* host = "127.0.0.1";
+uint16_t    port = 1883;
+int         failures = 0;
+
+struct Received {
+  std::string topic;
+  std::string payload;
+  uint8_t     qos;
+};
+
+// subscriber: default RX_SIZE (512) like the nodes; publisher: room for the oversize packet
+h2h::PosixClient subNet, pubNet;
+h2h::MqttClient<h2h::PosixClient> sub(subNet);
+h2h::MqttClient<h2h::PosixClient, 512, 2048> pub(pubNet);
+std::vector<Received> inbox;
+
+void on_message(const h2h::MqttMessage& m) {
+  inbox.push_back({ std::string(m.topic, m.topicLen), std::string(m.payload, m.payloadLen), m.qos });
+}
+
+void on_sub_connect() {
+  sub.subscribe("h2h/test/#", 1);
+}
+
+void check(bool ok, int version, const char* what) {
+  printf("%s v%d %s\n", ok ? "ok  " : "FAIL", version, what);
+  if (!ok) failures++;
+}
+
+// clients' loop() until done() or timeout; withPub = false leaves the
+// publisher's socket unread
+template <typename F>
+bool pump(F done, bool withPub = true, uint32_t timeoutMs = 2000) {
+  const uint32_t start = h2h::mqtt_now_ms();
+  for (;;) {
+    sub.loop();
+    if (withPub) pub.loop();
+    if (done()) return true;
+    if (h2h::mqtt_now_ms() - start > timeoutMs) return false;
+    usleep(1000);
+  }
+}
+
+size_t count(const char* topic) {
+  size_t k = 0;
+  for (auto& r : inbox) if (r.topic == topic) k++;
+  return k;
+}
+
+const Received* find(const char* topic) {
+  for (auto& r : inbox) if (r.topic == topic) return &r;
+  return nullptr;
+}
+
+void run(int version) {
+  inbox.clear();
+  sub.set_protocol((uint8_t)version);
+  pub.set_protocol((uint8_t)version);
+  sub.set_server(host, port);
+  pub.set_server(host, port);
+  sub.set_handler(on_message);
+  sub.set_on_connect(on_sub_connect);
+
+  const bool up = sub.connect("h2h-test-sub") && pub.connect("h2h-test-pub") &&
+                  pump([] { return sub.connected() && pub.connected(); });
+  check(up && sub.protocol() == version && pub.protocol() == version, version, "connect");
+  if (!up) return;
+
+  // the broker handles one connection in order: our own publish comes
+  // back only after the SUBSCRIBE is in place
+  sub.publish("h2h/test/ready", "1");
+  check(pump([] { return find("h2h/test/ready") != nullptr; }), version, "subscribe");
+
+  // round trip
+  pub.publish("h2h/test/q0", "zero");
+  pub.publish("h2h/test/q1", "one", false, 1);
+  check(pump([] { return find("h2h/test/q0") && find("h2h/test/q1") && pub.inflight() == 0; }),
+        version, "QoS 0/1 delivered, PUBACK received");
+  const Received* q1 = find("h2h/test/q1");
+  check(q1 && q1->payload == "one" && q1->qos == 1, version, "QoS 1 payload and QoS");
+
+  // aliases: same topic three times, topic string only on the first
+  const uint8_t aliasesOut = pub.aliases_out();
+  uint32_t txBytes[4] = { pub.tx_bytes() };
+  uint32_t rxBytes[4] = { sub.rx_bytes() };
+  for (int i = 1; i <= 3; i++) {
+    char payload[8];
+    snprintf(payload, sizeof(payload), "%d", i);
+    pub.publish("h2h/test/alias/light_adc", payload);
+    const size_t want = (size_t)i;
+    const bool got = pump([want] { return count("h2h/test/alias/light_adc") == want; });
+    txBytes[i] = pub.tx_bytes();
+    rxBytes[i] = sub.rx_bytes();
+    if (!got) break;
+  }
+  check(count("h2h/test/alias/light_adc") == 3 && inbox.back().payload == "3", version,
+        "aliased topic resolved on every sample");
+  if (version == 5) {
+    check(pub.aliases_out() == aliasesOut + 1, version, "publisher: one new alias");
+    check(txBytes[3] - txBytes[2] < txBytes[1] - txBytes[0], version, "publisher: later samples without topic string");
+    check(sub.alias_misses() == 0, version, "subscriber: no alias misses");
+    check(rxBytes[3] - rxBytes[2] < rxBytes[1] - rxBytes[0], version, "subscriber: later samples without topic string");
+  } else {
+    check(pub.aliases_out() == 0, version, "no aliases on 3.1.1");
+  }
+
+  // QoS 1 re-send: the PUBACK stays unread in the socket, then the line drops
+  pub.publish("h2h/test/resend", "again", false, 1);
+  const bool arrived = pump([] { return find("h2h/test/resend") != nullptr; }, false);
+  pubNet.stop();
+  pub.loop();                                             // notices the lost connection
+  check(arrived && pub.inflight() == 1 && !pub.active(), version, "in flight after connection loss");
+  const bool back = pub.connect("h2h-test-pub") &&
+                    pump([] { return pub.connected() && pub.inflight() == 0 && count("h2h/test/resend") == 2; });
+  check(back, version, "re-sent after reconnect, PUBACK received");
+
+  // oversize: 1000 bytes do not fit the subscriber's 512-byte buffer
+  std::string big(1000, 'x');
+  const uint32_t dropped = sub.oversize_dropped();
+  pub.publish("h2h/test/big", (const void*)big.data(), big.size());
+  pub.publish("h2h/test/after", "ok");
+  check(pump([] { return find("h2h/test/after") != nullptr; }), version, "packet after the oversize one delivered");
+  check(sub.oversize_dropped() == dropped + 1 && !find("h2h/test/big"), version, "oversize packet skipped");
+  const Received* after = find("h2h/test/after");
+  check(after && after->payload == "ok" && sub.connected(), version, "stream still in sync");
+
+  sub.disconnect();
+  pub.disconnect();
+}
+
+void usage(const char* argv0) {
+  fprintf(stderr, "usage: %s [-H host] [-p port]\n", argv0);
+}
+
+} // namespace
+
+
+int main(int argc, char** argv) {
+  int o;
+  while ((o = getopt(argc, argv, "H:p:h")) != -1) {
+    switch (o) {
+      case 'H': host = optarg; break;
+      case 'p': port = (uint16_t)atoi(optarg); break;
+      default: usage(argv[0]); return 2;
+    }
+  }
+  run(4);
+  run(5);
+  printf("%s (%d failed)\n", failures ? "FAILED" : "passed", failures);
+  return failures ? 1 : 0;
+}
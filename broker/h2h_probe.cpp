@@ -0,0 +1,195 @@
+// ============================================================
+// broker/h2h_probe.cpp  —  RTT / clock offset to the houses (host)
+// - one more peer of h2h_probe.h: sends h2h/<name>/sys/probe every -i ms,
+//   answers the nodes' requests, prints the per-peer table every -r s
+// - on the broker host it splits a house-to-house RTT into its legs:
+//   haus1 <-> broker and broker <-> haus2
+// - -s: one line per reply (seq, delay, offset) for plotting
+// - -c peer:loop_ms: check that the peer reads requests when they arrive,
+//   not on its loop ticks. Requests go out at random phases; if the
+//   peer's receive stamps t2 cluster modulo loop_ms, the RTT it reports
+//   (and ours) is its sleep, not the network. Exit 0 = ok, 1 = quantized
+//
+// Build: g++ -O2 -std=c++17 -I. -o h2h_probe broker/h2h_probe.cpp
+// Run:   ./h2h_probe [-H 127.0.0.1] [-p 1883] [-n pc] [-i 1000] [-r 10] [-s] [-5] [-c haus1:1000]
+// ============================================================
+
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/select.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <vector>
+
+#include "h2h_probe.h"
+
+
+namespace {
+
+struct Options {
+  const char* host = "127.0.0.1";
+  uint16_t    port = 1883;
+  const char* name = "pc";
+  uint32_t    intervalMs = 1000;
+  uint32_t    reportS = 10;
+  bool        samples = false;
+  uint8_t     protocol = 4;
+  char        checkPeer[16] = {};
+  uint32_t    checkLoopMs = 0;
+};
+
+static const size_t CHECK_SAMPLES = 30;
+static const double CHECK_MAX_CONCENTRATION = 0.5;   // uniform phases, 30 samples: ~0.16
+
+Options opt;
+h2h::PosixClient net;
+h2h::MqttClient<h2h::PosixClient> mqtt(net);
+h2h::ProbeService* probe = nullptr;
+
+// -c: phase of the peer's t2 within its loop period, delay per reply
+double checkCos = 0, checkSin = 0;
+std::vector<double> checkDelaysMs;
+
+struct Stdout {
+  template <typename... A>
+  void printf(const char* f, A... a) { ::printf(f, a...); }
+};
+
+// t2 of a reply "<seq> <t1> <t2> <t3>" from the -c peer
+void check_sample(const h2h::MqttMessage& m, const h2h::ProbeSample& s) {
+  const size_t n = strlen(opt.checkPeer);
+  if (m.topicLen < 4 + n + 1 || memcmp(m.topic + 4, opt.checkPeer, n) != 0 || m.topic[4 + n] != '/') return;
+  char* end;
+  strtoul(m.payload, &end, 10);
+  strtoll(end, &end, 10);
+  const long long t2 = strtoll(end, &end, 10);
+  const long long loopUs = (long long)opt.checkLoopMs * 1000;
+  const double phase = 2 * M_PI * (double)(t2 % loopUs) / (double)loopUs;
+  checkCos += cos(phase);
+  checkSin += sin(phase);
+  checkDelaysMs.push_back(s.delayUs / 1000.0);
+}
+
+// mean resultant length of the phases: 0 = spread over the period, 1 = all on one tick
+int check_result() {
+  const size_t n = checkDelaysMs.size();
+  const double r = sqrt(checkCos * checkCos + checkSin * checkSin) / (double)n;
+  std::sort(checkDelaysMs.begin(), checkDelaysMs.end());
+  const bool quantized = r > CHECK_MAX_CONCENTRATION;
+  printf("%s: %zu replies, delay min %.1fms p50 %.1fms max %.1fms, t2 phase concentration %.2f over %lums: %s\n",
+         opt.checkPeer, n, checkDelaysMs.front(), checkDelaysMs[n / 2], checkDelaysMs.back(), r,
+         (unsigned long)opt.checkLoopMs,
+         quantized ? "QUANTIZED (requests wait for the peer's loop tick)" : "ok");
+  return quantized ? 1 : 0;
+}
+
+void on_message(const h2h::MqttMessage& m) {
+  const int64_t rxUs = h2h::probe_now_us();
+  if (probe->handle(mqtt, m, rxUs) != h2h::PROBE_REPLY) return;
+  const h2h::ProbeSample& s = probe->last_sample();
+  if (opt.checkLoopMs) check_sample(m, s);
+  if (!opt.samples) return;
+  printf("%.*s seq=%lu delay=%.3fms offset=%.3fms\n", (int)m.topicLen, m.topic,
+         strtoul(m.payload, nullptr, 10), s.delayUs / 1000.0, s.offsetUs / 1000.0);
+  fflush(stdout);   // usually piped into a file or plot
+}
+
+void on_connect() {
+  probe->subscribe(mqtt);
+}
+
+void usage(const char* argv0) {
+  fprintf(stderr, "usage: %s [-H host] [-p port] [-n name] [-i interval_ms] [-r report_s] [-s] [-5] [-c peer:loop_ms]\n", argv0);
+}
+
+} // namespace
+
+
+int main(int argc, char** argv) {
+  int o;
+  while ((o = getopt(argc, argv, "H:p:n:i:r:s5c:h")) != -1) {
+    switch (o) {
+      case 'H': opt.host = optarg; break;
+      case 'p': opt.port = (uint16_t)atoi(optarg); break;
+      case 'n': opt.name = optarg; break;
+      case 'i': opt.intervalMs = (uint32_t)atoi(optarg); break;
+      case 'r': opt.reportS = (uint32_t)atoi(optarg); break;
+      case 's': opt.samples = true; break;
+      case '5': opt.protocol = 5; break;
+      case 'c': {
+        const char* colon = strchr(optarg, ':');
+        const size_t n = colon ? (size_t)(colon - optarg) : 0;
+        if (!n || n >= sizeof(opt.checkPeer) || atoi(colon + 1) <= 0) { usage(argv[0]); return 2; }
+        memcpy(opt.checkPeer, optarg, n);
+        opt.checkLoopMs = (uint32_t)atoi(colon + 1);
+        break;
+      }
+      default: usage(argv[0]); return 2;
+    }
+  }
+  if (!opt.intervalMs) opt.intervalMs = 1000;
+  srand((unsigned)getpid());
+
+  h2h::ProbeService service(opt.name);
+  probe = &service;
+  char clientId[48];
+  snprintf(clientId, sizeof(clientId), "h2h-probe-%s-%d", opt.name, (int)getpid());
+
+  mqtt.set_server(opt.host, opt.port);
+  mqtt.set_protocol(opt.protocol);
+  mqtt.set_handler(on_message);
+  mqtt.set_on_connect(on_connect);
+
+  Stdout out;
+  uint32_t nextProbe = h2h::mqtt_now_ms();
+  uint32_t nextReport = nextProbe + opt.reportS * 1000;
+  // -c: a peer that does not answer is an error too, not a pass
+  const uint32_t checkDeadline = nextProbe + (uint32_t)(CHECK_SAMPLES * 3) * (opt.intervalMs + opt.checkLoopMs) + 10000;
+  for (;;) {
+    if (!mqtt.active()) {
+      if (!mqtt.connect(clientId)) {
+        fprintf(stderr, "connect %s:%u failed, retrying\n", opt.host, opt.port);
+        sleep(2);
+        continue;
+      }
+    }
+    mqtt.loop();
+
+    const uint32_t now = h2h::mqtt_now_ms();
+    if (mqtt.connected() && (int32_t)(now - nextProbe) >= 0) {
+      probe->send(mqtt);
+      nextProbe += opt.intervalMs;
+      if ((int32_t)(now - nextProbe) > 0) nextProbe = now + opt.intervalMs;   // fell behind
+      if (opt.checkLoopMs) nextProbe += (uint32_t)rand() % opt.checkLoopMs;     // random phase vs. the peer's loop
+    }
+    if (opt.checkLoopMs) {
+      if (checkDelaysMs.size() >= CHECK_SAMPLES) return check_result();
+      if ((int32_t)(now - checkDeadline) >= 0) {
+        fprintf(stderr, "%s: %zu of %zu replies, giving up\n", opt.checkPeer, checkDelaysMs.size(), CHECK_SAMPLES);
+        return 2;
+      }
+    }
+    if (opt.reportS && (int32_t)(now - nextReport) >= 0) {
+      printf("\n%lu requests sent\n", (unsigned long)probe->sent());
+      probe->report(out);
+      fflush(stdout);
+      nextReport = now + opt.reportS * 1000;
+    }
+
+    // until the next probe or data on the socket
+    const int fd = net.fd();
+    if (fd < 0) continue;
+    int32_t waitMs = (int32_t)(nextProbe - h2h::mqtt_now_ms());
+    if (waitMs < 0) waitMs = 0;
+    if (waitMs > 1000) waitMs = 1000;
+    fd_set rfds;
+    FD_ZERO(&rfds);
+    FD_SET(fd, &rfds);
+    timeval tv = { waitMs / 1000, (waitMs % 1000) * 1000 };
+    select(fd + 1, &rfds, nullptr, nullptr, &tv);
+  }
+}
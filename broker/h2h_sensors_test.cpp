@@ -0,0 +1,169 @@
+// ============================================================
+// broker/h2h_sensors_test.cpp  —  h2h_sensors.h drivers on MockI2cBus
+// - sensor_detect(): SHT3x at 0x44 behind the BME280 / SHT4x probes
+// - SHT3x, SHT4x, BME280 each through begin, start, wait, read:
+//   read before the conversion time fails (SHT NACK, BME reset value),
+//   at the returned wait it gives the scripted values
+// - faults: NACK on start and on read, CRC error in the frame; the next
+//   cycle works again
+// - start() / read() never sleep and make a fixed number of transfers
+//   (no busy-wait on the bus): what loop() / the timer wheel rely on
+// - BME280 compensation against the Bosch datasheet example (T, P) and
+//   the datasheet's floating-point formula (RH)
+// - exit code 0 = all passed
+//
+// Build: g++ -O2 -std=c++17 -I. -o h2h_sensors_test broker/h2h_sensors_test.cpp
+// Run:   ./h2h_sensors_test
+// ============================================================
+
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "h2h_sensors.h"
+
+
+namespace {
+
+int failures = 0;
+
+void check(bool ok, const char* sensor, const char* what) {
+  printf("%s %-7s %s\n", ok ? "ok  " : "FAIL", sensor, what);
+  if (!ok) failures++;
+}
+
+bool near(float a, float b, float tol) { return fabsf(a - b) <= tol; }
+
+// start() + read() must not block: no delay_ms, one write to start,
+// at most a register-pointer write plus one read to fetch
+struct Cost {
+  h2h::MockI2cBus& bus;
+  size_t writes, reads;
+  uint32_t slept;
+  explicit Cost(h2h::MockI2cBus& b) : bus(b), writes(b.writes), reads(b.reads), slept(b.sleptMs) {}
+  bool within(size_t maxWrites, size_t maxReads) const {
+    return bus.sleptMs == slept && bus.writes - writes <= maxWrites && bus.reads - reads <= maxReads;
+  }
+};
+
+// one sensor: wait, early read, values, faults
+void cycle(h2h::MockI2cBus& bus, h2h::EnvSensor& s, uint8_t addr, size_t readWrites,
+           float tempC, float humid, float tempTol, float humidTol) {
+  const char* n = s.name();
+  h2h::SensorReading r = {};
+
+  Cost startCost(bus);
+  const uint32_t wait = s.start();
+  check(wait > 0 && startCost.within(1, 0), n, "start: wait returned, one write, no sleep");
+
+  bus.advance_ms(wait / 2);
+  Cost earlyCost(bus);
+  check(!s.read(r) && earlyCost.within(readWrites, 1), n, "read before the conversion time fails, no sleep");
+
+  bus.advance_ms(wait - wait / 2);
+  Cost readCost(bus);
+  const bool ok = s.read(r);
+  check(ok && readCost.within(readWrites, 1), n, "read at the returned wait, no sleep");
+  check(ok && near(r.tempC, tempC, tempTol) && near(r.humid, humid, humidTol), n, "scripted values");
+
+  // NACK on start: 0 = bus error, the next start works
+  bus.nack_next(addr);
+  check(s.start() == 0, n, "NACK on start -> 0");
+  bus.advance_ms(s.start());
+  check(s.read(r), n, "next cycle after a start NACK");
+
+  // NACK on the read (BME280: on the register-pointer write)
+  bus.advance_ms(s.start());
+  bus.nack_next(addr);
+  check(!s.read(r), n, "NACK on read -> false");
+  bus.advance_ms(s.start());
+  check(s.read(r), n, "next cycle after a read NACK");
+}
+
+void sht_crc_cycle(h2h::MockI2cBus& bus, h2h::EnvSensor& s, uint8_t addr) {
+  h2h::SensorReading r = {};
+  bus.bad_crc_next(addr);
+  bus.advance_ms(s.start());
+  check(!s.read(r), s.name(), "CRC error -> false");
+  bus.advance_ms(s.start());
+  check(s.read(r), s.name(), "next cycle after a CRC error");
+}
+
+void test_detect() {
+  h2h::MockI2cBus bus;
+  bus.add_sht(0x44, false, 21.5f, 48.0f);
+  h2h::EnvSensor* s = h2h::sensor_detect(bus);
+  check(s && strcmp(s->name(), "SHT3x") == 0, "detect", "SHT3x at 0x44 (NACKs the SHT4x probe)");
+}
+
+void test_sht3x() {
+  h2h::MockI2cBus bus;
+  bus.add_sht(0x45, false, 21.5f, 48.0f);
+  h2h::Sht3x s(bus, 0x45);
+  check(s.begin(), s.name(), "begin (serial number, CRC ok)");
+  cycle(bus, s, 0x45, 0, 21.5f, 48.0f, 0.01f, 0.01f);
+  sht_crc_cycle(bus, s, 0x45);
+}
+
+void test_sht4x() {
+  h2h::MockI2cBus bus;
+  bus.add_sht(0x44, true, -5.25f, 91.0f);
+  h2h::Sht4x s(bus, 0x44);
+  check(s.begin(), s.name(), "begin (serial number, CRC ok)");
+  cycle(bus, s, 0x44, 0, -5.25f, 91.0f, 0.01f, 0.01f);
+  sht_crc_cycle(bus, s, 0x44);
+
+  bus.nack_next(0x44);
+  check(!s.begin(), s.name(), "begin: NACK -> not detected");
+}
+
+// Bosch BMP280/BME280 datasheet example: T = 25.08 degC, p = 100653.27 Pa
+void put16(uint8_t* r, int v) { r[0] = (uint8_t)v; r[1] = (uint8_t)(v >> 8); }
+
+void test_bme280() {
+  h2h::MockI2cBus bus;
+  uint8_t* regs = bus.add_bme280(0x76);
+  const int cal[12] = { 27504, 26435, -1000, 36477, -10685, 3024, 2855, 140, -7, 15500, -14600, 6000 };
+  for (int i = 0; i < 12; i++) put16(regs + 0x88 + 2 * i, cal[i]);
+  const int H1 = 75, H2 = 362, H3 = 0, H4 = 313, H5 = 50, H6 = 30;
+  regs[0xA1] = H1;
+  put16(regs + 0xE1, H2);
+  regs[0xE3] = H3;
+  regs[0xE4] = (uint8_t)(H4 >> 4);
+  regs[0xE5] = (uint8_t)((H4 & 0x0F) | ((H5 & 0x0F) << 4));
+  regs[0xE6] = (uint8_t)(H5 >> 4);
+  regs[0xE7] = (uint8_t)H6;
+  const int32_t adcT = 519888, adcP = 415148, adcH = 30000;
+  bus.set_bme_adc(0x76, adcP, adcT, adcH);
+
+  // datasheet 8.1, double precision; t_fine of the example is 128422
+  double h = 128422.0 - 76800.0;
+  h = (adcH - (H4 * 64.0 + H5 / 16384.0 * h)) * (H2 / 65536.0 * (1.0 + H6 / 67108864.0 * h * (1.0 + H3 / 67108864.0 * h)));
+  h = h * (1.0 - H1 * h / 524288.0);
+
+  h2h::Bme280 s(bus, 0x76);
+  Cost beginCost(bus);
+  check(s.begin() && bus.sleptMs == beginCost.slept, s.name(), "begin (chip id, calibration, no sleep)");
+  cycle(bus, s, 0x76, 1, 25.08f, (float)h, 0.005f, 0.05f);
+
+  h2h::SensorReading r = {};
+  bus.advance_ms(s.start());
+  check(s.read(r) && r.hasPress && near(r.pressHpa, 1006.5327f, 0.01f), s.name(), "pressure (datasheet example)");
+
+  regs[0xD0] = 0x58;                                   // BMP280: no humidity
+  h2h::Bme280 other(bus, 0x76);
+  check(!other.begin(), s.name(), "begin: wrong chip id -> not detected");
+}
+
+} // namespace
+
+
+int main() {
+  test_detect();
+  test_sht3x();
+  test_sht4x();
+  test_bme280();
+  printf("%s (%d failed)\n", failures ? "FAILED" : "passed", failures);
+  return failures ? 1 : 0;
+}
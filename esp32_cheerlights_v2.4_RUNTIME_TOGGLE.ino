@@ -7,6 +7,21 @@
  * - nth LED shows custom color from web (always, in all modes)
  * - LED count configurable via web interface
  * - Colors normalized to same perceived brightness
+ * - Prometheus metrics on /metrics
+ * - Loop tracing: /trace?on=1, /trace (Chrome JSON), /trace?on=0
+ * - Heap/String profile: /heap (Serial 'h'), per-site lines in /metrics
+ * - Netzwerk-Task auf Core 0 (HTTP, Webserver, Buttons, LDR),
+ *   Render-Task auf Core 1 (einziger Zugriff auf den Strip, 50 fps)
+ * - Helligkeit in einem Durchgang über den ganzen Frame (h2h_pixels.h,
+ *   Benchmark über Serial 'p')
+ * - Periodische Updates (CheerLights, Custom Colors, LDR) über ein Timer-Rad
+ * - DNS-Cache (h2h_dns.h): Hosts werden im Hintergrund vor Ablauf der TTL
+ *   neu aufgelöst, der HTTP-Abruf verbindet direkt auf die Adresse
+ * - Delta-OTA (h2h_ota.h): /ota (Digest-Auth, Benutzer "ota", Passwort
+ *   OTA_KEY) oder Serial 'u' holt einen Patch von OTA_DELTA_URL, prüft
+ *   die Signatur (OTA_KEY) und schreibt das neue Image in den anderen Slot
+ * - Stall-Erkennung (h2h_stall.h): Netz-/Render-Durchläufe über
+ *   STALL_*_MS, pro Trace-Scope in /metrics und über Serial 's'
  * 
  * Display Modes (Button 2 = short press to cycle):
  * - Mode 0: All LEDs show current CheerLights color (default)
@@ -23,11 +38,22 @@
 #include <WiFi.h>
 #include <WiFiManager.h>
 #include <HTTPClient.h>
+#include <WiFiClientSecure.h>
 #include <ArduinoJson.h>
 #include <Adafruit_NeoPixel.h>
 #include <Preferences.h>
 #include <WebServer.h>
 
+#include "h2h_metrics.h"
+#include "h2h_trace.h"
+#include "h2h_heap.h"
+#include "h2h_spsc.h"
+#include "h2h_pixels.h"
+#include "h2h_timer.h"
+#include "h2h_dns.h"
+#include "h2h_ota.h"
+#include "h2h_stall.h"
+
 // ==================== KONFIGURATION ====================
 #define VERSION "v2.3"             // Version String für HTML
 #define SHOW_DEBUG false           // true = Debug-Sektion anzeigen, false = verstecken
@@ -49,11 +75,28 @@
 #define LDR_DARK_THRESHOLD 500           // ADC-Wert: dunkel (0-4095 Skala)
 #define LDR_BRIGHT_THRESHOLD 3000        // ADC-Wert: hell
 
+// Tasks: Netzwerk auf Core 0, Rendern auf Core 1
+#define NET_CORE 0
+#define RENDER_CORE 1
+#define NET_TASK_STACK 10240             // HTTPS braucht Platz
+#define RENDER_TASK_STACK 4096
+#define RENDER_INTERVAL_MS 20            // 50 fps Frame-Takt
+#define BRIGHTNESS_STEP_INTERVAL 100     // smoothBrightnessTransition alle 100ms (wie früher pro Loop)
+#define MODE_BLINK_INTERVAL 200          // Mode-Feedback: 200ms an / 200ms aus
+#define NET_TIMER_TICK_MS 10             // Auflösung des Timer-Rads (Netz-Task)
+#define STALL_NET_MS 1000                // HTTPS-Abruf ~0.5 s ist normal, darüber = Stall
+#define STALL_RENDER_MS (2 * RENDER_INTERVAL_MS)   // ein verlorener Frame
+#define NET_POLL_MS 100                  // Webserver/Buttons werden weiterhin gepollt
+#define OTA_DELTA_URL "http://broker.local:8000/cheerlights.h2hd"   // broker/h2h_delta.cpp
+#define OTA_KEY "00000000000000000000000000000000"   // = H2H_OTA_KEY von `h2h_delta diff`, alles 0 = kein OTA (nicht ins Repo!)
+
 // ==================== GLOBALE VARIABLEN ====================
 Preferences preferences;
 WiFiManager wifiManager;
 Adafruit_NeoPixel *strip = nullptr;
 WebServer server(80);
+WiFiUDP dnsUdp;
+h2h::DnsCache<WiFiUDP> dnsCache(dnsUdp);   // ThingSpeak + Hosts der Custom-URLs
 
 int numLEDs = 10;              // Default: 10 LEDs
 String customColorURL_LED0 = "https://example.com/led0.txt";  // URL für LED 0
@@ -63,9 +106,6 @@ bool customLEDNEnabled = true;  // Runtime: LED n Custom aktiviert?
 uint32_t cheerLightsColor = 0;
 uint32_t customColorLED0 = 0;    // Custom Color für LED 0
 uint32_t customColorLEDN = 0;    // Custom Color für LED n
-unsigned long lastCheerLightsUpdate = 0;
-unsigned long lastCustomColorUpdate0 = 0;  // Für LED 0
-unsigned long lastCustomColorUpdateN = 0;  // Für LED n
 unsigned long lastColorChange = 0;  // Für Mode 2: Timestamp der letzten Farbänderung
 const unsigned long updateInterval = 30000;  // Update alle 30 Sekunden
 
@@ -74,9 +114,8 @@ int displayMode = 0;
 uint32_t colorHistory[50] = {0};  // History für shift-along (max 50 CheerLights LEDs)
 
 // LDR und Auto-Brightness
-unsigned long lastLDRRead = 0;
-int currentBrightness = BRIGHTNESS_MAX;
-int targetBrightness = BRIGHTNESS_MAX;  // Ziel-Helligkeit für smooth transition
+std::atomic<int> currentBrightness{BRIGHTNESS_MAX};  // schreibt nur der Render-Task
+std::atomic<int> targetBrightness{BRIGHTNESS_MAX};   // Ziel-Helligkeit für smooth transition (Netz-Task)
 int currentLDRValue = 0;  // Aktueller LDR-Wert für Anzeige
 bool ldrEnabled = true;  // LDR an/aus (kann im Web getoggelt werden)
 
@@ -86,12 +125,60 @@ int brightnessMax = BRIGHTNESS_MAX;
 int ldrDarkThreshold = LDR_DARK_THRESHOLD;
 int ldrBrightThreshold = LDR_BRIGHT_THRESHOLD;
 
+// Metriken (siehe /metrics)
+static h2h::Counter   mHttpFetch      ("http_fetch_total",       "HTTP color fetches");
+static h2h::Counter   mHttpFetchError ("http_fetch_error_total", "HTTP color fetches without usable result");
+static h2h::Histogram mCheerFetchMs   ("cheerlights_fetch_ms",   "updateCheerLights HTTP latency", h2h::BUCKETS_MS);
+static h2h::Histogram mCustomFetchMs  ("custom_fetch_ms",        "Custom color HTTP latency", h2h::BUCKETS_MS);
+static h2h::Counter   mDnsQueries     ("dns_queries_total",      "DNS queries sent by the cache (refresh + retry)");
+static h2h::Counter   mDnsFailures    ("dns_failures_total",     "DNS timeouts / errors (last good address kept)");
+static h2h::Counter   mDnsStale       ("dns_stale_served_total", "Fetches on a last-known-good address past its TTL");
+static h2h::Histogram mShowUs         ("led_show_us",            "strip->show duration", h2h::BUCKETS_US);
+static h2h::Counter   mWebRequests    ("web_requests_total",     "Handled web server requests");
+static h2h::Gauge     mBrightness     ("brightness",             "Current strip brightness (0-255)");
+static h2h::Gauge     mLdr            ("ldr_adc",                "Last LDR reading (0-4095)");
+static h2h::Gauge     mWifiRssi       ("wifi_rssi_dbm",          "WiFi RSSI");
+static h2h::Counter   mFrames         ("render_frames_total",    "Frames shown by the render task");
+static h2h::Counter   mFrameDrop      ("frame_queue_drop_total", "Frames dropped because the queue was full");
+static h2h::Counter   mRenderLate     ("render_late_total",      "Render ticks more than one period late");
+static h2h::Histogram mRenderJitter   ("render_jitter_us",       "Deviation of the render period from RENDER_INTERVAL_MS", h2h::BUCKETS_US);
+static h2h::StallMonitor stallNet     ("net",    STALL_NET_MS);
+static h2h::StallMonitor stallRender  ("render", STALL_RENDER_MS);
+
+// Was angezeigt werden soll. Baut der Netz-Task, der Render-Task bekommt
+// eine Kopie über die SPSC-Queue; nach dem Einreihen wird nichts mehr geändert.
+struct LedFrame {
+  uint8_t  displayMode;
+  bool     customLED0;
+  bool     customLEDN;
+  uint8_t  blinks;               // > 0: Mode-Feedback (n x lila blinken)
+  uint32_t cheerLightsColor;
+  uint32_t customColorLED0;
+  uint32_t customColorLEDN;
+  uint32_t colorHistory[50];
+};
+
+h2h::SpscQueue<LedFrame, 4> frameQueue;
+LedFrame lastQueuedFrame;        // nur Netz-Task
+uint8_t pendingBlinks = 0;       // nur Netz-Task
+
+// Netz-Task braucht den Strip kurz selbst (Button-Feedback, Config-Portal)
+// Generation statt Flag: eine Quittung vom vorigen Halt zählt nicht für den nächsten
+std::atomic<uint32_t> renderHoldGen{0};   // 0 = kein Halt angefordert
+std::atomic<uint32_t> renderHeldGen{0};   // vom Render-Task quittierte Generation
+TaskHandle_t netTaskHandle = nullptr;
+
+// Periodische Updates des Netz-Tasks (nur Netz-Task)
+h2h::TimerWheel<> netTimers(NET_TIMER_TICK_MS);
+h2h::TimerNode tmrCheerLights, tmrCustom0, tmrCustomN, tmrLdr, tmrOta;
+TaskHandle_t renderTaskHandle = nullptr;
+
 // Function declarations
 bool isHexColor(String str);
 uint32_t normalizeColorBrightness(uint32_t color, uint8_t targetBrightness);
 void checkModeButton();
 void updateBrightnessFromLDR();
-void smoothBrightnessTransition();
+bool smoothBrightnessTransition();
 String getColorName(uint32_t color);
 bool isLightColor(uint32_t color);
 String colorToHex(uint32_t color);
@@ -142,7 +229,7 @@ void setup() {
   strip = new Adafruit_NeoPixel(numLEDs, LED_PIN, NEO_GRB + NEO_KHZ800);
   strip->begin();
   strip->setBrightness(currentBrightness);
-  targetBrightness = currentBrightness; // Initial gleich setzen
+  targetBrightness = currentBrightness.load(); // Initial gleich setzen
   strip->show();
   
   // Initial LDR-Wert lesen (auch wenn deaktiviert, für Anzeige)
@@ -159,6 +246,8 @@ void setup() {
 
   // WiFi verbinden
   connectWiFi();
+  dnsCache.set_server(WiFi.dnsIP().toString().c_str());
+  dnsCache.add("api.thingspeak.com");   // Custom-URLs kommen beim ersten Abruf dazu
 
   // Web Server starten
   setupWebServer();
@@ -200,12 +289,192 @@ void setup() {
   }
   #endif
   
+  // Ab hier fasst nur noch der Render-Task den Strip an
+  queueFrame();
+  xTaskCreatePinnedToCore(renderTask, "render", RENDER_TASK_STACK, nullptr, 2, &renderTaskHandle, RENDER_CORE);
+  xTaskCreatePinnedToCore(netTask, "net", NET_TASK_STACK, nullptr, 1, &netTaskHandle, NET_CORE);
+
   Serial.println("Setup complete!");
 }
 
 // ==================== MAIN LOOP ====================
 void loop() {
-  server.handleClient();
+  // Arbeit läuft in netTask (Core 0) und renderTask (Core 1)
+  vTaskDelete(nullptr);
+}
+
+// ==================== TASKS ====================
+
+void netTask(void*) {
+  // Erste Updates liefen schon in setup()
+  tmrCheerLights.fn = [](h2h::TimerNode&) { updateCheerLights(); };
+  tmrCustom0.fn     = [](h2h::TimerNode&) { if (customLED0Enabled) updateCustomColorLED0(); };
+  tmrCustomN.fn     = [](h2h::TimerNode&) { if (customLEDNEnabled) updateCustomColorLEDN(); };
+  tmrLdr.fn         = [](h2h::TimerNode&) { updateBrightnessFromLDR(); };
+  tmrOta.fn         = [](h2h::TimerNode&) { runDeltaOta(); };
+
+  netTimers.start(millis());
+  netTimers.every(tmrCheerLights, updateInterval, updateInterval);
+  #if CUSTOM_LED_0_ENABLED
+  netTimers.every(tmrCustom0, updateInterval, updateInterval);
+  #endif
+  #if CUSTOM_LED_N_ENABLED
+  netTimers.every(tmrCustomN, updateInterval, updateInterval);
+  #endif
+  netTimers.every(tmrLdr, LDR_SAMPLE_INTERVAL, LDR_SAMPLE_INTERVAL);
+
+  stallNet.attach();
+  for (;;) {
+    {
+      h2h::StallScope iteration(stallNet);
+      netLoop();
+    }
+    serialPoll();
+    // bis zur nächsten Deadline, höchstens NET_POLL_MS (Webserver/Buttons)
+    uint32_t sleepMs = netTimers.next_ms(millis());
+    if (sleepMs > NET_POLL_MS) sleepMs = NET_POLL_MS;
+    vTaskDelay(pdMS_TO_TICKS(sleepMs) ? pdMS_TO_TICKS(sleepMs) : 1);
+  }
+}
+
+// Fester Frame-Takt: HTTP-Timeouts (bis 10s) verzögern Daten, aber keine Frames
+void renderTask(void*) {
+  const int32_t periodUs = RENDER_INTERVAL_MS * 1000;
+  TickType_t wake = xTaskGetTickCount();
+  uint32_t lastUs = micros();
+  unsigned long lastBrightnessStep = millis();
+  unsigned long blinkPhaseStart = 0;
+  uint8_t blinkPhases = 0;       // gerade = an, ungerade = aus
+  LedFrame frame;
+  bool haveFrame = false;
+  bool wasHeld = false;
+
+  // Ab hier skaliert renderFrame() die Helligkeit selbst (px_scale)
+  strip->setBrightness(255);
+
+  stallRender.attach();
+  for (;;) {
+    vTaskDelayUntil(&wake, pdMS_TO_TICKS(RENDER_INTERVAL_MS));
+
+    uint32_t nowUs = micros();
+    int32_t period = (int32_t)(nowUs - lastUs);
+    lastUs = nowUs;
+    mRenderJitter.observe((uint32_t)abs(period - periodUs));
+    if (period > 2 * periodUs) mRenderLate.inc();
+
+    const uint32_t hold = renderHoldGen.load();
+    if (hold) {
+      renderHeldGen.store(hold);
+      wasHeld = true;
+      continue;
+    }
+
+    h2h::StallScope iteration(stallRender);
+    H2H_TRACE_SCOPE("render");
+    bool dirty = wasHeld;
+    wasHeld = false;
+
+    LedFrame next;
+    while (frameQueue.pop(next)) {
+      if (next.blinks) {
+        blinkPhases = next.blinks * 2;
+        blinkPhaseStart = millis();
+      }
+      frame = next;
+      haveFrame = true;
+      dirty = true;
+    }
+    if (!haveFrame) continue;
+
+    if (millis() - lastBrightnessStep >= BRIGHTNESS_STEP_INTERVAL) {
+      lastBrightnessStep = millis();
+      if (smoothBrightnessTransition()) dirty = true;
+    }
+
+    if (blinkPhases && millis() - blinkPhaseStart >= MODE_BLINK_INTERVAL) {
+      blinkPhases--;
+      blinkPhaseStart = millis();
+      dirty = true;
+    }
+
+    if (dirty) {
+      renderFrame(frame, blinkPhases > 0 && blinkPhases % 2 == 0);
+      mFrames.inc();
+    }
+  }
+}
+
+// Render-Task anhalten, bis renderResume() (nur aus dem Netz-Task)
+// Während der Pause gilt wieder die Adafruit-Helligkeit (setPixelColor skaliert)
+void renderPause() {
+  if (!renderTaskHandle) return;  // Setup: Tasks laufen noch nicht
+  static uint32_t gen = 0;
+  if (++gen == 0) gen = 1;
+  renderHoldGen.store(gen);
+  while (renderHeldGen.load() != gen) vTaskDelay(1);
+  strip->setBrightness(currentBrightness);
+}
+
+void renderResume() {
+  if (renderTaskHandle) strip->setBrightness(255);  // Render-Task skaliert selbst
+  renderHoldGen.store(0);
+}
+
+// Aktuellen Zustand als Frame einreihen (nur bei Änderung)
+void queueFrame() {
+  LedFrame f;
+  memset(&f, 0, sizeof(f));
+  f.displayMode = displayMode;
+  #if CUSTOM_LED_0_ENABLED
+  f.customLED0 = customLED0Enabled;
+  #endif
+  #if CUSTOM_LED_N_ENABLED
+  f.customLEDN = customLEDNEnabled;
+  #endif
+  f.cheerLightsColor = cheerLightsColor;
+  f.customColorLED0 = customColorLED0;
+  f.customColorLEDN = customColorLEDN;
+  memcpy(f.colorHistory, colorHistory, sizeof(f.colorHistory));
+
+  if (pendingBlinks == 0 && memcmp(&f, &lastQueuedFrame, sizeof(f)) == 0) return;
+
+  f.blinks = pendingBlinks;
+  if (!frameQueue.push(f)) {
+    mFrameDrop.inc();     // nächster Versuch im nächsten netLoop
+    return;
+  }
+  f.blinks = 0;
+  lastQueuedFrame = f;
+  pendingBlinks = 0;
+}
+
+// Delta-OTA im Netz-Task: blockiert Downloads/Webserver, der Render-Task läuft weiter
+void runDeltaOta() {
+  H2H_TRACE_SCOPE("ota");
+  if (h2h::ota_delta_http(OTA_DELTA_URL, OTA_KEY, Serial) != h2h::DELTA_DONE) return;
+  delay(200);
+  ESP.restart();
+}
+
+// Diagnose-Kommandos über Serial ('t'/'d'/'c' Trace, 'h' Heap, 's' Stalls, 'u' Delta-OTA)
+void serialPoll() {
+  while (Serial.available() > 0) {
+    int c = Serial.read();
+    if (c == 'u') { netTimers.schedule(tmrOta, 0); continue; }
+    if (h2h::stall_serial_cmd(c)) continue;
+    if (!h2h::trace_serial_cmd(c) && !h2h::heap_serial_cmd(c)) h2h::pixels_serial_cmd(c);
+  }
+}
+
+void netLoop() {
+  H2H_TRACE_SCOPE("net");
+  {
+    H2H_TRACE_SCOPE("server.handleClient");
+    server.handleClient();
+  }
+
+  // DNS-Antworten abholen, fällige Einträge neu anfragen
+  dnsCache.loop();
   
   // Check Button für Config-Mode
   if (checkButtonHold()) {
@@ -215,40 +484,19 @@ void loop() {
   // Check Mode Button für Mode-Wechsel
   checkModeButton();
   
-  // LDR-basierte Helligkeitsanpassung
-  updateBrightnessFromLDR();
-  
-  // Smooth brightness transition (jeden Loop)
-  smoothBrightnessTransition();
+  // Regelmäßige Updates (CheerLights, Custom Colors, LDR)
+  netTimers.advance(millis());
 
-  // Regelmäßige Updates
-  unsigned long now = millis();
-  
-  if (now - lastCheerLightsUpdate > updateInterval) {
-    updateCheerLights();
-  }
-  
-  #if CUSTOM_LED_0_ENABLED
-  if (customLED0Enabled && now - lastCustomColorUpdate0 > updateInterval) {
-    updateCustomColorLED0();
-  }
-  #endif
-  
-  #if CUSTOM_LED_N_ENABLED
-  if (customLEDNEnabled && now - lastCustomColorUpdateN > updateInterval) {
-    updateCustomColorLEDN();
-  }
-  #endif
+  // Änderungen an den Render-Task
+  queueFrame();
 
-  // LEDs aktualisieren
-  updateLEDs();
-  
-  delay(100);
+  h2h::heap_loop();
 }
 
 // ==================== FUNKTIONEN ====================
 
 void startupAnimation() {
+  H2H_TRACE_SCOPE("startupAnimation");
   // Array mit allen CheerLights-Farben (distinkt und unterscheidbar!)
   const int numColors = 11;
   uint32_t cheerColors[numColors] = {
@@ -303,7 +551,9 @@ void startupAnimation() {
 }
 
 bool checkButtonHold() {
+  H2H_TRACE_SCOPE("checkButtonHold");
   if (digitalRead(BUTTON_PIN) == LOW) {
+    renderPause();
     unsigned long pressStart = millis();
     
     // Visuelles Feedback
@@ -328,12 +578,14 @@ bool checkButtonHold() {
     // Button zu kurz gedrückt
     strip->clear();
     strip->show();
+    renderResume();
   }
   return false;
 }
 
 
 void checkModeButton() {
+  H2H_TRACE_SCOPE("checkModeButton");
   static bool lastButtonState = HIGH;
   static unsigned long lastDebounceTime = 0;
   const unsigned long debounceDelay = 50;
@@ -375,27 +627,8 @@ void checkModeButton() {
         lastColorChange = millis();
       }
       
-      // Visuelles Feedback: Anzahl Blinks = Mode
-      for(int i = 0; i < displayMode + 1; i++) {
-        for(int j = 0; j < numLEDs; j++) {
-          // Alle LEDs außer aktive Custom blinken
-          bool isCustom = false;
-          #if CUSTOM_LED_0_ENABLED
-          if (j == 0 && customLED0Enabled) isCustom = true;
-          #endif
-          #if CUSTOM_LED_N_ENABLED
-          if (j == numLEDs - 1 && customLEDNEnabled) isCustom = true;
-          #endif
-          
-          if (!isCustom) {
-            strip->setPixelColor(j, strip->Color(50, 0, 50));
-          }
-        }
-        strip->show();
-        delay(200);
-        updateLEDs();  // Zurück zu normal
-        delay(200);
-      }
+      // Visuelles Feedback: Anzahl Blinks = Mode (blinkt der Render-Task)
+      pendingBlinks = displayMode + 1;
     }
   }
   
@@ -403,7 +636,9 @@ void checkModeButton() {
 }
 
 void enterConfigMode() {
+  H2H_TRACE_SCOPE("enterConfigMode");
   Serial.println("Config-Mode aktiviert!");
+  renderPause();  // endet ohnehin mit ESP.restart()
   
   // LEDs orange blinken lassen
   for(int i = 0; i < 5; i++) {
@@ -430,6 +665,7 @@ void enterConfigMode() {
 }
 
 void connectWiFi() {
+  H2H_TRACE_SCOPE("connectWiFi");
   Serial.println("Verbinde mit WiFi...");
   
   // AutoConnect mit gespeicherten Credentials
@@ -457,25 +693,60 @@ void connectWiFi() {
   }
 }
 
+// Verbindung mit der Adresse aus dem DNS-Cache selbst aufbauen, HTTPClient
+// übernimmt die offene Verbindung: kein DNS im Abruf. Ohne Cache-Eintrag
+// (erster Abruf) oder wenn die Adresse nicht antwortet: normales http.begin(url).
+// tcp/tls müssen länger leben als http (vor http deklarieren).
+bool httpBegin(HTTPClient& http, WiFiClient& tcp, WiFiClientSecure& tls, const String& url) {
+  const bool https = url.startsWith("https://");
+  const int hostStart = url.indexOf("://") + 3;
+  if (hostStart < 3) return http.begin(url);
+
+  unsigned hostEnd = hostStart;
+  while (hostEnd < url.length() && url[hostEnd] != '/' && url[hostEnd] != ':') hostEnd++;
+  const String host = url.substring(hostStart, hostEnd);
+  uint16_t port = https ? 443 : 80;
+  if (hostEnd < url.length() && url[hostEnd] == ':') port = url.substring(hostEnd + 1).toInt();
+
+  IPAddress ip;
+  if (!dnsCache.lookup(host.c_str(), ip)) return http.begin(url);
+
+  bool ok;
+  if (https) {
+    tls.setInsecure();   // wie bisher: http.begin(url) ohne CA prüft kein Zertifikat
+    ok = tls.connect(ip, port, host.c_str(), nullptr, nullptr, nullptr);   // Host für SNI
+  } else {
+    ok = tcp.connect(ip, port);
+  }
+  if (!ok) return http.begin(url);
+  return http.begin(https ? (WiFiClient&)tls : tcp, url);
+}
+
 void updateCheerLights() {
+  H2H_TRACE_SCOPE("updateCheerLights");
+  H2H_HEAP_SITE("updateCheerLights");
   if (WiFi.status() != WL_CONNECTED) {
     Serial.println("WiFi not connected - skipping CheerLights update");
-    lastCheerLightsUpdate = millis();
     return;
   }
   
   Serial.println("\n=== Updating CheerLights ===");
+  WiFiClient tcp;
+  WiFiClientSecure tls;
   HTTPClient http;
   
   // CheerLights API
-  http.begin("https://api.thingspeak.com/channels/1417/field/2/last.json");
+  httpBegin(http, tcp, tls, "https://api.thingspeak.com/channels/1417/field/2/last.json");
   http.setTimeout(10000);
+  mHttpFetch.inc();
+  unsigned long fetchStart = millis();
   int httpCode = http.GET();
   
   Serial.printf("HTTP Code: %d\n", httpCode);
   
   if (httpCode == 200) {
     String payload = http.getString();
+    mCheerFetchMs.observe(millis() - fetchStart);
     Serial.printf("Raw JSON: %s\n", payload.c_str());
     
     // JSON parsen
@@ -484,6 +755,7 @@ void updateCheerLights() {
     
     if (error) {
       Serial.printf("JSON Parse Error: %s\n", error.c_str());
+      mHttpFetchError.inc();
     } else {
       String colorName = doc["field2"].as<String>();
       colorName.trim();
@@ -521,11 +793,11 @@ void updateCheerLights() {
       }
       
       cheerLightsColor = newColor;
-      lastCheerLightsUpdate = millis();
       Serial.println("CheerLights update successful!");
     }
   } else {
     Serial.printf("HTTP Error: %d\n", httpCode);
+    mHttpFetchError.inc();
   }
   
   http.end();
@@ -559,29 +831,34 @@ void updateCheerLights() {
 }
 
 void updateCustomColorLED0() {
+  H2H_TRACE_SCOPE("updateCustomColorLED0");
+  H2H_HEAP_SITE("updateCustomColorLED0");
   if (WiFi.status() != WL_CONNECTED) {
     Serial.println("WiFi not connected - skipping LED0 Custom Color");
-    lastCustomColorUpdate0 = millis();
     return;
   }
   if (customColorURL_LED0.length() < 10) {
     Serial.println("LED0 URL too short - skipping");
-    lastCustomColorUpdate0 = millis();
     return;
   }
   
   Serial.println("\n=== Updating Custom Color LED0 ===");
   Serial.printf("URL: %s\n", customColorURL_LED0.c_str());
   
+  WiFiClient tcp;
+  WiFiClientSecure tls;
   HTTPClient http;
-  http.begin(customColorURL_LED0);
+  httpBegin(http, tcp, tls, customColorURL_LED0);
   http.setTimeout(5000);
+  mHttpFetch.inc();
+  unsigned long fetchStart = millis();
   int httpCode = http.GET();
   
   Serial.printf("HTTP Code: %d\n", httpCode);
   
   if (httpCode == 200) {
     String payload = http.getString();
+    mCustomFetchMs.observe(millis() - fetchStart);
     payload.trim();
     
     if (payload.startsWith("#")) {
@@ -606,40 +883,46 @@ void updateCustomColorLED0() {
       Serial.println("LED0 Custom Color update successful!");
     } else {
       Serial.printf("ERROR: Invalid hex length: %d\n", payload.length());
+      mHttpFetchError.inc();
     }
   } else {
     Serial.printf("HTTP Error: %d\n", httpCode);
+    mHttpFetchError.inc();
   }
   
-  lastCustomColorUpdate0 = millis();
   http.end();
   Serial.println("=== LED0 Update Complete ===\n");
 }
 
 void updateCustomColorLEDN() {
+  H2H_TRACE_SCOPE("updateCustomColorLEDN");
+  H2H_HEAP_SITE("updateCustomColorLEDN");
   if (WiFi.status() != WL_CONNECTED) {
     Serial.println("WiFi not connected - skipping LEDN Custom Color");
-    lastCustomColorUpdateN = millis();
     return;
   }
   if (customColorURL_LEDN.length() < 10) {
     Serial.println("LEDN URL too short - skipping");
-    lastCustomColorUpdateN = millis();
     return;
   }
   
   Serial.println("\n=== Updating Custom Color LEDN ===");
   Serial.printf("URL: %s\n", customColorURL_LEDN.c_str());
   
+  WiFiClient tcp;
+  WiFiClientSecure tls;
   HTTPClient http;
-  http.begin(customColorURL_LEDN);
+  httpBegin(http, tcp, tls, customColorURL_LEDN);
   http.setTimeout(5000);
+  mHttpFetch.inc();
+  unsigned long fetchStart = millis();
   int httpCode = http.GET();
   
   Serial.printf("HTTP Code: %d\n", httpCode);
   
   if (httpCode == 200) {
     String payload = http.getString();
+    mCustomFetchMs.observe(millis() - fetchStart);
     payload.trim();
     
     if (payload.startsWith("#")) {
@@ -664,12 +947,13 @@ void updateCustomColorLEDN() {
       Serial.println("LEDN Custom Color update successful!");
     } else {
       Serial.printf("ERROR: Invalid hex length: %d\n", payload.length());
+      mHttpFetchError.inc();
     }
   } else {
     Serial.printf("HTTP Error: %d\n", httpCode);
+    mHttpFetchError.inc();
   }
   
-  lastCustomColorUpdateN = millis();
   http.end();
   Serial.println("=== LEDN Update Complete ===\n");
 }
@@ -686,6 +970,7 @@ void updateCustomColors() {
 }
 
 uint32_t parseColorName(String colorName) {
+  H2H_HEAP_SITE("parseColorName");
   colorName.toLowerCase();
   colorName.trim();
   
@@ -756,21 +1041,9 @@ uint32_t normalizeColorBrightness(uint32_t color, uint8_t targetBrightness) {
   uint8_t g = (color >> 8) & 0xFF;
   uint8_t b = color & 0xFF;
   
-  // Berechne perzeptuelle Helligkeit (Luminanz)
-  // Human eye sensitivity: ~30% red, 59% green, 11% blue
-  float currentBrightness = (0.299 * r + 0.587 * g + 0.114 * b);
-  
-  if (currentBrightness < 1) currentBrightness = 1; // Verhindere Division durch 0
-  
+  // Perzeptuelle Helligkeit (Luminanz, ~30% R, 59% G, 11% B) in Festkomma.
   // Nur dimmen, nicht aufhellen (verhindert Clipping-Probleme)
-  if (currentBrightness > targetBrightness) {
-    float scale = targetBrightness / currentBrightness;
-    
-    r = (uint8_t)(r * scale);
-    g = (uint8_t)(g * scale);
-    b = (uint8_t)(b * scale);
-  }
-  // Wenn Farbe dunkler ist als Ziel, lasse sie so (keine Aufhellung)
+  h2h::px_normalize_luma(r, g, b, targetBrightness);
   
   return strip->Color(r, g, b);
 }
@@ -779,10 +1052,7 @@ uint32_t normalizeColorBrightness(uint32_t color, uint8_t targetBrightness) {
 void updateBrightnessFromLDR() {
   if (!ldrEnabled) return;
   
-  unsigned long now = millis();
-  if (now - lastLDRRead < LDR_SAMPLE_INTERVAL) return;
-  
-  lastLDRRead = now;
+  H2H_TRACE_SCOPE("updateBrightnessFromLDR");
   
   // LDR auslesen (ADC 0-4095)
   currentLDRValue = analogRead(LDR_PIN);
@@ -795,26 +1065,31 @@ void updateBrightnessFromLDR() {
   // Nur ändern wenn Unterschied > 5 (verhindert flackern)
   if (abs(newBrightness - targetBrightness) > 5) {
     targetBrightness = newBrightness;
-    Serial.printf("LDR: %d → Target Brightness: %d (%d%%)\n", currentLDRValue, targetBrightness, 
-                  (targetBrightness * 100) / 255);
+    Serial.printf("LDR: %d → Target Brightness: %d (%d%%)\n", currentLDRValue, newBrightness, 
+                  (newBrightness * 100) / 255);
   }
 }
 
-// Smooth brightness transition (called every loop)
-void smoothBrightnessTransition() {
-  if (currentBrightness != targetBrightness) {
-    // Schrittweise anpassen (2 pro Loop = smooth aber nicht zu langsam)
-    if (currentBrightness < targetBrightness) {
-      currentBrightness = min(currentBrightness + 2, targetBrightness);
-    } else {
-      currentBrightness = max(currentBrightness - 2, targetBrightness);
-    }
-    strip->setBrightness(currentBrightness);
+// Smooth brightness transition (Render-Task, alle BRIGHTNESS_STEP_INTERVAL ms)
+// Gibt true zurück, wenn sich die Helligkeit geändert hat
+bool smoothBrightnessTransition() {
+  int current = currentBrightness;
+  int target = targetBrightness;
+  if (current == target) return false;
+
+  // Schrittweise anpassen (2 pro Schritt = smooth aber nicht zu langsam)
+  if (current < target) {
+    current = min(current + 2, target);
+  } else {
+    current = max(current - 2, target);
   }
+  currentBrightness = current;  // wirkt beim nächsten renderFrame()
+  return true;
 }
 
 // Gibt Farbnamen für uint32_t zurück (für HTML-Anzeige)
 String getColorName(uint32_t color) {
+  H2H_HEAP_SITE("getColorName");
   uint8_t r = (color >> 16) & 0xFF;
   uint8_t g = (color >> 8) & 0xFF;
   uint8_t b = color & 0xFF;
@@ -854,6 +1129,7 @@ bool isLightColor(uint32_t color) {
 
 // Konvertiert uint32_t Farbe zu Hex-String
 String colorToHex(uint32_t color) {
+  H2H_HEAP_SITE("colorToHex");
   uint8_t r = (color >> 16) & 0xFF;
   uint8_t g = (color >> 8) & 0xFF;
   uint8_t b = color & 0xFF;
@@ -864,6 +1140,7 @@ String colorToHex(uint32_t color) {
 
 // Konvertiert Farbnamen zu Hex-Code für HTML (nur für bekannte Namen)
 String colorNameToHex(String colorName) {
+  H2H_HEAP_SITE("colorNameToHex");
   colorName.toLowerCase();
   if (colorName == "red") return "#c80000";
   if (colorName == "green") return "#00b400";
@@ -885,9 +1162,16 @@ String colorNameToHex(String colorName) {
   return "#666666"; // Default grau
 }
 
-void updateLEDs() {
+// Zeichnet einen Frame (nur Render-Task). blinkOn = Mode-Feedback lila
+// Farben gehen direkt in den Pixelpuffer (NEO_GRB), die Helligkeit wird
+// danach in einem Durchgang über alle Kanäle angewendet.
+void renderFrame(const LedFrame& f, bool blinkOn) {
+  H2H_TRACE_SCOPE("updateLEDs");
+  uint8_t* px = strip->getPixels();
+  // Puffergröße = LED-Zahl beim Anlegen des Strips, nicht numLEDs
+  const int n = strip->numPixels() < numLEDs ? strip->numPixels() : numLEDs;
   // Setze alle LEDs basierend auf Mode
-  for(int i = 0; i < numLEDs; i++) {
+  for(int i = 0; i < n; i++) {
     uint32_t color;
     
     // Prüfe ob LED Custom ist (compile-time UND runtime)
@@ -895,47 +1179,56 @@ void updateLEDs() {
     bool isCustomLEDN = false;
     
     #if CUSTOM_LED_0_ENABLED
-    isCustomLED0 = (i == 0 && customLED0Enabled);
+    isCustomLED0 = (i == 0 && f.customLED0);
     #endif
     
     #if CUSTOM_LED_N_ENABLED
-    isCustomLEDN = (i == numLEDs - 1 && customLEDNEnabled);
+    isCustomLEDN = (i == n - 1 && f.customLEDN);
     #endif
     
     // LED 0: Custom oder CheerLights?
     if (isCustomLED0) {
-      color = customColorLED0;
+      color = f.customColorLED0;
     }
     // LED n-1: Custom oder CheerLights?
     else if (isCustomLEDN) {
-      color = customColorLEDN;
+      color = f.customColorLEDN;
+    }
+    // Mode-Feedback: alle LEDs außer aktive Custom blinken
+    else if (blinkOn) {
+      color = strip->Color(50, 0, 50);
     }
     // Alle CheerLights LEDs
     else {
-      if (displayMode == 0) {
-        color = cheerLightsColor;  // Mode 0: Alle gleich
+      if (f.displayMode == 0) {
+        color = f.cheerLightsColor;  // Mode 0: Alle gleich
       } else {
         // Mode 1/2: History
         int historyIndex = i;
         
         // Offset für Custom LED 0 wenn aktiviert
         #if CUSTOM_LED_0_ENABLED
-        if (customLED0Enabled && i > 0) {
+        if (f.customLED0 && i > 0) {
           historyIndex--;
         }
         #endif
         
         if (historyIndex >= 0 && historyIndex < 50) {
-          color = colorHistory[historyIndex];
+          color = f.colorHistory[historyIndex];
         } else {
-          color = cheerLightsColor;
+          color = f.cheerLightsColor;
         }
       }
     }
     
-    strip->setPixelColor(i, color);
+    px[i * 3]     = (color >> 8) & 0xFF;   // G
+    px[i * 3 + 1] = (color >> 16) & 0xFF;  // R
+    px[i * 3 + 2] = color & 0xFF;          // B
   }
+  h2h::px_scale(px, n * 3, currentBrightness);
   
+  H2H_TRACE_SCOPE("strip.show");
+  h2h::ScopedTimerUs t(mShowUs);
   strip->show();
 }
 
@@ -945,9 +1238,95 @@ void setupWebServer() {
   server.on("/", handleRoot);
   server.on("/save", handleSave);
   server.on("/status", handleStatus);
+  server.on("/metrics", handleMetrics);
+  server.on("/trace", handleTrace);
+  server.on("/heap", handleHeap);
+  server.on("/ota", handleOta);
+}
+
+// Print-Adapter: schreibt direkt als HTTP-Chunks raus (kein großer String im Heap)
+class ServerChunkPrint : public Print {
+public:
+  explicit ServerChunkPrint(WebServer& s) : srv(s), len(0) {}
+  size_t write(uint8_t c) override {
+    buf[len++] = (char)c;
+    if (len == sizeof(buf)) flush();
+    return 1;
+  }
+  void flush() override {
+    if (len) srv.sendContent(buf, len);
+    len = 0;
+  }
+private:
+  WebServer& srv;
+  char buf[256];
+  size_t len;
+};
+
+void handleMetrics() {
+  mWebRequests.inc();
+  h2h::metrics_sample_system();
+  mBrightness.set(currentBrightness);
+  mLdr.set(currentLDRValue);
+  mWifiRssi.set(WiFi.RSSI());
+  mDnsQueries.follow(dnsCache.queries());
+  mDnsFailures.follow(dnsCache.failures());
+  mDnsStale.follow(dnsCache.stale());
+
+  server.setContentLength(CONTENT_LENGTH_UNKNOWN);
+  server.send(200, "text/plain; version=0.0.4", "");
+  ServerChunkPrint out(server);
+  h2h::metrics_write_prometheus(out);
+  h2h::heap_write_prometheus(out);
+  h2h::stall_write_prometheus(out);
+  out.flush();
+  server.sendContent("");  // Ende chunked
+}
+
+// Heap-Report: Fragmentierung über Zeit + Allokationen pro Call-Site
+void handleHeap() {
+  mWebRequests.inc();
+  server.setContentLength(CONTENT_LENGTH_UNKNOWN);
+  server.send(200, "text/plain", "");
+  ServerChunkPrint out(server);
+  h2h::heap_report(out);
+  out.flush();
+  server.sendContent("");
+}
+
+// /ota: Antwort sofort, der Patch-Download läuft danach im Timer (Ergebnis: /metrics ota_delta_*)
+void handleOta() {
+  mWebRequests.inc();
+  // Digest: das Passwort geht nicht im Klartext übers LAN
+  if (!server.authenticate("ota", OTA_KEY)) {
+    server.requestAuthentication(DIGEST_AUTH, "h2h-ota");
+    return;
+  }
+  server.send(200, "text/plain", "ota: fetching " OTA_DELTA_URL "\n");
+  netTimers.schedule(tmrOta, 0);
+}
+
+// /trace?on=1 startet, /trace?on=0 stoppt, /trace liefert Chrome-JSON (chrome://tracing)
+void handleTrace() {
+  mWebRequests.inc();
+  if (server.hasArg("on")) {
+    h2h::trace_enable(server.arg("on").toInt() != 0);
+    if (server.hasArg("clear")) h2h::trace_clear();
+    server.send(200, "text/plain", h2h::trace_enabled() ? "trace on\n" : "trace off\n");
+    return;
+  }
+
+  server.setContentLength(CONTENT_LENGTH_UNKNOWN);
+  server.send(200, "application/json", "");
+  ServerChunkPrint out(server);
+  h2h::trace_dump_chrome(out);
+  out.flush();
+  server.sendContent("");
 }
 
 void handleRoot() {
+  mWebRequests.inc();
+  H2H_HEAP_SITE("handleRoot");
   String html = "<!DOCTYPE html><html><head>";
   html += "<meta charset='UTF-8'>";
   html += "<meta name='viewport' content='width=device-width, initial-scale=1'>";
@@ -1135,10 +1514,15 @@ void handleRoot() {
 }
 
 void handleSave() {
+  mWebRequests.inc();
+  H2H_HEAP_SITE("handleSave");
+  // neue LED-Zahl gilt erst nach dem Neustart: der Render-Task zeichnet
+  // bis dahin in den Puffer des laufenden Strips
+  int newNumLEDs = numLEDs;
   if (server.hasArg("numLEDs")) {
-    numLEDs = server.arg("numLEDs").toInt();
-    if (numLEDs < 2) numLEDs = 2;
-    if (numLEDs > 300) numLEDs = 300;
+    newNumLEDs = server.arg("numLEDs").toInt();
+    if (newNumLEDs < 2) newNumLEDs = 2;
+    if (newNumLEDs > 300) newNumLEDs = 300;
   }
   
   #if CUSTOM_LED_0_ENABLED
@@ -1193,7 +1577,7 @@ void handleSave() {
   
   // Speichern
   preferences.begin("ledstrip", false);
-  preferences.putInt("numLEDs", numLEDs);
+  preferences.putInt("numLEDs", newNumLEDs);
   #if CUSTOM_LED_0_ENABLED
   preferences.putString("colorURL0", customColorURL_LED0);
   preferences.putBool("customLED0En", customLED0Enabled);
@@ -1226,6 +1610,8 @@ void handleSave() {
 }
 
 void handleStatus() {
+  mWebRequests.inc();
+  H2H_HEAP_SITE("handleStatus");
   String json = "{";
   json += "\"numLEDs\":" + String(numLEDs) + ",";
   json += "\"displayMode\":" + String(displayMode) + ",";
@@ -0,0 +1,175 @@
+// ============================================================
+// h2h_audio.h  —  I2S microphone level meter (header-only)
+// - DMA-fed I2S capture (INMP441/SPH0645 style, 32-bit slots, left channel)
+// - fixed-point kernel: DC blocker, sum of squares, peak; no float per sample
+// - runs in its own task; per-window results go out through a SeqLock,
+//   the publisher only reads finished windows
+// - levels are 16-bit full scale (32767); audio_dbfs() for publishing
+// ============================================================
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <math.h>
+#include <atomic>
+
+#include "h2h_seqlock.h"
+
+#ifdef ARDUINO
+  #include <Arduino.h>
+  #include <driver/i2s.h>
+#endif
+
+
+namespace h2h {
+
+struct AudioWindow {
+  uint32_t seq;        // window number
+  uint32_t samples;    // samples in this window
+  int32_t  rms;        // 0..32767
+  int32_t  peak;       // 0..32767
+};
+
+static inline uint32_t isqrt64(uint64_t v) {
+  uint64_t r = 0, bit = 1ULL << 62;
+  while (bit > v) bit >>= 2;
+  while (bit) {
+    if (v >= r + bit) { v -= r + bit; r = (r >> 1) + bit; }
+    else              { r >>= 1; }
+    bit >>= 2;
+  }
+  return (uint32_t)r;
+}
+
+// 20*log10(level / full scale); once per window, not per sample
+static inline float audio_dbfs(int32_t level) {
+  if (level <= 0) return -120.0f;
+  return 20.0f * log10f(level / 32767.0f);
+}
+
+// Windowed RMS/peak over raw I2S words (sample in the upper bits)
+class AudioMeter {
+public:
+  explicit AudioMeter(uint32_t windowSamples) : window_(windowSamples ? windowSamples : 1) {}
+
+  // true when a window completed (out filled); chunks may span windows
+  bool feed(const int32_t* raw, size_t n, AudioWindow& out) {
+    bool done = false;
+    size_t i = 0;
+    while (i < n) {
+      size_t take = window_ - count_;
+      if (take > n - i) take = n - i;
+      block(raw + i, take);
+      i += take;
+      count_ += take;
+      if (count_ == window_) {
+        out.seq     = ++seq_;
+        out.samples = count_;
+        out.rms     = (int32_t)isqrt64(sumSq_ / count_);
+        out.peak    = peak_ > 32767 ? 32767 : peak_;
+        if (out.rms > 32767) out.rms = 32767;
+        sumSq_ = 0;
+        peak_ = 0;
+        count_ = 0;
+        done = true;
+      }
+    }
+    return done;
+  }
+
+private:
+  // y = x - x[-1] + R*y[-1], R = 0.995 (Q15): removes the mic's DC offset
+  void block(const int32_t* raw, size_t n) {
+    int32_t  xp = xPrev_, yp = yPrev_, pk = peak_;
+    uint64_t acc = sumSq_;
+    for (size_t k = 0; k < n; k++) {
+      const int32_t x = raw[k] >> 16;                  // 24-bit mic -> 16 bit
+      const int32_t y = x - xp + (int32_t)(((int64_t)yp * 32604) >> 15);
+      xp = x;
+      yp = y;
+      acc += (uint64_t)((int64_t)y * y);
+      const int32_t a = y < 0 ? -y : y;
+      if (a > pk) pk = a;
+    }
+    xPrev_ = xp; yPrev_ = yp; peak_ = pk; sumSq_ = acc;
+  }
+
+  uint32_t window_;
+  uint32_t count_ = 0;
+  uint32_t seq_ = 0;
+  uint64_t sumSq_ = 0;
+  int32_t  peak_ = 0;
+  int32_t  xPrev_ = 0;
+  int32_t  yPrev_ = 0;
+};
+
+
+#ifdef ARDUINO
+
+struct AudioConfig {
+  int        pinBck;
+  int        pinWs;
+  int        pinSd;
+  uint32_t   sampleRate;     // e.g. 16000
+  uint32_t   windowMs;       // one AudioWindow per windowMs
+  i2s_port_t port;
+};
+
+static inline SeqLock<AudioWindow>& audio_windows() {
+  static SeqLock<AudioWindow> s;
+  return s;
+}
+
+static inline std::atomic<uint32_t>& audio_read_errors() {
+  static std::atomic<uint32_t> n{0};
+  return n;
+}
+
+static void audio_task(void* arg) {
+  const AudioConfig cfg = *static_cast<const AudioConfig*>(arg);
+  AudioMeter meter(cfg.sampleRate / 1000 * cfg.windowMs);
+  static int32_t buf[256];                              // one DMA buffer
+  AudioWindow w;
+
+  for (;;) {
+    size_t got = 0;
+    if (i2s_read(cfg.port, buf, sizeof(buf), &got, portMAX_DELAY) != ESP_OK) {
+      audio_read_errors().fetch_add(1, std::memory_order_relaxed);
+      continue;
+    }
+    if (meter.feed(buf, got / sizeof(int32_t), w)) audio_windows().write(w);
+  }
+}
+
+// Installs the I2S driver and starts the capture task
+static inline bool audio_start(const AudioConfig& cfg, int core, UBaseType_t prio) {
+  static AudioConfig taskCfg;
+  taskCfg = cfg;
+
+  i2s_config_t ic = {};
+  ic.mode                 = (i2s_mode_t)(I2S_MODE_MASTER | I2S_MODE_RX);
+  ic.sample_rate          = cfg.sampleRate;
+  ic.bits_per_sample      = I2S_BITS_PER_SAMPLE_32BIT;
+  ic.channel_format       = I2S_CHANNEL_FMT_ONLY_LEFT;   // L/R pin to GND
+  ic.communication_format = I2S_COMM_FORMAT_STAND_I2S;
+  ic.intr_alloc_flags     = ESP_INTR_FLAG_LEVEL1;
+  ic.dma_buf_count        = 4;
+  ic.dma_buf_len          = 256;                          // 16 ms per buffer at 16 kHz
+  ic.use_apll             = false;
+
+  i2s_pin_config_t pins = {};
+  pins.bck_io_num   = cfg.pinBck;
+  pins.ws_io_num    = cfg.pinWs;
+  pins.data_out_num = I2S_PIN_NO_CHANGE;
+  pins.data_in_num  = cfg.pinSd;
+
+  if (i2s_driver_install(cfg.port, &ic, 0, nullptr) != ESP_OK) return false;
+  if (i2s_set_pin(cfg.port, &pins) != ESP_OK) return false;
+
+  return xTaskCreatePinnedToCore(audio_task, "audio", 3072, &taskCfg, prio, nullptr, core) == pdPASS;
+}
+
+#endif
+
+} // namespace h2h
@@ -0,0 +1,389 @@
+// ============================================================
+// h2h_delta.h  —  delta firmware patches: format + streaming applier
+// - patch = 88-byte header (old/new size + CRC32, SHA-256 of the new
+//   image, HMAC-SHA256 over all of it) + LZSS-compressed command stream
+//   (4 KB window, heatshrink-like, decoder needs no heap beyond the
+//   applier object)
+// - signed with a 128-bit key (32 hex chars, the all-zero default is
+//   refused): the header MAC is checked before anything is read or
+//   erased, the new image must hash to the signed SHA-256 before the sink
+//   is committed. CRC32 only tells "wrong base image" early
+// - commands, bsdiff style: COPY old bytes, ADD (old byte + diff byte:
+//   code that only moved has mostly-zero diffs, which compress well),
+//   LIT new bytes. Old offsets are relative seeks
+// - DeltaApplier takes the patch in chunks of any size (HTTP, MQTT, ...)
+//   and writes the new image strictly sequentially, so the sink can be
+//   the inactive OTA partition (h2h_ota.h). Before the sink sees a byte
+//   the header MAC and the old image CRC are checked: a forged patch or
+//   one for another build does nothing
+// - same code on the host: broker/h2h_delta.cpp builds patches and
+//   applies them for testing
+// ============================================================
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include "h2h_sha256.h"
+
+
+namespace h2h {
+
+static const uint32_t DELTA_MAGIC      = 0x44483248;   // "H2HD" little-endian
+static const uint8_t  DELTA_VERSION    = 2;            // 1: unsigned, refused
+static const size_t   DELTA_SIGNED_LEN = 56;           // header bytes covered by the MAC
+static const size_t   DELTA_HEADER_LEN = DELTA_SIGNED_LEN + SHA256_LEN;
+static const size_t   DELTA_KEY_LEN    = 16;
+static const size_t   DELTA_WINDOW     = 4096;         // LZSS offsets: 12 bit
+static const size_t   DELTA_MIN_MATCH  = 3;
+static const size_t   DELTA_MAX_MATCH  = 18 + 255;     // nibble 15 + extension byte
+
+enum DeltaOp : uint8_t { DELTA_END = 0, DELTA_COPY = 1, DELTA_ADD = 2, DELTA_LIT = 3 };
+
+enum DeltaStatus : int8_t {
+  DELTA_MORE       = 0,     // keep feeding
+  DELTA_DONE       = 1,     // new image complete, size + CRC match
+  DELTA_ERR_HEADER = -1,    // not a patch / other version
+  DELTA_ERR_OLD    = -2,    // running image is not the one the patch was made for
+  DELTA_ERR_FORMAT = -3,    // corrupt command stream, out of range
+  DELTA_ERR_READ   = -4,    // old image read failed
+  DELTA_ERR_WRITE  = -5,    // sink refused (begin / write)
+  DELTA_ERR_CRC    = -6,    // new image does not match the header (CRC / SHA-256)
+  DELTA_ERR_AUTH   = -7,    // header MAC wrong or no usable key: nothing touched
+};
+
+static inline const char* delta_status_str(DeltaStatus s) {
+  switch (s) {
+    case DELTA_MORE:       return "incomplete";
+    case DELTA_DONE:       return "ok";
+    case DELTA_ERR_HEADER: return "bad header";
+    case DELTA_ERR_OLD:    return "patch is for another image";
+    case DELTA_ERR_FORMAT: return "corrupt patch";
+    case DELTA_ERR_READ:   return "old image read failed";
+    case DELTA_ERR_WRITE:  return "write failed";
+    case DELTA_ERR_CRC:    return "new image hash mismatch";
+    case DELTA_ERR_AUTH:   return "bad signature / no key";
+  }
+  return "?";
+}
+
+struct DeltaHeader {
+  uint32_t oldSize, oldCrc;
+  uint32_t newSize, newCrc;
+  uint8_t  newSha[SHA256_LEN];
+};
+
+// 32 hex chars -> key; false for anything else and for the all-zero
+// placeholder the sketches ship with
+static inline bool delta_key_from_hex(const char* hex, uint8_t key[DELTA_KEY_LEN]) {
+  if (!hex || strlen(hex) != 2 * DELTA_KEY_LEN) return false;
+  uint8_t any = 0;
+  for (size_t i = 0; i < DELTA_KEY_LEN; i++) {
+    uint8_t v = 0;
+    for (int j = 0; j < 2; j++) {
+      const char c = hex[2 * i + j];
+      v <<= 4;
+      if (c >= '0' && c <= '9')      v |= (uint8_t)(c - '0');
+      else if (c >= 'a' && c <= 'f') v |= (uint8_t)(c - 'a' + 10);
+      else if (c >= 'A' && c <= 'F') v |= (uint8_t)(c - 'A' + 10);
+      else return false;
+    }
+    key[i] = v;
+    any |= v;
+  }
+  return any != 0;
+}
+
+// CRC-32 (IEEE, as zlib), nibble table: 64 bytes of flash
+static inline uint32_t delta_crc32(uint32_t crc, const uint8_t* p, size_t n) {
+  static const uint32_t T[16] = {
+    0x00000000, 0x1db71064, 0x3b6e20c8, 0x26d930ac, 0x76dc4190, 0x6b6b51f4, 0x4db26158, 0x5005713c,
+    0xedb88320, 0xf00f9344, 0xd6d6a3e8, 0xcb61b38c, 0x9b64c2b0, 0x86d3d2d4, 0xa00ae278, 0xbdbdf21c,
+  };
+  crc = ~crc;
+  for (size_t i = 0; i < n; i++) {
+    crc ^= p[i];
+    crc = (crc >> 4) ^ T[crc & 15];
+    crc = (crc >> 4) ^ T[crc & 15];
+  }
+  return ~crc;
+}
+
+static inline void delta_put32(uint8_t* p, uint32_t v) {
+  p[0] = (uint8_t)v; p[1] = (uint8_t)(v >> 8); p[2] = (uint8_t)(v >> 16); p[3] = (uint8_t)(v >> 24);
+}
+
+static inline uint32_t delta_get32(const uint8_t* p) {
+  return (uint32_t)p[0] | (uint32_t)p[1] << 8 | (uint32_t)p[2] << 16 | (uint32_t)p[3] << 24;
+}
+
+static inline void delta_write_header(uint8_t out[DELTA_HEADER_LEN], const DeltaHeader& h) {
+  memset(out, 0, DELTA_HEADER_LEN);
+  delta_put32(out, DELTA_MAGIC);
+  out[4] = DELTA_VERSION;                    // 5..7 reserved
+  delta_put32(out + 8, h.oldSize);
+  delta_put32(out + 12, h.oldCrc);
+  delta_put32(out + 16, h.newSize);
+  delta_put32(out + 20, h.newCrc);
+  memcpy(out + 24, h.newSha, SHA256_LEN);
+}
+
+// host: MAC over the signed part, written behind it
+static inline void delta_sign_header(uint8_t hdr[DELTA_HEADER_LEN], const uint8_t key[DELTA_KEY_LEN]) {
+  hmac_sha256(key, DELTA_KEY_LEN, hdr, DELTA_SIGNED_LEN, hdr + DELTA_SIGNED_LEN);
+}
+
+static inline bool delta_verify_header(const uint8_t hdr[DELTA_HEADER_LEN], const uint8_t key[DELTA_KEY_LEN]) {
+  uint8_t tag[SHA256_LEN];
+  hmac_sha256(key, DELTA_KEY_LEN, hdr, DELTA_SIGNED_LEN, tag);
+  return sha256_equal(tag, hdr + DELTA_SIGNED_LEN, SHA256_LEN);
+}
+
+static inline bool delta_read_header(const uint8_t in[DELTA_HEADER_LEN], DeltaHeader& h) {
+  if (delta_get32(in) != DELTA_MAGIC || in[4] != DELTA_VERSION) return false;
+  h.oldSize = delta_get32(in + 8);
+  h.oldCrc  = delta_get32(in + 12);
+  h.newSize = delta_get32(in + 16);
+  h.newCrc  = delta_get32(in + 20);
+  memcpy(h.newSha, in + 24, SHA256_LEN);
+  return true;
+}
+
+
+// ============================================================
+//  APPLIER
+// ============================================================
+
+// Old: bool read(uint32_t offset, uint8_t* buf, size_t n)
+// Out: bool begin(uint32_t newSize), bool write(const uint8_t* buf, size_t n)
+// key: DELTA_KEY_LEN bytes, nullptr = refuse every patch.
+// ~8.6 KB with the defaults: allocate it for the update, not statically.
+template <class Old, class Out, size_t OUT_BLOCK = 4096, size_t OLD_BLOCK = 256>
+class DeltaApplier {
+public:
+  DeltaApplier(Old& old, Out& out, const uint8_t* key) : old_(old), out_(out), haveKey_(key != nullptr) {
+    if (key) memcpy(key_, key, DELTA_KEY_LEN);
+  }
+
+  // next piece of the patch; DELTA_MORE until the END command checked out
+  DeltaStatus write(const uint8_t* p, size_t n) {
+    while (n && status_ == DELTA_MORE) {
+      if (hdrLen_ < DELTA_HEADER_LEN) {
+        const size_t k = n < DELTA_HEADER_LEN - hdrLen_ ? n : DELTA_HEADER_LEN - hdrLen_;
+        memcpy(hdr_ + hdrLen_, p, k);
+        hdrLen_ += k; p += k; n -= k;
+        if (hdrLen_ == DELTA_HEADER_LEN) start();
+        continue;
+      }
+      lz(*p++);
+      n--;
+    }
+    return status_;
+  }
+
+  DeltaStatus status() const { return status_; }
+  bool has_header() const { return hdrLen_ == DELTA_HEADER_LEN && status_ != DELTA_ERR_HEADER; }
+  const DeltaHeader& header() const { return h_; }
+  uint32_t written() const { return newPos_; }
+
+private:
+  enum LzState : uint8_t { LZ_FLAGS, LZ_ITEM, LZ_MATCH2, LZ_EXT };
+  enum CmdState : uint8_t { C_OP, C_LEN, C_SEEK, C_ADD, C_LIT, C_END };
+
+  void fail(DeltaStatus s) { if (status_ == DELTA_MORE) status_ = s; }
+
+  // header complete: check the MAC and the old image, then open the sink
+  void start() {
+    if (!delta_read_header(hdr_, h_)) { fail(DELTA_ERR_HEADER); return; }
+    if (!haveKey_ || !delta_verify_header(hdr_, key_)) { fail(DELTA_ERR_AUTH); return; }
+    uint32_t crc = 0;
+    for (uint32_t off = 0; off < h_.oldSize; ) {
+      const size_t k = h_.oldSize - off < OLD_BLOCK ? h_.oldSize - off : OLD_BLOCK;
+      if (!old_.read(off, oldBuf_, k)) { fail(DELTA_ERR_READ); return; }
+      crc = delta_crc32(crc, oldBuf_, k);
+      off += (uint32_t)k;
+    }
+    oldBufLen_ = 0;
+    if (crc != h_.oldCrc) { fail(DELTA_ERR_OLD); return; }
+    if (!out_.begin(h_.newSize)) fail(DELTA_ERR_WRITE);
+  }
+
+  // ---------- LZSS: flag byte per 8 items, 1 = match (2-3 bytes) ----------
+  void lz(uint8_t b) {
+    switch (lzState_) {
+      case LZ_FLAGS:
+        flags_ = b;
+        flagBits_ = 8;
+        lzState_ = LZ_ITEM;
+        return;
+      case LZ_ITEM:
+        if (!(flags_ & 0x80)) {
+          emit(b);
+          next_item();
+        } else {
+          m1_ = b;
+          lzState_ = LZ_MATCH2;
+        }
+        return;
+      case LZ_MATCH2: {
+        const size_t off = ((size_t)m1_ << 4 | b >> 4) + 1;
+        if ((b & 15) == 15) { mOff_ = (uint16_t)off; lzState_ = LZ_EXT; return; }
+        match(off, (b & 15) + DELTA_MIN_MATCH);
+        next_item();
+        return;
+      }
+      case LZ_EXT:
+        match(mOff_, 18 + (size_t)b);
+        next_item();
+        return;
+    }
+  }
+
+  void next_item() {
+    flags_ <<= 1;
+    lzState_ = --flagBits_ ? LZ_ITEM : LZ_FLAGS;
+  }
+
+  void match(size_t off, size_t len) {
+    if (off > winFill_) { fail(DELTA_ERR_FORMAT); return; }
+    for (size_t i = 0; i < len && status_ == DELTA_MORE; i++) {
+      emit(win_[(winPos_ - off) & (DELTA_WINDOW - 1)]);
+    }
+  }
+
+  void emit(uint8_t c) {
+    win_[winPos_ & (DELTA_WINDOW - 1)] = c;
+    winPos_++;
+    if (winFill_ < DELTA_WINDOW) winFill_++;
+    cmd(c);
+  }
+
+  // ---------- command stream ----------
+  void cmd(uint8_t c) {
+    switch (cmdState_) {
+      case C_OP:
+        op_ = c;
+        if (op_ == DELTA_END) { finish(); return; }
+        if (op_ > DELTA_LIT) { fail(DELTA_ERR_FORMAT); return; }
+        varint_ = 0; shift_ = 0;
+        cmdState_ = C_LEN;
+        return;
+
+      case C_LEN:
+        if (!varint(c)) return;
+        len_ = varint_;
+        if (len_ > h_.newSize - newPos_) { fail(DELTA_ERR_FORMAT); return; }
+        if (op_ == DELTA_LIT) { cmdState_ = len_ ? C_LIT : C_OP; return; }
+        varint_ = 0; shift_ = 0;
+        cmdState_ = C_SEEK;
+        return;
+
+      case C_SEEK: {
+        if (!varint(c)) return;
+        const int64_t seek = (int64_t)(varint_ >> 1) ^ -(int64_t)(varint_ & 1);   // zigzag
+        const int64_t pos = (int64_t)oldPos_ + seek;
+        if (pos < 0 || pos + (int64_t)len_ > (int64_t)h_.oldSize) { fail(DELTA_ERR_FORMAT); return; }
+        oldPos_ = (uint32_t)pos;
+        if (op_ == DELTA_COPY) {
+          while (len_ && status_ == DELTA_MORE) { out_byte(old_byte()); len_--; }
+          cmdState_ = C_OP;
+        } else {
+          cmdState_ = len_ ? C_ADD : C_OP;
+        }
+        return;
+      }
+
+      case C_ADD:
+        out_byte((uint8_t)(old_byte() + c));
+        if (--len_ == 0) cmdState_ = C_OP;
+        return;
+
+      case C_LIT:
+        out_byte(c);
+        if (--len_ == 0) cmdState_ = C_OP;
+        return;
+
+      case C_END:
+        return;                               // padding after END: ignored
+    }
+  }
+
+  // LEB128; false = more bytes to come
+  bool varint(uint8_t c) {
+    if (shift_ > 28) { fail(DELTA_ERR_FORMAT); return false; }
+    varint_ |= (uint32_t)(c & 0x7F) << shift_;
+    shift_ += 7;
+    return !(c & 0x80);
+  }
+
+  uint8_t old_byte() {
+    if (oldPos_ < oldBufStart_ || oldPos_ >= oldBufStart_ + oldBufLen_) {
+      const uint32_t left = h_.oldSize - oldPos_;
+      const size_t k = left < OLD_BLOCK ? left : OLD_BLOCK;
+      if (!old_.read(oldPos_, oldBuf_, k)) { fail(DELTA_ERR_READ); return 0; }
+      oldBufStart_ = oldPos_;
+      oldBufLen_ = (uint32_t)k;
+    }
+    return oldBuf_[oldPos_++ - oldBufStart_];
+  }
+
+  void out_byte(uint8_t c) {
+    outBuf_[outLen_++] = c;
+    newPos_++;
+    if (outLen_ == OUT_BLOCK) flush();
+  }
+
+  void flush() {
+    if (!outLen_) return;
+    newCrc_ = delta_crc32(newCrc_, outBuf_, outLen_);
+    newSha_.update(outBuf_, outLen_);
+    if (!out_.write(outBuf_, outLen_)) fail(DELTA_ERR_WRITE);
+    outLen_ = 0;
+  }
+
+  void finish() {
+    cmdState_ = C_END;
+    flush();
+    if (status_ != DELTA_MORE) return;
+    uint8_t sha[SHA256_LEN];
+    newSha_.finish(sha);
+    status_ = (newPos_ == h_.newSize && newCrc_ == h_.newCrc && sha256_equal(sha, h_.newSha, SHA256_LEN))
+              ? DELTA_DONE : DELTA_ERR_CRC;
+  }
+
+  Old&        old_;
+  Out&        out_;
+  uint8_t     key_[DELTA_KEY_LEN] = {};
+  bool        haveKey_;
+  DeltaStatus status_ = DELTA_MORE;
+
+  uint8_t     hdr_[DELTA_HEADER_LEN];
+  size_t      hdrLen_ = 0;
+  DeltaHeader h_ = {};
+
+  uint8_t     win_[DELTA_WINDOW];
+  uint32_t    winPos_ = 0;
+  size_t      winFill_ = 0;
+  LzState     lzState_ = LZ_FLAGS;
+  uint8_t     flags_ = 0, flagBits_ = 0, m1_ = 0;
+  uint16_t    mOff_ = 0;
+
+  CmdState    cmdState_ = C_OP;
+  uint8_t     op_ = 0;
+  uint32_t    varint_ = 0;
+  uint8_t     shift_ = 0;
+  uint32_t    len_ = 0;
+
+  uint8_t     oldBuf_[OLD_BLOCK];
+  uint32_t    oldBufStart_ = 0, oldBufLen_ = 0;
+  uint32_t    oldPos_ = 0;
+
+  uint8_t     outBuf_[OUT_BLOCK];
+  size_t      outLen_ = 0;
+  uint32_t    newPos_ = 0;
+  uint32_t    newCrc_ = 0;
+  Sha256      newSha_;
+};
+
+} // namespace h2h
@@ -0,0 +1,294 @@
+// ============================================================
+// h2h_dns.h  —  small DNS cache with TTL and last-known-good address
+// - own A-record queries over UDP (template over an Arduino UDP class,
+//   WiFiUDP): non-blocking, answers are picked up in loop()
+// - the record TTL is honoured (clamped to DNS_TTL_MIN..DNS_TTL_MAX);
+//   entries are refreshed at 3/4 of the TTL, so a reconnect finds a
+//   fresh address and never waits for DNS
+// - DNS failure or timeout keeps the last good address (served stale),
+//   retries back off 2 s .. 64 s
+// - address(host): dotted IP for set_server()/connect(), or the host
+//   itself while nothing is known yet (the caller's resolver takes over)
+// ============================================================
+
+#pragma once
+
+#include <stdint.h>
+#include <string.h>
+#include <ctype.h>
+#include <strings.h>
+#include <stdio.h>
+
+#ifdef ARDUINO
+  #include <Arduino.h>
+#else
+  #include <stdlib.h>
+  #include <time.h>
+#endif
+
+
+namespace h2h {
+
+static const uint32_t DNS_TTL_MIN     = 30;      // s
+static const uint32_t DNS_TTL_MAX     = 3600;    // s
+static const uint32_t DNS_TIMEOUT_MS  = 2000;    // one query
+static const uint16_t DNS_PORT        = 53;
+static const uint8_t  DNS_HOST_LEN    = 64;
+
+static inline uint32_t dns_now_ms() {
+#ifdef ARDUINO
+  return millis();
+#else
+  timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint32_t)(ts.tv_sec * 1000 + ts.tv_nsec / 1000000);
+#endif
+}
+
+static inline uint16_t dns_random16() {
+#ifdef ARDUINO
+  return (uint16_t)esp_random();
+#else
+  return (uint16_t)rand();
+#endif
+}
+
+struct DnsEntry {
+  char     host[DNS_HOST_LEN];
+  char     addr[16];        // dotted, "" until the first answer
+  uint8_t  ip[4];
+  uint32_t freshUntilMs;    // TTL end; afterwards the address is served stale
+  uint32_t nextQueryMs;     // refresh (3/4 TTL) or retry after a failure
+  uint32_t sentMs;
+  uint16_t qid;
+  uint8_t  fails;           // in a row, for the backoff
+  bool     pending;
+};
+
+
+// ============================================================
+//  CACHE
+// ============================================================
+
+template<class Udp, uint8_t N = 4>
+class DnsCache {
+public:
+  explicit DnsCache(Udp& udp) : udp_(udp) { memset(e_, 0, sizeof(e_)); }
+
+  // dotted address of the DNS server (WiFi.dnsIP()); call after each WiFi connect
+  void set_server(const char* dotted) {
+    strncpy(server_, dotted, sizeof(server_) - 1);
+    server_[sizeof(server_) - 1] = 0;
+  }
+
+  // watch a host: resolved in the background from now on. false = table full
+  bool add(const char* host) {
+    if (find(host)) return true;
+    if (strlen(host) >= DNS_HOST_LEN) return false;
+    for (uint8_t i = 0; i < N; i++) {
+      DnsEntry& d = e_[i];
+      if (d.host[0]) continue;
+      strcpy(d.host, host);
+      d.nextQueryMs = dns_now_ms();   // next loop()
+      return true;
+    }
+    return false;
+  }
+
+  // cached address (fresh or stale); false = never resolved, host is now watched
+  bool lookup(const char* host, uint8_t out[4]) {
+    const DnsEntry* d = find(host);
+    if (!d || !d->addr[0]) {
+      misses_++;
+      add(host);
+      return false;
+    }
+    if ((int32_t)(dns_now_ms() - d->freshUntilMs) >= 0) stale_++;
+    else hits_++;
+    memcpy(out, d->ip, 4);
+    return true;
+  }
+
+#ifdef ARDUINO
+  bool lookup(const char* host, IPAddress& out) {
+    uint8_t ip[4];
+    if (!lookup(host, ip)) return false;
+    out = IPAddress(ip[0], ip[1], ip[2], ip[3]);
+    return true;
+  }
+#endif
+
+  // for connect(host, port): dotted address if known, else the host name
+  const char* address(const char* host) {
+    uint8_t ip[4];
+    if (!lookup(host, ip)) return host;
+    return find(host)->addr;
+  }
+
+  // send due queries, read answers, expire timeouts; cheap when idle
+  void loop() {
+    if (!server_[0]) return;
+    const uint32_t now = dns_now_ms();
+
+    bool anyPending = false;
+    for (uint8_t i = 0; i < N; i++) anyPending |= e_[i].pending;
+    if (anyPending) receive(now);
+
+    for (uint8_t i = 0; i < N; i++) {
+      DnsEntry& d = e_[i];
+      if (!d.host[0]) continue;
+      if (d.pending && now - d.sentMs >= DNS_TIMEOUT_MS) fail(d, now);
+      if (!d.pending && (int32_t)(now - d.nextQueryMs) >= 0) query(d, now);
+    }
+  }
+
+  // ---------- counters (for metrics) ----------
+  uint32_t hits()     const { return hits_; }      // fresh address served
+  uint32_t stale()    const { return stale_; }     // last-known-good served after TTL
+  uint32_t misses()   const { return misses_; }    // nothing known, caller resolved itself
+  uint32_t queries()  const { return queries_; }
+  uint32_t failures() const { return failures_; }  // timeout, error rcode, no A record
+  uint32_t last_rtt_ms() const { return lastRttMs_; }
+
+private:
+  DnsEntry* find(const char* host) {
+    for (uint8_t i = 0; i < N; i++) {
+      if (e_[i].host[0] && strcasecmp(e_[i].host, host) == 0) return &e_[i];
+    }
+    return nullptr;
+  }
+
+  void fail(DnsEntry& d, uint32_t now) {
+    d.pending = false;
+    failures_++;
+    if (d.fails < 6) d.fails++;
+    d.nextQueryMs = now + (1000u << d.fails);   // 2 s .. 64 s; address stays as it is
+  }
+
+  // header (id, RD) + QNAME labels + QTYPE A + QCLASS IN
+  static size_t encode(uint8_t* q, uint16_t id, const char* host) {
+    uint8_t* p = q;
+    *p++ = id >> 8; *p++ = id & 0xFF;
+    *p++ = 0x01; *p++ = 0x00;            // recursion desired
+    *p++ = 0; *p++ = 1;                  // QDCOUNT
+    memset(p, 0, 6); p += 6;
+    const char* s = host;
+    while (*s) {
+      const char* dot = strchr(s, '.');
+      const size_t n = dot ? (size_t)(dot - s) : strlen(s);
+      if (n == 0 || n > 63) return 0;
+      *p++ = (uint8_t)n;
+      memcpy(p, s, n); p += n;
+      s += n;
+      if (*s == '.') s++;
+    }
+    *p++ = 0;
+    *p++ = 0; *p++ = 1;                  // A
+    *p++ = 0; *p++ = 1;                  // IN
+    return (size_t)(p - q);
+  }
+
+  void query(DnsEntry& d, uint32_t now) {
+    if (!open_) {
+      if (!udp_.begin(0)) return;        // ephemeral port
+      open_ = true;
+    }
+    uint8_t q[12 + DNS_HOST_LEN + 6];
+    d.qid = dns_random16();
+    const size_t len = encode(q, d.qid, d.host);
+    if (!len) { fail(d, now); return; }
+
+    if (!udp_.beginPacket(server_, DNS_PORT)) { fail(d, now); return; }
+    udp_.write(q, len);
+    if (!udp_.endPacket()) { fail(d, now); return; }
+    d.pending = true;
+    d.sentMs = now;
+    queries_++;
+  }
+
+  // QNAME in the answer must spell our host (case-insensitive); p ends behind it
+  static bool name_is(const uint8_t*& p, const uint8_t* end, const char* host) {
+    const char* h = host;
+    while (p < end && *p) {
+      const uint8_t n = *p++;
+      if (n > 63 || p + n > end) return false;
+      if (h != host) { if (*h++ != '.') return false; }
+      for (uint8_t i = 0; i < n; i++, h++) {
+        if (!*h || tolower(p[i]) != tolower((uint8_t)*h)) return false;
+      }
+      p += n;
+    }
+    if (p >= end || *h) return false;
+    p++;
+    return true;
+  }
+
+  // skip a (possibly compressed) name in the answer section
+  static bool skip_name(const uint8_t*& p, const uint8_t* end) {
+    while (p < end) {
+      const uint8_t n = *p;
+      if ((n & 0xC0) == 0xC0) { p += 2; return p <= end; }
+      p++;
+      if (n == 0) return true;
+      p += n;
+    }
+    return false;
+  }
+
+  void receive(uint32_t now) {
+    uint8_t buf[512];
+    while (udp_.parsePacket() > 0) {
+      const int len = udp_.read(buf, sizeof(buf));
+      if (len < 12) continue;
+      const uint16_t id = (uint16_t)(buf[0] << 8 | buf[1]);
+
+      DnsEntry* d = nullptr;
+      for (uint8_t i = 0; i < N; i++) {
+        if (e_[i].pending && e_[i].qid == id) { d = &e_[i]; break; }
+      }
+      if (!d || !(buf[2] & 0x80)) continue;   // not ours / not a response
+
+      const uint8_t* p = buf + 12;
+      const uint8_t* end = buf + len;
+      const uint16_t qd = (uint16_t)(buf[4] << 8 | buf[5]);
+      const uint16_t an = (uint16_t)(buf[6] << 8 | buf[7]);
+      if (qd != 1 || !name_is(p, end, d->host) || p + 4 > end) continue;   // spoofed / garbled
+      p += 4;
+      if ((buf[3] & 0x0F) != 0) { fail(*d, now); continue; }             // NXDOMAIN, SERVFAIL, ...
+
+      bool found = false;
+      for (uint16_t i = 0; i < an && !found; i++) {
+        if (!skip_name(p, end) || p + 10 > end) break;
+        const uint16_t type  = (uint16_t)(p[0] << 8 | p[1]);
+        const uint16_t cls   = (uint16_t)(p[2] << 8 | p[3]);
+        uint32_t ttl = (uint32_t)p[4] << 24 | (uint32_t)p[5] << 16 | (uint32_t)p[6] << 8 | p[7];
+        const uint16_t rdlen = (uint16_t)(p[8] << 8 | p[9]);
+        p += 10;
+        if (p + rdlen > end) break;
+        if (type == 1 && cls == 1 && rdlen == 4) {   // CNAMEs before it are skipped
+          if (ttl < DNS_TTL_MIN) ttl = DNS_TTL_MIN;
+          if (ttl > DNS_TTL_MAX) ttl = DNS_TTL_MAX;
+          memcpy(d->ip, p, 4);
+          snprintf(d->addr, sizeof(d->addr), "%u.%u.%u.%u", p[0], p[1], p[2], p[3]);
+          d->freshUntilMs = now + ttl * 1000;
+          d->nextQueryMs  = now + ttl * 750;
+          d->fails = 0;
+          d->pending = false;
+          lastRttMs_ = now - d->sentMs;
+          found = true;
+        }
+        p += rdlen;
+      }
+      if (!found) fail(*d, now);
+    }
+  }
+
+  Udp&     udp_;
+  DnsEntry e_[N];
+  char     server_[16] = {};
+  bool     open_ = false;
+
+  uint32_t hits_ = 0, stale_ = 0, misses_ = 0, queries_ = 0, failures_ = 0, lastRttMs_ = 0;
+};
+
+} // namespace h2h
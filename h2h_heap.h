@@ -0,0 +1,248 @@
+// ============================================================
+// h2h_heap.h  —  heap fragmentation + per-call-site allocation profile
+// - H2H_HEAP_SITE("name") marks a String-heavy code path:
+//     always:          calls, net retained bytes (free heap delta)
+//     H2H_HEAP_TRACK:  allocations + requested bytes inside the scope
+// - heap_loop() samples free / largest free block into a history ring
+//   and the heap_* gauges of the metrics registry
+// - report as text (serial 'h', /heap) or Prometheus lines
+//
+// H2H_HEAP_TRACK=1 needs the allocator wrapped at link time, e.g.
+// PlatformIO:  build_flags = -DH2H_HEAP_TRACK=1
+//              -Wl,--wrap=malloc -Wl,--wrap=calloc -Wl,--wrap=realloc
+//
+// Include from the sketch itself (one translation unit).
+// ============================================================
+
+#pragma once
+
+#include <Arduino.h>
+#include <atomic>
+#include "esp_heap_caps.h"
+#include "h2h_metrics.h"
+
+#ifndef H2H_HEAP_TRACK
+  #define H2H_HEAP_TRACK 0
+#endif
+
+#ifndef H2H_HEAP_SAMPLE_MS
+  #define H2H_HEAP_SAMPLE_MS 60000    // history resolution
+#endif
+
+#ifndef H2H_HEAP_HISTORY
+  #define H2H_HEAP_HISTORY 64         // samples (64 x 1 min ~ 1 h)
+#endif
+
+
+#define H2H_HEAP_CAT2(a, b) a##b
+#define H2H_HEAP_CAT(a, b)  H2H_HEAP_CAT2(a, b)
+
+#define H2H_HEAP_SITE(name) \
+  static h2h::HeapSite H2H_HEAP_CAT(_h2hSite, __LINE__)(name); \
+  h2h::HeapScope H2H_HEAP_CAT(_h2hScope, __LINE__)(H2H_HEAP_CAT(_h2hSite, __LINE__))
+
+
+namespace h2h {
+
+// ============================================================
+//  CALL SITES
+// ============================================================
+
+struct HeapSite;
+
+inline HeapSite*& heap_sites_head() {
+  static HeapSite* head = nullptr;
+  return head;
+}
+
+struct HeapSite {
+  const char* name;
+  HeapSite*   next;
+  std::atomic<uint32_t> calls{0};
+  std::atomic<uint32_t> allocs{0};      // H2H_HEAP_TRACK only
+  std::atomic<uint32_t> bytes{0};       // H2H_HEAP_TRACK only
+  std::atomic<int32_t>  retained{0};    // sum of net free-heap loss
+  std::atomic<int32_t>  retainedMax{0}; // worst single call
+
+  explicit HeapSite(const char* n) : name(n), next(heap_sites_head()) {
+    heap_sites_head() = this;
+  }
+};
+
+// Site currently collecting allocations + the task that owns it.
+// Allocations from other tasks (WiFi, lwIP) are not attributed.
+struct HeapActive {
+  std::atomic<HeapSite*> site{nullptr};
+  std::atomic<void*>     task{nullptr};
+};
+
+inline HeapActive& heap_active() {
+  static HeapActive a;
+  return a;
+}
+
+struct HeapScope {
+  HeapSite& site;
+  HeapSite* prevSite;
+  void*     prevTask;
+  uint32_t  freeBefore;
+
+  explicit HeapScope(HeapSite& s) : site(s) {
+    HeapActive& a = heap_active();
+    prevSite = a.site.load(std::memory_order_relaxed);
+    prevTask = a.task.load(std::memory_order_relaxed);
+    a.task.store(xTaskGetCurrentTaskHandle(), std::memory_order_relaxed);
+    a.site.store(&site, std::memory_order_relaxed);
+    freeBefore = ESP.getFreeHeap();
+  }
+
+  ~HeapScope() {
+    const int32_t lost = (int32_t)freeBefore - (int32_t)ESP.getFreeHeap();
+    site.calls.fetch_add(1, std::memory_order_relaxed);
+    site.retained.fetch_add(lost, std::memory_order_relaxed);
+    if (lost > site.retainedMax.load(std::memory_order_relaxed)) {
+      site.retainedMax.store(lost, std::memory_order_relaxed);
+    }
+    HeapActive& a = heap_active();
+    a.site.store(prevSite, std::memory_order_relaxed);
+    a.task.store(prevTask, std::memory_order_relaxed);
+  }
+};
+
+inline void heap_note_alloc(size_t n) {
+  HeapActive& a = heap_active();
+  HeapSite* s = a.site.load(std::memory_order_relaxed);
+  if (!s || a.task.load(std::memory_order_relaxed) != xTaskGetCurrentTaskHandle()) return;
+  s->allocs.fetch_add(1, std::memory_order_relaxed);
+  s->bytes.fetch_add((uint32_t)n, std::memory_order_relaxed);
+}
+
+} // namespace h2h
+
+#if H2H_HEAP_TRACK
+extern "C" {
+  void* __real_malloc(size_t n);
+  void* __real_calloc(size_t n, size_t m);
+  void* __real_realloc(void* p, size_t n);
+
+  void* __wrap_malloc(size_t n) {
+    void* p = __real_malloc(n);
+    if (p) h2h::heap_note_alloc(n);
+    return p;
+  }
+  void* __wrap_calloc(size_t n, size_t m) {
+    void* p = __real_calloc(n, m);
+    if (p) h2h::heap_note_alloc(n * m);
+    return p;
+  }
+  // String growth goes through realloc: counted as one allocation
+  void* __wrap_realloc(void* old, size_t n) {
+    void* p = __real_realloc(old, n);
+    if (p && n) h2h::heap_note_alloc(n);
+    return p;
+  }
+}
+#endif
+
+
+namespace h2h {
+
+// ============================================================
+//  FRAGMENTATION HISTORY
+// ============================================================
+
+struct HeapSample {
+  uint32_t uptimeS;
+  uint32_t freeBytes;
+  uint32_t largestBlock;
+};
+
+struct HeapHistory {
+  HeapSample s[H2H_HEAP_HISTORY];
+  uint32_t count = 0;           // total samples taken
+  uint32_t lastMs = 0;
+  uint32_t largestMin = 0xFFFFFFFF;
+};
+
+inline HeapHistory& heap_history() {
+  static HeapHistory h;
+  return h;
+}
+
+static Gauge heapLargest  ("heap_largest_block_bytes",     "Largest free heap block");
+static Gauge heapLargeMin ("heap_largest_block_min_bytes", "Smallest largest-free-block seen");
+static Gauge heapFragPct  ("heap_fragmentation_pct",       "100 - largest block / free heap");
+
+inline void heap_sample() {
+  HeapHistory& h = heap_history();
+  HeapSample& e = h.s[h.count % H2H_HEAP_HISTORY];
+  e.uptimeS      = millis() / 1000;
+  e.freeBytes    = heap_caps_get_free_size(MALLOC_CAP_8BIT);
+  e.largestBlock = heap_caps_get_largest_free_block(MALLOC_CAP_8BIT);
+  h.count++;
+  if (e.largestBlock < h.largestMin) h.largestMin = e.largestBlock;
+
+  heapLargest.set((int32_t)e.largestBlock);
+  heapLargeMin.set((int32_t)h.largestMin);
+  heapFragPct.set(e.freeBytes ? (int32_t)(100 - (uint64_t)e.largestBlock * 100 / e.freeBytes) : 0);
+}
+
+inline void heap_loop() {
+  HeapHistory& h = heap_history();
+  if (h.count && millis() - h.lastMs < H2H_HEAP_SAMPLE_MS) return;
+  h.lastMs = millis();
+  heap_sample();
+}
+
+
+// ============================================================
+//  REPORTS
+// ============================================================
+
+inline void heap_report(Print& out) {
+  out.printf("free=%lu largest=%lu minFree=%lu largestMin=%lu track=%d\n",
+             (unsigned long)heap_caps_get_free_size(MALLOC_CAP_8BIT),
+             (unsigned long)heap_caps_get_largest_free_block(MALLOC_CAP_8BIT),
+             (unsigned long)heap_caps_get_minimum_free_size(MALLOC_CAP_8BIT),
+             (unsigned long)heap_history().largestMin, H2H_HEAP_TRACK);
+
+  out.print("\nsite                       calls   allocs      bytes  retained  worst\n");
+  for (const HeapSite* s = heap_sites_head(); s; s = s->next) {
+    out.printf("%-24s %7lu %8lu %10lu %9ld %6ld\n", s->name,
+               (unsigned long)s->calls.load(), (unsigned long)s->allocs.load(),
+               (unsigned long)s->bytes.load(), (long)s->retained.load(),
+               (long)s->retainedMax.load());
+  }
+
+  const HeapHistory& h = heap_history();
+  const uint32_t n = h.count < H2H_HEAP_HISTORY ? h.count : H2H_HEAP_HISTORY;
+  out.print("\nuptime_s       free    largest\n");
+  for (uint32_t k = 0; k < n; k++) {
+    const HeapSample& e = h.s[(h.count - n + k) % H2H_HEAP_HISTORY];
+    out.printf("%8lu %10lu %10lu\n", (unsigned long)e.uptimeS,
+               (unsigned long)e.freeBytes, (unsigned long)e.largestBlock);
+  }
+}
+
+// Per-site lines for /metrics (labels, so they cannot live in the registry)
+inline void heap_write_prometheus(Print& out) {
+  out.print("# TYPE h2h_heap_site_calls_total counter\n"
+            "# TYPE h2h_heap_site_allocs_total counter\n"
+            "# TYPE h2h_heap_site_alloc_bytes_total counter\n"
+            "# TYPE h2h_heap_site_retained_bytes gauge\n");
+  for (const HeapSite* s = heap_sites_head(); s; s = s->next) {
+    out.printf("h2h_heap_site_calls_total{site=\"%s\"} %lu\n", s->name, (unsigned long)s->calls.load());
+    out.printf("h2h_heap_site_allocs_total{site=\"%s\"} %lu\n", s->name, (unsigned long)s->allocs.load());
+    out.printf("h2h_heap_site_alloc_bytes_total{site=\"%s\"} %lu\n", s->name, (unsigned long)s->bytes.load());
+    out.printf("h2h_heap_site_retained_bytes{site=\"%s\"} %ld\n", s->name, (long)s->retained.load());
+  }
+}
+
+// Serial command 'h' = heap report; returns false for other characters
+inline bool heap_serial_cmd(int c) {
+  if (c != 'h') return false;
+  heap_report(Serial);
+  return true;
+}
+
+} // namespace h2h
@@ -0,0 +1,174 @@
+// ============================================================
+// h2h_metrics.h  —  tiny lock-free metrics registry (header-only)
+// - counters, gauges and fixed-bucket histograms
+// - hot path = one relaxed atomic add (+ short bucket scan)
+// - metrics register themselves at static-init time (no locks)
+// - export as Prometheus text (/metrics) or one value per metric
+//   (MQTT: h2h/<house>/sys/<metric>, numeric payload only)
+//
+// Include from the sketch itself (one translation unit).
+// ============================================================
+
+#pragma once
+
+#include <Arduino.h>
+#include <atomic>
+
+
+namespace h2h {
+
+// ============================================================
+//  REGISTRY
+// ============================================================
+
+enum MetricKind : uint8_t { METRIC_COUNTER, METRIC_GAUGE, METRIC_HISTOGRAM };
+
+struct Metric;
+
+// list head; only written during static init, read-only afterwards
+inline Metric*& metrics_head() {
+  static Metric* head = nullptr;
+  return head;
+}
+
+struct Metric {
+  const char* name;      // without "h2h_" prefix, e.g. "mqtt_rx_total"
+  const char* help;
+  MetricKind  kind;
+  Metric*     next;
+
+  Metric(const char* n, const char* h, MetricKind k)
+    : name(n), help(h), kind(k), next(metrics_head()) {
+    metrics_head() = this;
+  }
+};
+
+
+// ============================================================
+//  METRIC TYPES
+// ============================================================
+
+struct Counter : Metric {
+  std::atomic<uint32_t> value{0};
+
+  Counter(const char* n, const char* h) : Metric(n, h, METRIC_COUNTER) {}
+
+  inline void inc(uint32_t n = 1) { value.fetch_add(n, std::memory_order_relaxed); }
+  inline uint32_t get() const     { return value.load(std::memory_order_relaxed); }
+  // mirror a count kept elsewhere (one writer); the delta wraps like the source
+  inline void follow(uint32_t total) { inc(total - get()); }
+};
+
+struct Gauge : Metric {
+  std::atomic<int32_t> value{0};
+
+  Gauge(const char* n, const char* h) : Metric(n, h, METRIC_GAUGE) {}
+
+  inline void set(int32_t v)     { value.store(v, std::memory_order_relaxed); }
+  inline void add(int32_t d)     { value.fetch_add(d, std::memory_order_relaxed); }
+  inline int32_t get() const     { return value.load(std::memory_order_relaxed); }
+};
+
+static const uint8_t HIST_MAX_BUCKETS = 12;   // upper bounds, +Inf is implicit
+
+struct Histogram : Metric {
+  const uint32_t* bounds;                     // ascending upper bounds (le)
+  uint8_t nbounds;
+  std::atomic<uint32_t> buckets[HIST_MAX_BUCKETS + 1];
+  std::atomic<uint32_t> count{0};
+  std::atomic<uint32_t> sum{0};               // wraps; use rate() downstream
+
+  template <size_t N>
+  Histogram(const char* n, const char* h, const uint32_t (&b)[N])
+    : Metric(n, h, METRIC_HISTOGRAM), bounds(b), nbounds(N) {
+    static_assert(N <= HIST_MAX_BUCKETS, "too many histogram buckets");
+    for (auto& c : buckets) c.store(0, std::memory_order_relaxed);
+  }
+
+  inline void observe(uint32_t v) {
+    uint8_t i = 0;
+    while (i < nbounds && v > bounds[i]) i++;
+    buckets[i].fetch_add(1, std::memory_order_relaxed);
+    count.fetch_add(1, std::memory_order_relaxed);
+    sum.fetch_add(v, std::memory_order_relaxed);
+  }
+};
+
+// Common bucket layouts
+static const uint32_t BUCKETS_US[] = { 50, 100, 250, 500, 1000, 2500, 5000, 10000, 25000, 50000, 100000 };
+static const uint32_t BUCKETS_MS[] = { 10, 25, 50, 100, 250, 500, 1000, 2500, 5000, 10000 };
+
+// Measures the enclosing scope in microseconds
+struct ScopedTimerUs {
+  Histogram& h;
+  uint32_t t0;
+  explicit ScopedTimerUs(Histogram& hist) : h(hist), t0(micros()) {}
+  ~ScopedTimerUs() { h.observe(micros() - t0); }
+};
+
+
+// ============================================================
+//  SYSTEM GAUGES (shared by all nodes)
+// ============================================================
+
+static Gauge sysHeapFree   ("heap_free_bytes",     "Free heap");
+static Gauge sysHeapMin    ("heap_min_free_bytes", "Lowest free heap since boot");
+static Gauge sysUptime     ("uptime_s",            "Seconds since boot");
+
+inline void metrics_sample_system() {
+  sysHeapFree.set((int32_t)ESP.getFreeHeap());
+  sysHeapMin.set((int32_t)ESP.getMinFreeHeap());
+  sysUptime.set((int32_t)(millis() / 1000));
+}
+
+
+// ============================================================
+//  EXPORT
+// ============================================================
+
+// Prometheus text exposition format 0.0.4
+inline void metrics_write_prometheus(Print& out) {
+  for (const Metric* m = metrics_head(); m; m = m->next) {
+    const char* type = (m->kind == METRIC_COUNTER) ? "counter"
+                     : (m->kind == METRIC_GAUGE)   ? "gauge" : "histogram";
+    out.printf("# HELP h2h_%s %s\n# TYPE h2h_%s %s\n", m->name, m->help, m->name, type);
+
+    if (m->kind == METRIC_COUNTER) {
+      out.printf("h2h_%s %lu\n", m->name, (unsigned long)static_cast<const Counter*>(m)->get());
+    } else if (m->kind == METRIC_GAUGE) {
+      out.printf("h2h_%s %ld\n", m->name, (long)static_cast<const Gauge*>(m)->get());
+    } else {
+      const Histogram* h = static_cast<const Histogram*>(m);
+      uint32_t cum = 0;
+      for (uint8_t i = 0; i < h->nbounds; i++) {
+        cum += h->buckets[i].load(std::memory_order_relaxed);
+        out.printf("h2h_%s_bucket{le=\"%lu\"} %lu\n", m->name,
+                   (unsigned long)h->bounds[i], (unsigned long)cum);
+      }
+      cum += h->buckets[h->nbounds].load(std::memory_order_relaxed);
+      out.printf("h2h_%s_bucket{le=\"+Inf\"} %lu\n", m->name, (unsigned long)cum);
+      out.printf("h2h_%s_sum %lu\n",   m->name, (unsigned long)h->sum.load(std::memory_order_relaxed));
+      out.printf("h2h_%s_count %lu\n", m->name, (unsigned long)h->count.load(std::memory_order_relaxed));
+    }
+  }
+}
+
+// One numeric value per metric, e.g. for MQTT "h2h/<house>/sys/<name><suffix>".
+// Histograms are flattened to <name>_count and <name>_sum.
+// fn(const char* name, const char* suffix, long value)
+template <typename Fn>
+inline void metrics_for_each_value(Fn fn) {
+  for (const Metric* m = metrics_head(); m; m = m->next) {
+    if (m->kind == METRIC_COUNTER) {
+      fn(m->name, "", (long)static_cast<const Counter*>(m)->get());
+    } else if (m->kind == METRIC_GAUGE) {
+      fn(m->name, "", (long)static_cast<const Gauge*>(m)->get());
+    } else {
+      const Histogram* h = static_cast<const Histogram*>(m);
+      fn(m->name, "_count", (long)h->count.load(std::memory_order_relaxed));
+      fn(m->name, "_sum",   (long)h->sum.load(std::memory_order_relaxed));
+    }
+  }
+}
+
+} // namespace h2h
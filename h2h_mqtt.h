@@ -0,0 +1,759 @@
+// ============================================================
+// h2h_mqtt.h  —  small non-blocking MQTT 3.1.1 / 5 client (header-only)
+// - template over an Arduino Client (WiFiClient, ...): connect() sends
+//   CONNECT and returns, CONNACK / PUBLISH / PUBACK are handled in loop()
+// - incremental parser: loop() takes whatever the socket has, packets may
+//   arrive in any number of pieces; never waits for the rest
+// - handler gets topic / payload views into the receive buffer, no copy.
+//   The payload is NUL-terminated in place (the byte after it is saved and
+//   restored), so atoi()/atof() work directly on it
+// - QoS 0/1 publish (QoS 1 kept until PUBACK, re-sent after a reconnect;
+//   set_on_puback() gets the send -> PUBACK time, e.g. as an RTT probe),
+//   QoS 0/1 subscribe, last will, keepalive
+// - MQTT 5 (set_protocol(5)): topic aliases both ways. The first ALIASES
+//   topics published get an alias, later samples carry only 2 bytes
+//   instead of the topic string. Falls back to 3.1.1 if the broker
+//   refuses v5
+// - v5 properties: extra ones per PUBLISH from a hook (set_publish_props,
+//   e.g. a MAC, h2h_mac.h) and on the will; received ones are passed
+//   through raw in MqttMessage::props
+// - packets larger than RX_SIZE are skipped and counted
+// - set_rx_budget(): loop() reads at most that many bytes per call, a
+//   queued backlog is worked off in slices (the rest waits in the socket)
+// - TCP connect itself is the Client's (WiFiClient: bounded by its timeout)
+// - single task only (no locking)
+// ============================================================
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#ifdef ARDUINO
+  #include <Arduino.h>
+#else
+  #include <errno.h>
+  #include <stdio.h>
+  #include <netdb.h>
+  #include <netinet/in.h>
+  #include <netinet/tcp.h>
+  #include <sys/ioctl.h>
+  #include <sys/socket.h>
+  #include <time.h>
+  #include <unistd.h>
+#endif
+
+
+namespace h2h {
+
+static inline uint32_t mqtt_now_ms() {
+#ifdef ARDUINO
+  return millis();
+#else
+  timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint32_t)(ts.tv_sec * 1000 + ts.tv_nsec / 1000000);
+#endif
+}
+
+
+// ---------- MQTT 5 properties (also used by broker/h2h_broker.cpp) ----------
+
+static const uint8_t MQTT_PROP_TOPIC_ALIAS_MAX = 0x22;
+static const uint8_t MQTT_PROP_TOPIC_ALIAS     = 0x23;
+static const uint8_t MQTT_PROP_USER            = 0x26;
+
+struct MqttProp {
+  uint8_t        id;
+  uint32_t       num;          // byte / u16 / u32 / varint properties
+  const uint8_t* data;         // string / binary / string pair
+  uint32_t       len;
+};
+
+static inline bool mqtt_varint(const uint8_t*& p, const uint8_t* end, uint32_t& v) {
+  v = 0;
+  for (int shift = 0; shift <= 21; shift += 7) {
+    if (p >= end) return false;
+    const uint8_t b = *p++;
+    v |= (uint32_t)(b & 0x7F) << shift;
+    if (!(b & 0x80)) return true;
+  }
+  return false;
+}
+
+// one property from [p, end); false = malformed or unknown id
+static inline bool mqtt_prop_next(const uint8_t*& p, const uint8_t* end, MqttProp& out) {
+  if (p >= end) return false;
+  out.id = *p++;
+  out.num = 0;
+  out.data = nullptr;
+  out.len = 0;
+  const size_t left = (size_t)(end - p);
+
+  switch (out.id) {
+    case 0x01: case 0x17: case 0x19: case 0x24: case 0x25: case 0x28: case 0x29: case 0x2A:
+      if (left < 1) return false;
+      out.num = *p++;
+      return true;
+    case 0x13: case 0x21: case 0x22: case 0x23:
+      if (left < 2) return false;
+      out.num = (uint32_t)((p[0] << 8) | p[1]);
+      p += 2;
+      return true;
+    case 0x02: case 0x11: case 0x18: case 0x27:
+      if (left < 4) return false;
+      out.num = ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) | ((uint32_t)p[2] << 8) | p[3];
+      p += 4;
+      return true;
+    case 0x0B:
+      return mqtt_varint(p, end, out.num);
+    case MQTT_PROP_USER: {                                 // user property: two strings
+      const uint8_t* s = p;
+      for (int k = 0; k < 2; k++) {
+        if ((size_t)(end - p) < 2) return false;
+        const size_t l = (size_t)((p[0] << 8) | p[1]);
+        if ((size_t)(end - p) < 2 + l) return false;
+        p += 2 + l;
+      }
+      out.data = s;
+      out.len = (uint32_t)(p - s);
+      return true;
+    }
+    case 0x03: case 0x08: case 0x09: case 0x12: case 0x15: case 0x16: case 0x1A: case 0x1C: case 0x1F: {
+      if (left < 2) return false;
+      const size_t l = (size_t)((p[0] << 8) | p[1]);
+      if (left < 2 + l) return false;
+      out.data = p + 2;
+      out.len = (uint32_t)l;
+      p += 2 + l;
+      return true;
+    }
+    default:
+      return false;
+  }
+}
+
+
+// Received PUBLISH; views are valid only during the handler call
+struct MqttMessage {
+  const char*    topic;        // not NUL-terminated, use topic_is()
+  uint16_t       topicLen;
+  const char*    payload;      // NUL-terminated in place
+  size_t         payloadLen;
+  uint8_t        qos;
+  bool           retain;
+  const uint8_t* props;        // v5 property block (no length prefix), nullptr on 3.1.1
+  uint32_t       propsLen;
+
+  bool topic_is(const char* t) const {
+    return strlen(t) == topicLen && memcmp(t, topic, topicLen) == 0;
+  }
+};
+
+template <class Net, size_t RX_SIZE = 512, size_t TX_SIZE = 256, uint8_t INFLIGHT = 4, uint8_t ALIASES = 16>
+class MqttClient {
+public:
+  enum State : uint8_t { DISCONNECTED, CONNECTING, CONNECTED };
+
+  static const uint32_t CONNACK_TIMEOUT_MS = 5000;
+  static const size_t   ALIAS_TOPIC_MAX = 64;              // longer topics go without alias
+  static const size_t   EXTRA_PROPS_MAX = 48;              // publish hook output
+
+  typedef void (*MessageHandler)(const MqttMessage&);
+  typedef void (*ConnectHandler)();
+  typedef void (*AckHandler)(uint32_t rttMs);             // QoS 1 publish -> PUBACK
+  // extra v5 properties for one PUBLISH into out (cap bytes); returns the length
+  typedef size_t (*PropsHook)(const char* topic, size_t tlen, const void* payload, size_t len,
+                              uint8_t* out, size_t cap);
+
+  explicit MqttClient(Net& net) : net_(net) {}
+
+  void set_server(const char* host, uint16_t port) { host_ = host; port_ = port; }
+  void set_handler(MessageHandler h)  { onMessage_ = h; }
+  void set_on_connect(ConnectHandler h) { onConnect_ = h; }   // CONNACK ok: subscribe here
+  void set_on_puback(AckHandler h) { onAck_ = h; }
+  void set_keepalive(uint16_t s) { keepAliveS_ = s; }
+  void set_publish_props(PropsHook h) { propsHook_ = h; }     // v5 only, not called on 3.1.1
+  void set_rx_budget(size_t bytes) { rxBudget_ = bytes; }    // per loop(), 0 = all there is
+
+  // 4 = 3.1.1 (default), 5 = MQTT 5 with topic aliases
+  void set_protocol(uint8_t version) {
+    const uint8_t v = version == 5 ? 5 : 4;
+    if (v != version_) clear_inflight();                  // stored packets are per version
+    version_ = v;
+  }
+  uint8_t protocol() const { return version_; }
+
+  // payload must stay valid (string literal / static): sent with every CONNECT
+  void set_will(const char* topic, const char* payload, uint8_t qos, bool retain) {
+    willTopic_ = topic; willPayload_ = payload; willQos_ = qos > 1 ? 1 : qos; willRetain_ = retain;
+  }
+
+  // v5 will properties (encoded, no length prefix); must stay valid like the payload
+  void set_will_props(const uint8_t* props, uint8_t len) { willProps_ = props; willPropsLen_ = len < 128 ? len : 0; }
+
+  // TCP connect + CONNECT; true = waiting for CONNACK (see state())
+  bool connect(const char* clientId, const char* user = nullptr, const char* pass = nullptr) {
+    if (state_ != DISCONNECTED) drop();
+    rxLen_ = 0;
+    skip_ = 0;
+    connackRc_ = 0xFF;
+    txAliasMax_ = 0;                                       // aliases live for one connection
+    txAliasUsed_ = 0;
+    memset(rxAliasLen_, 0, sizeof(rxAliasLen_));
+    if (!net_.connect(host_, port_)) return false;
+
+    const bool v5 = version_ == 5;
+    const bool hasUser = user && user[0];
+    const bool hasPass = hasUser && pass && pass[0];
+    size_t rem = 10 + 2 + str_len(clientId);
+    if (v5) rem += 4;                                      // props: topic alias maximum
+    if (willTopic_) rem += 4 + str_len(willTopic_) + str_len(willPayload_) + (v5 ? 1 + willPropsLen_ : 0);
+    if (hasUser) rem += 2 + str_len(user);
+    if (hasPass) rem += 2 + str_len(pass);
+
+    uint8_t flags = 0x02;                                  // clean session / clean start
+    if (willTopic_) flags |= 0x04 | (uint8_t)(willQos_ << 3) | (willRetain_ ? 0x20 : 0);
+    if (hasUser) flags |= 0x80;
+    if (hasPass) flags |= 0x40;
+
+    size_t n = begin_packet(0x10, rem);
+    if (!n) { net_.stop(); return false; }
+    n = put_str(n, "MQTT");
+    tx_[n++] = version_;
+    tx_[n++] = flags;
+    tx_[n++] = (uint8_t)(keepAliveS_ >> 8);
+    tx_[n++] = (uint8_t)keepAliveS_;
+    if (v5) {
+      tx_[n++] = 3;
+      tx_[n++] = MQTT_PROP_TOPIC_ALIAS_MAX;
+      tx_[n++] = 0;
+      tx_[n++] = ALIASES;
+    }
+    n = put_str(n, clientId);
+    if (willTopic_) {
+      if (v5) {
+        tx_[n++] = willPropsLen_;                          // < 128: one-byte varint
+        if (willPropsLen_) memcpy(tx_ + n, willProps_, willPropsLen_);
+        n += willPropsLen_;
+      }
+      n = put_str(n, willTopic_);
+      n = put_str(n, willPayload_);
+    }
+    if (hasUser) n = put_str(n, user);
+    if (hasPass) n = put_str(n, pass);
+
+    state_ = CONNECTING;
+    connectMs_ = lastIn_ = mqtt_now_ms();
+    if (!send(tx_, n)) return false;
+    return true;
+  }
+
+  void disconnect() {
+    if (state_ == CONNECTED) {
+      const uint8_t p[2] = { 0xE0, 0 };
+      net_.write(p, 2);
+    }
+    drop();
+  }
+
+  State state() const { return state_; }
+  bool connected() const { return state_ == CONNECTED; }
+  bool active() const { return state_ != DISCONNECTED; }   // connected or handshake running
+  uint8_t connack_rc() const { return connackRc_; }          // 0xFF = none yet
+  uint32_t oversize_dropped() const { return oversize_; }
+  uint32_t alias_misses() const { return aliasMiss_; }       // inbound alias without topic
+  uint8_t aliases_out() const { return txAliasUsed_; }
+  uint32_t tx_bytes() const { return txBytes_; }              // wraps
+  uint32_t rx_bytes() const { return rxBytes_; }
+  uint8_t inflight() const {
+    uint8_t k = 0;
+    for (auto& f : inflight_) if (f.pid) k++;
+    return k;
+  }
+
+  // false: not connected, too large for TX_SIZE, or QoS 1 window full
+  bool publish(const char* topic, const void* payload, size_t len, bool retain = false, uint8_t qos = 0) {
+    if (state_ != CONNECTED) return false;
+    qos = qos ? 1 : 0;
+    const size_t tlen = str_len(topic);
+
+    Inflight* slot = nullptr;
+    if (qos) {
+      for (auto& f : inflight_) if (!f.pid) { slot = &f; break; }
+      if (!slot) return false;
+    }
+
+    // QoS 1 may be re-sent on a new connection: always with the full topic
+    bool newAlias = false;
+    const uint8_t alias = (version_ == 5 && !qos) ? tx_alias(topic, tlen, newAlias) : 0;
+    const bool withTopic = !alias || newAlias;
+    uint8_t extra[EXTRA_PROPS_MAX];
+    const size_t extraLen = (version_ == 5 && propsHook_) ? propsHook_(topic, tlen, payload, len, extra, sizeof(extra)) : 0;
+    const size_t props = version_ == 5 ? 1 + (alias ? 3 : 0) + extraLen : 0;
+
+    size_t n = begin_packet((uint8_t)(0x30 | (qos << 1) | (retain ? 1 : 0)),
+                            2 + (withTopic ? tlen : 0) + (qos ? 2 : 0) + props + len);
+    if (!n) return false;
+    n = withTopic ? put_str(n, topic) : put_str(n, nullptr);
+    uint16_t pid = 0;
+    if (qos) {
+      pid = next_pid();
+      tx_[n++] = (uint8_t)(pid >> 8);
+      tx_[n++] = (uint8_t)pid;
+    }
+    if (props) {
+      tx_[n++] = (uint8_t)(props - 1);
+      if (alias) {
+        tx_[n++] = MQTT_PROP_TOPIC_ALIAS;
+        tx_[n++] = 0;
+        tx_[n++] = alias;
+      }
+      if (extraLen) memcpy(tx_ + n, extra, extraLen);
+      n += extraLen;
+    }
+    if (len) memcpy(tx_ + n, payload, len);
+    n += len;
+
+    if (newAlias) {                                        // fits: now it is ours
+      memcpy(txAlias_[txAliasUsed_], topic, tlen);
+      txAliasLen_[txAliasUsed_] = (uint8_t)tlen;
+      txAliasUsed_++;
+    }
+    if (slot) {
+      memcpy(slot->buf, tx_, n);
+      slot->len = (uint16_t)n;
+      slot->pid = pid;
+      slot->sentMs = mqtt_now_ms();
+    }
+    return send(tx_, n);
+  }
+
+  bool publish(const char* topic, const char* payload, bool retain = false, uint8_t qos = 0) {
+    return publish(topic, payload, str_len(payload), retain, qos);
+  }
+
+  bool subscribe(const char* filter, uint8_t qos = 0) {
+    if (state_ != CONNECTED) return false;
+    size_t n = begin_packet(0x82, 2 + (version_ == 5 ? 1 : 0) + 2 + str_len(filter) + 1);
+    if (!n) return false;
+    const uint16_t pid = next_pid();
+    tx_[n++] = (uint8_t)(pid >> 8);
+    tx_[n++] = (uint8_t)pid;
+    if (version_ == 5) tx_[n++] = 0;                       // no properties
+    n = put_str(n, filter);
+    tx_[n++] = qos > 1 ? 1 : qos;                          // v5: options, QoS in bits 0-1
+    return send(tx_, n);
+  }
+
+  // read what is there, dispatch complete packets, keepalive
+  void loop() {
+    if (state_ == DISCONNECTED) return;
+    if (!net_.connected()) { drop(); return; }
+
+    size_t budget = rxBudget_ ? rxBudget_ : (size_t)-1;
+    while (budget) {
+      const int avail = net_.available();
+      if (avail <= 0 || rxLen_ >= RX_SIZE) break;
+      size_t want = RX_SIZE - rxLen_;
+      if ((size_t)avail < want) want = (size_t)avail;
+      if (budget < want) want = budget;
+      const int r = net_.read(rx_ + rxLen_, want);
+      if (r <= 0) break;
+      budget -= (size_t)r;
+      rxLen_ += (size_t)r;
+      rxBytes_ += (uint32_t)r;
+      lastIn_ = mqtt_now_ms();
+      process();
+      if (state_ == DISCONNECTED) return;
+    }
+
+    const uint32_t now = mqtt_now_ms();
+    if (state_ == CONNECTING) {
+      if (now - connectMs_ > CONNACK_TIMEOUT_MS) drop();
+      return;
+    }
+    if (keepAliveS_) {
+      if (now - lastIn_ > keepAliveS_ * 1500UL) { drop(); return; }   // no PINGRESP either
+      if (now - lastOut_ >= keepAliveS_ * 1000UL) {
+        const uint8_t p[2] = { 0xC0, 0 };
+        send(p, 2);
+      }
+    }
+  }
+
+private:
+  struct Inflight {
+    uint16_t pid = 0;           // 0 = free
+    uint16_t len = 0;
+    uint32_t sentMs = 0;
+    uint8_t  buf[TX_SIZE];
+  };
+
+  static size_t str_len(const char* s) { return s ? strlen(s) : 0; }
+
+  // fixed header into tx_; 0 if the packet does not fit
+  size_t begin_packet(uint8_t head, size_t rem) {
+    if (rem > 0x0FFFFFFF) return 0;
+    size_t n = 0;
+    tx_[n++] = head;
+    size_t len = rem;
+    do {
+      uint8_t b = len & 0x7F;
+      len >>= 7;
+      if (len) b |= 0x80;
+      tx_[n++] = b;
+    } while (len);
+    return n + rem <= TX_SIZE ? n : 0;
+  }
+
+  size_t put_str(size_t n, const char* s) {
+    const size_t len = str_len(s);
+    tx_[n++] = (uint8_t)(len >> 8);
+    tx_[n++] = (uint8_t)len;
+    if (len) memcpy(tx_ + n, s, len);
+    return n + len;
+  }
+
+  uint16_t next_pid() {
+    if (++pid_ == 0) pid_ = 1;
+    return pid_;
+  }
+
+  // alias for topic (1..), 0 = none; isNew: not yet known to the broker
+  uint8_t tx_alias(const char* topic, size_t tlen, bool& isNew) {
+    isNew = false;
+    for (uint8_t i = 0; i < txAliasUsed_; i++) {
+      if (txAliasLen_[i] == tlen && memcmp(txAlias_[i], topic, tlen) == 0) return (uint8_t)(i + 1);
+    }
+    if (txAliasUsed_ >= txAliasMax_ || tlen >= ALIAS_TOPIC_MAX) return 0;
+    isNew = true;
+    return (uint8_t)(txAliasUsed_ + 1);
+  }
+
+  bool send(const uint8_t* p, size_t n) {
+    if (net_.write(p, n) != n) { drop(); return false; }
+    txBytes_ += (uint32_t)n;
+    lastOut_ = mqtt_now_ms();
+    return true;
+  }
+
+  void drop() {
+    net_.stop();
+    state_ = DISCONNECTED;
+    rxLen_ = 0;
+    skip_ = 0;
+  }
+
+  void clear_inflight() {
+    for (auto& f : inflight_) f.pid = 0;
+  }
+
+  // complete packets in rx_; the incomplete tail moves to the front
+  void process() {
+    size_t off = 0;
+    while (off < rxLen_) {
+      if (skip_) {
+        size_t n = rxLen_ - off;
+        if (n > skip_) n = skip_;
+        off += n;
+        skip_ -= n;
+        continue;
+      }
+
+      const size_t avail = rxLen_ - off;
+      if (avail < 2) break;
+      uint32_t rem = 0;
+      size_t i = 1;
+      bool complete = false;
+      for (int shift = 0; i < avail; shift += 7) {
+        if (shift > 21) { drop(); return; }
+        const uint8_t b = rx_[off + i++];
+        rem |= (uint32_t)(b & 0x7F) << shift;
+        if (!(b & 0x80)) { complete = true; break; }
+      }
+      if (!complete) break;
+
+      const size_t total = i + rem;
+      if (total > RX_SIZE) { oversize_++; skip_ = total; continue; }
+      if (avail < total) break;
+
+      handle(rx_[off], rx_ + off + i, rem);
+      if (state_ == DISCONNECTED) return;
+      off += total;
+    }
+    if (off) {
+      memmove(rx_, rx_ + off, rxLen_ - off);
+      rxLen_ -= off;
+    }
+  }
+
+  void on_connack(const uint8_t* body, uint32_t len) {
+    if (len < 2 || state_ != CONNECTING) { drop(); return; }
+    connackRc_ = body[1];
+    if (connackRc_ != 0) {
+      // 3.1.1 broker: "unacceptable protocol version" (1), v5 broker: 0x84
+      if (version_ == 5 && (connackRc_ == 0x01 || connackRc_ == 0x84)) set_protocol(4);
+      drop();
+      return;
+    }
+    if (version_ == 5 && len > 2) {
+      const uint8_t* p = body + 2;
+      const uint8_t* end = body + len;
+      uint32_t plen;
+      if (!mqtt_varint(p, end, plen) || plen > (uint32_t)(end - p)) { drop(); return; }
+      end = p + plen;
+      MqttProp pr;
+      while (p < end) {
+        if (!mqtt_prop_next(p, end, pr)) { drop(); return; }
+        if (pr.id == MQTT_PROP_TOPIC_ALIAS_MAX) txAliasMax_ = pr.num < ALIASES ? (uint8_t)pr.num : ALIASES;
+      }
+    }
+    state_ = CONNECTED;
+    resend_inflight();
+    if (onConnect_) onConnect_();
+  }
+
+  void on_publish(uint8_t head, uint8_t* body, uint32_t len) {
+    const uint8_t qos = (head >> 1) & 3;
+    if (len < 2) { drop(); return; }
+    const uint16_t tlen = (uint16_t)((body[0] << 8) | body[1]);
+    size_t p = 2 + (size_t)tlen;
+    uint16_t pid = 0;
+    if (qos) {
+      if (p + 2 > len) { drop(); return; }
+      pid = (uint16_t)((body[p] << 8) | body[p + 1]);
+      p += 2;
+    }
+    if (p > len) { drop(); return; }
+
+    const char* topic = (const char*)body + 2;
+    uint16_t topicLen = tlen;
+    bool deliver = true;
+    const uint8_t* props = nullptr;
+    uint32_t propsLen = 0;
+
+    if (version_ == 5) {
+      const uint8_t* q = body + p;
+      const uint8_t* end = body + len;
+      uint32_t plen;
+      if (!mqtt_varint(q, end, plen) || plen > (uint32_t)(end - q)) { drop(); return; }
+      const uint8_t* pend = q + plen;
+      props = q;
+      propsLen = plen;
+      uint32_t alias = 0;
+      MqttProp pr;
+      while (q < pend) {
+        if (!mqtt_prop_next(q, pend, pr)) { drop(); return; }
+        if (pr.id == MQTT_PROP_TOPIC_ALIAS) alias = pr.num;
+      }
+      p = (size_t)(pend - body);
+
+      if (alias) {
+        if (alias > ALIASES) { drop(); return; }
+        const uint8_t k = (uint8_t)(alias - 1);
+        if (tlen) {                                        // (re)define the alias
+          if (tlen < ALIAS_TOPIC_MAX) {
+            memcpy(rxAlias_[k], topic, tlen);
+            rxAliasLen_[k] = (uint8_t)tlen;
+          } else {
+            rxAliasLen_[k] = 0;
+          }
+        } else if (rxAliasLen_[k]) {
+          topic = rxAlias_[k];
+          topicLen = rxAliasLen_[k];
+        } else {
+          aliasMiss_++;
+          deliver = false;
+        }
+      } else if (!tlen) {
+        drop();
+        return;
+      }
+    }
+
+    if (deliver) {
+      MqttMessage m;
+      m.topic      = topic;
+      m.topicLen   = topicLen;
+      m.payload    = (const char*)body + p;
+      m.payloadLen = len - p;
+      m.qos        = qos;
+      m.retain     = head & 1;
+      m.props      = props;
+      m.propsLen   = propsLen;
+
+      uint8_t* end = body + len;                           // <= rx_ + RX_SIZE
+      const uint8_t saved = *end;
+      *end = 0;
+      if (onMessage_) onMessage_(m);
+      *end = saved;
+    }
+
+    if (qos && state_ == CONNECTED) {
+      const uint8_t ack[4] = { (uint8_t)(qos == 1 ? 0x40 : 0x50), 2, (uint8_t)(pid >> 8), (uint8_t)pid };
+      send(ack, 4);
+    }
+  }
+
+  void handle(uint8_t head, uint8_t* body, uint32_t len) {
+    switch (head >> 4) {
+      case 2:                                              // CONNACK
+        on_connack(body, len);
+        break;
+
+      case 3:                                              // PUBLISH
+        on_publish(head, body, len);
+        break;
+
+      case 4: {                                            // PUBACK
+        if (len < 2) break;
+        const uint16_t pid = (uint16_t)((body[0] << 8) | body[1]);
+        for (auto& f : inflight_) {
+          if (f.pid != pid) continue;
+          f.pid = 0;
+          if (onAck_) onAck_(mqtt_now_ms() - f.sentMs);
+        }
+        break;
+      }
+
+      case 6: {                                            // PUBREL -> PUBCOMP
+        if (len < 2) break;
+        const uint8_t p[4] = { 0x70, 2, body[0], body[1] };
+        send(p, 4);
+        break;
+      }
+
+      case 14:                                             // v5: DISCONNECT from the broker
+        drop();
+        break;
+
+      default:                                             // SUBACK, PINGRESP, ...
+        break;
+    }
+  }
+
+  // clean session: the broker forgot them, send again with DUP set
+  void resend_inflight() {
+    for (auto& f : inflight_) {
+      if (!f.pid) continue;
+      f.buf[0] |= 0x08;
+      f.sentMs = mqtt_now_ms();                           // RTT of this connection, not of the outage
+      if (!send(f.buf, f.len)) return;
+    }
+  }
+
+  Net&           net_;
+  const char*    host_ = nullptr;
+  uint16_t       port_ = 1883;
+  uint16_t       keepAliveS_ = 15;
+  uint8_t        version_ = 4;
+  State          state_ = DISCONNECTED;
+  uint8_t        connackRc_ = 0xFF;
+
+  const char*    willTopic_ = nullptr;
+  const char*    willPayload_ = nullptr;
+  uint8_t        willQos_ = 0;
+  bool           willRetain_ = false;
+  const uint8_t* willProps_ = nullptr;
+  uint8_t        willPropsLen_ = 0;
+
+  MessageHandler onMessage_ = nullptr;
+  ConnectHandler onConnect_ = nullptr;
+  AckHandler     onAck_ = nullptr;
+  PropsHook      propsHook_ = nullptr;
+
+  uint8_t        rx_[RX_SIZE + 1];                       // +1: in-place payload NUL
+  size_t         rxLen_ = 0;
+  size_t         skip_ = 0;                              // rest of an oversize packet
+  uint32_t       oversize_ = 0;
+  size_t         rxBudget_ = 0;
+  uint8_t        tx_[TX_SIZE];
+  uint16_t       pid_ = 0;
+  Inflight       inflight_[INFLIGHT];
+
+  // v5 topic aliases, per connection: ours (publish) and the broker's (receive)
+  uint8_t        txAliasMax_ = 0;
+  uint8_t        txAliasUsed_ = 0;
+  char           txAlias_[ALIASES][ALIAS_TOPIC_MAX];
+  uint8_t        txAliasLen_[ALIASES];
+  char           rxAlias_[ALIASES][ALIAS_TOPIC_MAX];
+  uint8_t        rxAliasLen_[ALIASES] = {};             // 0 = not defined
+  uint32_t       aliasMiss_ = 0;
+
+  uint32_t       txBytes_ = 0;
+  uint32_t       rxBytes_ = 0;
+  uint32_t       connectMs_ = 0;
+  uint32_t       lastIn_ = 0;
+  uint32_t       lastOut_ = 0;
+};
+
+
+#ifndef ARDUINO
+// Host-side Client (Linux sockets) for running MqttClient against a local broker
+class PosixClient {
+public:
+  ~PosixClient() { stop(); }
+
+  int connect(const char* host, uint16_t port) {
+    stop();
+    addrinfo hints = {}, *res = nullptr;
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    char service[8];
+    snprintf(service, sizeof(service), "%u", port);
+    if (getaddrinfo(host, service, &hints, &res) != 0) return 0;
+    for (addrinfo* a = res; a; a = a->ai_next) {
+      fd_ = socket(a->ai_family, a->ai_socktype, a->ai_protocol);
+      if (fd_ < 0) continue;
+      if (::connect(fd_, a->ai_addr, a->ai_addrlen) == 0) break;
+      ::close(fd_);
+      fd_ = -1;
+    }
+    freeaddrinfo(res);
+    if (fd_ < 0) return 0;
+    const int one = 1;
+    setsockopt(fd_, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    return 1;
+  }
+
+  size_t write(const uint8_t* p, size_t n) {
+    size_t off = 0;
+    while (off < n) {
+      const ssize_t w = ::send(fd_, p + off, n - off, MSG_NOSIGNAL);
+      if (w <= 0) { if (w < 0 && errno == EINTR) continue; break; }
+      off += (size_t)w;
+    }
+    return off;
+  }
+
+  int available() {
+    int n = 0;
+    if (fd_ < 0 || ioctl(fd_, FIONREAD, &n) < 0) return 0;
+    return n;
+  }
+
+  int read(uint8_t* p, size_t n) { return fd_ < 0 ? -1 : (int)::recv(fd_, p, n, MSG_DONTWAIT); }
+
+  uint8_t connected() {
+    if (fd_ < 0) return 0;
+    uint8_t b;
+    const ssize_t r = ::recv(fd_, &b, 1, MSG_PEEK | MSG_DONTWAIT);
+    if (r == 0 || (r < 0 && errno != EAGAIN && errno != EWOULDBLOCK)) return 0;
+    return 1;
+  }
+
+  void stop() {
+    if (fd_ >= 0) ::close(fd_);
+    fd_ = -1;
+  }
+
+  int fd() const { return fd_; }
+
+private:
+  int fd_ = -1;
+};
+#endif
+
+} // namespace h2h
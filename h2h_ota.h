@@ -0,0 +1,127 @@
+// ============================================================
+// h2h_ota.h  —  delta OTA on the ESP32 (patch format: h2h_delta.h)
+// - old image = the running app partition (esp_partition_read),
+//   new image = the next OTA slot, written block by block while the
+//   patch streams in over HTTP; nothing is buffered beyond 4 KB
+// - the header MAC (key = 32 hex chars, h2h_delta.h) and then the old
+//   image CRC are checked before the slot is erased: a forged patch, a
+//   patch for another build (or one that is already installed) costs
+//   one header download, nothing is written. No usable key: no download
+// - boot partition only switches after size, CRC and the signed SHA-256
+//   of the new image and esp_ota_end()'s own image check passed; the
+//   caller restarts. Plain HTTP is fine for that: the transport is not
+//   trusted, the signature is
+// - blocks the calling task for the download: run it from the net task
+//   or loop(), not from a callback
+//
+// Include from the sketch itself (one translation unit).
+// ============================================================
+
+#pragma once
+
+#include <Arduino.h>
+#include <HTTPClient.h>
+#include <esp_ota_ops.h>
+#include <esp_partition.h>
+#include "h2h_delta.h"
+#include "h2h_metrics.h"
+
+
+namespace h2h {
+
+static Counter   otaAttempts   ("ota_delta_total",        "Delta OTA attempts");
+static Counter   otaFailed     ("ota_delta_fail_total",   "Delta OTA attempts that kept the running image");
+static Gauge     otaLastStatus ("ota_delta_last_status",  "Last delta OTA: 1 ok, 0 download cut, < 0 error (h2h_delta.h)");
+
+struct OtaRunningImage {
+  const esp_partition_t* part = esp_ota_get_running_partition();
+  bool read(uint32_t off, uint8_t* buf, size_t n) {
+    return part && esp_partition_read(part, off, buf, n) == ESP_OK;
+  }
+};
+
+struct OtaNextSlot {
+  const esp_partition_t* part = esp_ota_get_next_update_partition(nullptr);
+  esp_ota_handle_t handle = 0;
+  bool open = false;
+
+  bool begin(uint32_t size) {
+    if (!part || size > part->size) return false;
+    open = esp_ota_begin(part, size, &handle) == ESP_OK;   // erases what the image needs
+    return open;
+  }
+  bool write(const uint8_t* p, size_t n) { return esp_ota_write(handle, p, n) == ESP_OK; }
+
+  // new image complete: validate and boot it next time
+  bool commit() {
+    open = false;
+    return esp_ota_end(handle) == ESP_OK && esp_ota_set_boot_partition(part) == ESP_OK;
+  }
+  void abort() {
+    if (open) esp_ota_abort(handle);
+    open = false;
+  }
+};
+
+// Download the patch at url, verify it against keyHex and apply it.
+// DELTA_DONE: the new image boots after ESP.restart(); anything else: the
+// running image stays as it is.
+inline DeltaStatus ota_delta_http(const char* url, const char* keyHex, Print& log, uint32_t idleTimeoutMs = 15000) {
+  otaAttempts.inc();
+  uint8_t key[DELTA_KEY_LEN];
+  if (!delta_key_from_hex(keyHex, key)) {
+    log.printf("ota: no key (32 hex chars, not all zero), not fetching\n");
+    otaFailed.inc();
+    otaLastStatus.set(DELTA_ERR_AUTH);
+    return DELTA_ERR_AUTH;
+  }
+  OtaRunningImage src;
+  OtaNextSlot dst;
+  auto* ap = new DeltaApplier<OtaRunningImage, OtaNextSlot>(src, dst, key);   // ~8.6 KB, only for the update
+  memset(key, 0, sizeof(key));
+  DeltaStatus st = DELTA_ERR_HEADER;
+
+  HTTPClient http;
+  http.setTimeout(idleTimeoutMs);
+  const uint32_t t0 = millis();
+  if (http.begin(url) && http.GET() == HTTP_CODE_OK) {
+    WiFiClient* s = http.getStreamPtr();
+    const int size = http.getSize();          // -1: chunked / unknown
+    uint8_t buf[512];
+    uint32_t got = 0, lastData = millis(), nextLog = 64 * 1024;
+    st = DELTA_MORE;
+    while (st == DELTA_MORE && (size < 0 || got < (uint32_t)size)) {
+      const int avail = s->available();
+      if (avail <= 0) {
+        if (!http.connected() || millis() - lastData > idleTimeoutMs) break;
+        delay(2);
+        continue;
+      }
+      const int r = s->read(buf, avail < (int)sizeof(buf) ? avail : sizeof(buf));
+      if (r <= 0) continue;
+      got += (uint32_t)r;
+      lastData = millis();
+      st = ap->write(buf, (size_t)r);
+      if (got >= nextLog) {
+        log.printf("ota: %u patch bytes -> %u image bytes\n", (unsigned)got, (unsigned)ap->written());
+        nextLog += 64 * 1024;
+      }
+    }
+    log.printf("ota: %u patch bytes in %u ms\n", (unsigned)got, (unsigned)(millis() - t0));
+  } else {
+    log.printf("ota: GET %s failed\n", url);
+  }
+  http.end();
+
+  if (st == DELTA_DONE && !dst.commit()) st = DELTA_ERR_WRITE;
+  if (st != DELTA_DONE) {
+    dst.abort();
+    otaFailed.inc();                          // DELTA_MORE here: download ended early
+  }
+  log.printf("ota: %s (image %u bytes)\n", delta_status_str(st), (unsigned)ap->written());
+  delete ap;
+  otaLastStatus.set(st);
+  return st;
+}
+
+} // namespace h2h
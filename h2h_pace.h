@@ -0,0 +1,106 @@
+// ============================================================
+// h2h_pace.h  —  adaptive publish rate (AIMD on link quality)
+// - samples keep their fixed clock; the pacer decides how many of them
+//   go into one publish (batch 1 = every sample, the healthy case)
+// - one QoS 1 publish per batch is the probe: send -> PUBACK is the RTT
+//   (MqttClient::set_on_puback). Base RTT = minimum over the last two
+//   windows of PACE_RTT_WINDOW probes, so a route change is picked up
+// - congestion: probe RTT > 2 x base + slack (queueing), probe still
+//   unacked when the next batch is due, or a publish the client refused
+//   -> batch doubles (rate halves, multiplicative decrease)
+// - clean batch -> batch - 1 (additive increase); weak RSSI holds the
+//   batch where it is (retries on the air, not queueing)
+// - no clock, no I/O: the sketch feeds samples, acks and failures
+// ============================================================
+
+#pragma once
+
+#include <stdint.h>
+
+#ifndef PACE_RTT_WINDOW
+  #define PACE_RTT_WINDOW 32          // probes per base-RTT window
+#endif
+
+
+namespace h2h {
+
+struct PaceConfig {
+  uint8_t  minBatch   = 1;            // samples per publish on a good link
+  uint8_t  maxBatch   = 12;           // 12 x 5 s = one publish per minute at worst
+  uint32_t rttSlackMs = 50;           // on top of 2 x base RTT
+  int8_t   rssiWeak   = -80;          // dBm, below: no increase
+};
+
+enum PaceSignal : uint8_t { PACE_CLEAN, PACE_RTT, PACE_LOST, PACE_FAILED, PACE_WEAK };
+
+class PublishPacer {
+public:
+  explicit PublishPacer(const PaceConfig& c = PaceConfig()) : cfg_(c), batch_(c.minBatch) {}
+
+  // PUBACK of a probe
+  void on_ack(uint32_t rttMs) {
+    lastRtt_ = rttMs;
+    haveRtt_ = true;
+    srtt_ = srtt_ ? (7 * srtt_ + rttMs) / 8 : rttMs;
+    if (rttMs < winMin_) winMin_ = rttMs;
+    if (++winN_ >= PACE_RTT_WINDOW) {
+      prevMin_ = winMin_;
+      winMin_ = UINT32_MAX;
+      winN_ = 0;
+    }
+  }
+
+  void on_publish_failed() { failed_ = true; }
+
+  // One sample taken. true: batch complete, publish it now (the batch
+  // size for the next one is already adjusted). probeInflight: the last
+  // probe has no PUBACK yet (MqttClient::inflight() > 0).
+  bool sample(int8_t rssi, bool probeInflight) {
+    if (++samples_ < batch_) return false;
+    samples_ = 0;
+    adjust(rssi, probeInflight);
+    return true;
+  }
+
+  uint8_t    batch() const       { return batch_; }
+  uint32_t   srtt_ms() const     { return srtt_; }
+  uint32_t   base_rtt_ms() const { return winMin_ < prevMin_ ? winMin_ : prevMin_; }   // UINT32_MAX: none yet
+  PaceSignal last_signal() const { return last_; }
+  uint32_t   backoffs() const    { return backoffs_; }
+
+private:
+  void adjust(int8_t rssi, bool probeInflight) {
+    const uint32_t base = base_rtt_ms();
+    PaceSignal s = PACE_CLEAN;
+    if (failed_)             s = PACE_FAILED;
+    else if (probeInflight)  s = PACE_LOST;
+    else if (haveRtt_ && base != UINT32_MAX && lastRtt_ > 2 * base + cfg_.rttSlackMs) s = PACE_RTT;
+    else if (rssi < cfg_.rssiWeak) s = PACE_WEAK;
+    failed_ = false;
+    haveRtt_ = false;                 // each RTT sample decides one batch
+    last_ = s;
+
+    if (s == PACE_CLEAN) {
+      if (batch_ > cfg_.minBatch) batch_--;
+    } else if (s != PACE_WEAK) {
+      const uint16_t b = (uint16_t)batch_ * 2;
+      batch_ = b > cfg_.maxBatch ? cfg_.maxBatch : (uint8_t)b;
+      backoffs_++;
+    }
+  }
+
+  PaceConfig cfg_;
+  uint8_t    batch_;
+  uint8_t    samples_ = 0;
+  bool       failed_ = false;
+  bool       haveRtt_ = false;
+  PaceSignal last_ = PACE_CLEAN;
+  uint32_t   lastRtt_ = 0;
+  uint32_t   srtt_ = 0;
+  uint32_t   winMin_ = UINT32_MAX;
+  uint32_t   prevMin_ = UINT32_MAX;
+  uint8_t    winN_ = 0;
+  uint32_t   backoffs_ = 0;
+};
+
+} // namespace h2h
@@ -0,0 +1,101 @@
+// ============================================================
+// h2h_pcnt.h  —  hardware pulse counting via the ESP32 PCNT unit
+// - edges are counted by the peripheral (glitch filter included),
+//   the CPU only reads the 16-bit counter now and then: no ISR per pulse
+// - poll() folds the hardware counter into a 32-bit total; call it at
+//   least once per PCNT_LIMIT pulses (32767 pulses, e.g. 1 s at 30 kHz)
+// - rate(): pulses/s since the previous rate() call
+// ============================================================
+
+#pragma once
+
+#include <stdint.h>
+
+#ifdef ARDUINO
+  #include <Arduino.h>
+  #include <driver/pcnt.h>
+#endif
+
+
+namespace h2h {
+
+static const int16_t PCNT_LIMIT = 32767;   // counter resets to 0 when it gets here
+
+// pulses between two counter readings; cur < last means the counter wrapped once
+static inline uint32_t pcnt_delta(int16_t last, int16_t cur) {
+  if (cur >= last) return (uint32_t)(cur - last);
+  return (uint32_t)(PCNT_LIMIT - last) + (uint32_t)cur;
+}
+
+#ifdef ARDUINO
+
+class PulseCounter {
+public:
+  // rising edges on pin; filterApbTicks: ignore pulses shorter than n / 80 MHz (max 1023)
+  bool begin(pcnt_unit_t unit, int pin, uint16_t filterApbTicks = 1023) {
+    unit_ = unit;
+
+    pcnt_config_t c = {};
+    c.pulse_gpio_num = pin;
+    c.ctrl_gpio_num  = PCNT_PIN_NOT_USED;
+    c.channel        = PCNT_CHANNEL_0;
+    c.unit           = unit;
+    c.pos_mode       = PCNT_COUNT_INC;
+    c.neg_mode       = PCNT_COUNT_DIS;
+    c.lctrl_mode     = PCNT_MODE_KEEP;
+    c.hctrl_mode     = PCNT_MODE_KEEP;
+    c.counter_h_lim  = PCNT_LIMIT;
+    c.counter_l_lim  = 0;
+    if (pcnt_unit_config(&c) != ESP_OK) return false;
+
+    pinMode(pin, INPUT_PULLUP);                        // S0 outputs are open collector
+    pcnt_set_filter_value(unit, filterApbTicks > 1023 ? 1023 : filterApbTicks);
+    pcnt_filter_enable(unit);
+    pcnt_counter_pause(unit);
+    pcnt_counter_clear(unit);
+    pcnt_counter_resume(unit);
+
+    last_ = 0;
+    total_ = 0;
+    rateTotal_ = 0;
+    rateMs_ = millis();
+    ok_ = true;
+    return true;
+  }
+
+  // fold the hardware counter into total(); cheap (one register read)
+  uint32_t poll() {
+    if (!ok_) return total_;
+    int16_t cur = 0;
+    if (pcnt_get_counter_value(unit_, &cur) != ESP_OK) return total_;
+    total_ += pcnt_delta(last_, cur);
+    last_ = cur;
+    return total_;
+  }
+
+  uint32_t total() const { return total_; }
+
+  float rate() {
+    poll();
+    const uint32_t now = millis();
+    const uint32_t dt = now - rateMs_;
+    const float r = dt ? (total_ - rateTotal_) * 1000.0f / dt : 0.0f;
+    rateMs_ = now;
+    rateTotal_ = total_;
+    return r;
+  }
+
+  bool ok() const { return ok_; }
+
+private:
+  pcnt_unit_t unit_ = PCNT_UNIT_0;
+  int16_t     last_ = 0;
+  uint32_t    total_ = 0;          // wraps after 2^32 pulses
+  uint32_t    rateTotal_ = 0;
+  uint32_t    rateMs_ = 0;
+  bool        ok_ = false;
+};
+
+#endif
+
+} // namespace h2h
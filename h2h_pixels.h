@@ -0,0 +1,287 @@
+// ============================================================
+// h2h_pixels.h  —  pixel kernels over packed 8-bit channel buffers
+// - scale (brightness), blend (crossfade), gamma (LUT), fill, luma
+// - px_*_ref: plain scalar reference, always available
+// - px_*:     fastest variant for the target
+//     ESP32 (all):   SWAR, 4 channels per 32-bit word (no S3 PIE path:
+//                    GCC has no intrinsics for it, only hand-written asm)
+//     host x86:      SSE2 (16 ch) / AVX2 (32 ch) when compiled with them
+// - buffers are in wire order (GRB etc.); kernels do not care
+// - PX_VARIANTS: every variant built for this target, for the benches
+// - pixels_bench(): on-device timing of all variants on a 300-LED frame;
+//   broker/h2h_pixels_bench.cpp checks and times them on the host
+//
+// Kernels have no Arduino dependency and build on the host as well.
+// ============================================================
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#if defined(__AVX2__)
+  #include <immintrin.h>
+  #define H2H_PX_AVX2 1
+#endif
+#if defined(__SSE2__)
+  #include <emmintrin.h>
+  #define H2H_PX_SSE2 1
+#endif
+
+
+namespace h2h {
+
+// ============================================================
+//  SCALAR REFERENCE
+// ============================================================
+
+// c' = c * (s + 1) >> 8   (s = 255 keeps the value)
+inline void px_scale_ref(uint8_t* p, size_t n, uint8_t s) {
+  const uint16_t k = (uint16_t)s + 1;
+  for (size_t i = 0; i < n; i++) p[i] = (uint8_t)((p[i] * k) >> 8);
+}
+
+// dst = (a * (256 - t) + b * t) >> 8   (t = 0 -> a, t = 255 -> ~b)
+inline void px_blend_ref(uint8_t* dst, const uint8_t* a, const uint8_t* b, size_t n, uint8_t t) {
+  const uint16_t wb = t, wa = 256 - t;
+  for (size_t i = 0; i < n; i++) dst[i] = (uint8_t)((a[i] * wa + b[i] * wb) >> 8);
+}
+
+inline void px_gamma(uint8_t* p, size_t n, const uint8_t lut[256]) {
+  for (size_t i = 0; i < n; i++) p[i] = lut[p[i]];
+}
+
+// count pixels of 3 channels each
+inline void px_fill3(uint8_t* p, size_t count, uint8_t c0, uint8_t c1, uint8_t c2) {
+  for (size_t i = 0; i < count; i++) {
+    p[0] = c0; p[1] = c1; p[2] = c2;
+    p += 3;
+  }
+}
+
+// Perceived brightness 0..255 (0.299 R + 0.587 G + 0.114 B in 8.8 fixed point)
+inline uint8_t px_luma(uint8_t r, uint8_t g, uint8_t b) {
+  return (uint8_t)((77u * r + 150u * g + 29u * b) >> 8);
+}
+
+// Dim (never brighten) a color to the given luma, integer only
+inline void px_normalize_luma(uint8_t& r, uint8_t& g, uint8_t& b, uint8_t target) {
+  uint16_t l = px_luma(r, g, b);
+  if (l < 1) l = 1;
+  if (l <= target) return;
+  const uint16_t k = (uint16_t)(((uint32_t)target << 8) / l);   // < 256
+  r = (uint8_t)((r * k) >> 8);
+  g = (uint8_t)((g * k) >> 8);
+  b = (uint8_t)((b * k) >> 8);
+}
+
+
+// ============================================================
+//  SWAR (32-bit words, even/odd byte lanes in 16-bit halves)
+// ============================================================
+
+inline uint32_t px_swar_scale_word(uint32_t w, uint32_t k) {
+  const uint32_t even = (((w & 0x00FF00FFu) * k) >> 8) & 0x00FF00FFu;
+  const uint32_t odd  = (((w >> 8) & 0x00FF00FFu) * k) & 0xFF00FF00u;
+  return even | odd;
+}
+
+inline uint32_t px_swar_blend_word(uint32_t a, uint32_t b, uint32_t wa, uint32_t wb) {
+  const uint32_t even = (((a & 0x00FF00FFu) * wa + (b & 0x00FF00FFu) * wb) >> 8) & 0x00FF00FFu;
+  const uint32_t odd  = (((a >> 8) & 0x00FF00FFu) * wa + ((b >> 8) & 0x00FF00FFu) * wb) & 0xFF00FF00u;
+  return even | odd;
+}
+
+inline void px_scale_swar(uint8_t* p, size_t n, uint8_t s) {
+  const uint32_t k = (uint32_t)s + 1;
+  // Xtensa faults on unaligned word access: byte head until aligned
+  while (n && ((uintptr_t)p & 3)) { *p = (uint8_t)((*p * k) >> 8); p++; n--; }
+  uint32_t* w = (uint32_t*)p;
+  for (size_t i = 0; i < n / 4; i++) w[i] = px_swar_scale_word(w[i], k);
+  px_scale_ref(p + (n & ~(size_t)3), n & 3, s);
+}
+
+inline void px_blend_swar(uint8_t* dst, const uint8_t* a, const uint8_t* b, size_t n, uint8_t t) {
+  const uint32_t wb = t, wa = 256 - t;
+  const uintptr_t mis = ((uintptr_t)dst | (uintptr_t)a | (uintptr_t)b) & 3;
+  if (mis && ((((uintptr_t)dst ^ (uintptr_t)a) | ((uintptr_t)dst ^ (uintptr_t)b)) & 3)) {
+    px_blend_ref(dst, a, b, n, t);   // different alignments: no word path
+    return;
+  }
+  while (n && ((uintptr_t)dst & 3)) { *dst++ = (uint8_t)((*a++ * wa + *b++ * wb) >> 8); n--; }
+  uint32_t* d = (uint32_t*)dst;
+  const uint32_t* wa32 = (const uint32_t*)a;
+  const uint32_t* wb32 = (const uint32_t*)b;
+  for (size_t i = 0; i < n / 4; i++) d[i] = px_swar_blend_word(wa32[i], wb32[i], wa, wb);
+  const size_t done = n & ~(size_t)3;
+  px_blend_ref(dst + done, a + done, b + done, n & 3, t);
+}
+
+
+// ============================================================
+//  x86 SIMD (host builds: simulator / visualizer / tests)
+// ============================================================
+
+#if H2H_PX_SSE2
+inline void px_scale_sse2(uint8_t* p, size_t n, uint8_t s) {
+  const __m128i k = _mm_set1_epi16((short)(s + 1));
+  const __m128i z = _mm_setzero_si128();
+  size_t i = 0;
+  for (; i + 16 <= n; i += 16) {
+    __m128i v  = _mm_loadu_si128((const __m128i*)(p + i));
+    __m128i lo = _mm_srli_epi16(_mm_mullo_epi16(_mm_unpacklo_epi8(v, z), k), 8);
+    __m128i hi = _mm_srli_epi16(_mm_mullo_epi16(_mm_unpackhi_epi8(v, z), k), 8);
+    _mm_storeu_si128((__m128i*)(p + i), _mm_packus_epi16(lo, hi));
+  }
+  px_scale_ref(p + i, n - i, s);
+}
+
+inline void px_blend_sse2(uint8_t* dst, const uint8_t* a, const uint8_t* b, size_t n, uint8_t t) {
+  const __m128i wa = _mm_set1_epi16((short)(256 - t));
+  const __m128i wb = _mm_set1_epi16((short)t);
+  const __m128i z  = _mm_setzero_si128();
+  size_t i = 0;
+  for (; i + 16 <= n; i += 16) {
+    __m128i va = _mm_loadu_si128((const __m128i*)(a + i));
+    __m128i vb = _mm_loadu_si128((const __m128i*)(b + i));
+    __m128i lo = _mm_add_epi16(_mm_mullo_epi16(_mm_unpacklo_epi8(va, z), wa),
+                               _mm_mullo_epi16(_mm_unpacklo_epi8(vb, z), wb));
+    __m128i hi = _mm_add_epi16(_mm_mullo_epi16(_mm_unpackhi_epi8(va, z), wa),
+                               _mm_mullo_epi16(_mm_unpackhi_epi8(vb, z), wb));
+    _mm_storeu_si128((__m128i*)(dst + i),
+                     _mm_packus_epi16(_mm_srli_epi16(lo, 8), _mm_srli_epi16(hi, 8)));
+  }
+  px_blend_ref(dst + i, a + i, b + i, n - i, t);
+}
+#endif
+
+#if H2H_PX_AVX2
+// unpack/pack work per 128-bit lane, so the byte order comes out unchanged
+inline void px_scale_avx2(uint8_t* p, size_t n, uint8_t s) {
+  const __m256i k = _mm256_set1_epi16((short)(s + 1));
+  const __m256i z = _mm256_setzero_si256();
+  size_t i = 0;
+  for (; i + 32 <= n; i += 32) {
+    __m256i v  = _mm256_loadu_si256((const __m256i*)(p + i));
+    __m256i lo = _mm256_srli_epi16(_mm256_mullo_epi16(_mm256_unpacklo_epi8(v, z), k), 8);
+    __m256i hi = _mm256_srli_epi16(_mm256_mullo_epi16(_mm256_unpackhi_epi8(v, z), k), 8);
+    _mm256_storeu_si256((__m256i*)(p + i), _mm256_packus_epi16(lo, hi));
+  }
+  px_scale_sse2(p + i, n - i, s);
+}
+
+inline void px_blend_avx2(uint8_t* dst, const uint8_t* a, const uint8_t* b, size_t n, uint8_t t) {
+  const __m256i wa = _mm256_set1_epi16((short)(256 - t));
+  const __m256i wb = _mm256_set1_epi16((short)t);
+  const __m256i z  = _mm256_setzero_si256();
+  size_t i = 0;
+  for (; i + 32 <= n; i += 32) {
+    __m256i va = _mm256_loadu_si256((const __m256i*)(a + i));
+    __m256i vb = _mm256_loadu_si256((const __m256i*)(b + i));
+    __m256i lo = _mm256_add_epi16(_mm256_mullo_epi16(_mm256_unpacklo_epi8(va, z), wa),
+                                  _mm256_mullo_epi16(_mm256_unpacklo_epi8(vb, z), wb));
+    __m256i hi = _mm256_add_epi16(_mm256_mullo_epi16(_mm256_unpackhi_epi8(va, z), wa),
+                                  _mm256_mullo_epi16(_mm256_unpackhi_epi8(vb, z), wb));
+    _mm256_storeu_si256((__m256i*)(dst + i),
+                        _mm256_packus_epi16(_mm256_srli_epi16(lo, 8), _mm256_srli_epi16(hi, 8)));
+  }
+  px_blend_sse2(dst + i, a + i, b + i, n - i, t);
+}
+#endif
+
+
+// ============================================================
+//  DISPATCH (compile time)
+// ============================================================
+
+inline void px_scale(uint8_t* p, size_t n, uint8_t s) {
+#if H2H_PX_AVX2
+  px_scale_avx2(p, n, s);
+#elif H2H_PX_SSE2
+  px_scale_sse2(p, n, s);
+#else
+  px_scale_swar(p, n, s);
+#endif
+}
+
+inline void px_blend(uint8_t* dst, const uint8_t* a, const uint8_t* b, size_t n, uint8_t t) {
+#if H2H_PX_AVX2
+  px_blend_avx2(dst, a, b, n, t);
+#elif H2H_PX_SSE2
+  px_blend_sse2(dst, a, b, n, t);
+#else
+  px_blend_swar(dst, a, b, n, t);
+#endif
+}
+
+typedef void (*PxScaleFn)(uint8_t*, size_t, uint8_t);
+typedef void (*PxBlendFn)(uint8_t*, const uint8_t*, const uint8_t*, size_t, uint8_t);
+
+struct PxVariant {
+  const char* name;
+  PxScaleFn   scale;
+  PxBlendFn   blend;
+};
+
+static const PxVariant PX_VARIANTS[] = {
+  { "ref",  px_scale_ref,  px_blend_ref  },
+  { "swar", px_scale_swar, px_blend_swar },
+#if H2H_PX_SSE2
+  { "sse2", px_scale_sse2, px_blend_sse2 },
+#endif
+#if H2H_PX_AVX2
+  { "avx2", px_scale_avx2, px_blend_avx2 },
+#endif
+};
+
+} // namespace h2h
+
+
+// ============================================================
+//  ON-DEVICE BENCHMARK (serial 'p')
+// ============================================================
+
+#ifdef ARDUINO
+#include <Arduino.h>
+
+namespace h2h {
+
+inline void pixels_bench(Print& out) {
+  static const size_t N = 300 * 3;            // 300 LEDs
+  static const int ROUNDS = 200;
+  static uint8_t a[N], b[N], ref[N], tst[N];
+  for (size_t i = 0; i < N; i++) { a[i] = (uint8_t)(i * 7); b[i] = (uint8_t)(255 - i * 3); }
+
+  out.printf("pixel kernels, %u channels, ns per frame (cycles)\n", (unsigned)N);
+  const uint32_t mhz = ESP.getCpuFreqMHz();
+  for (const PxVariant& v : PX_VARIANTS) {
+    memcpy(ref, a, N); px_scale_ref(ref, N, 100);
+    memcpy(tst, a, N); v.scale(tst, N, 100);
+    const bool scaleOk = memcmp(ref, tst, N) == 0;
+    px_blend_ref(ref, a, b, N, 77);
+    v.blend(tst, a, b, N, 77);
+    const bool blendOk = memcmp(ref, tst, N) == 0;
+
+    uint32_t c0 = ESP.getCycleCount();
+    for (int r = 0; r < ROUNDS; r++) v.scale(tst, N, 200);
+    const uint32_t scaleCyc = (ESP.getCycleCount() - c0) / ROUNDS;
+    c0 = ESP.getCycleCount();
+    for (int r = 0; r < ROUNDS; r++) v.blend(tst, a, b, N, (uint8_t)r);
+    const uint32_t blendCyc = (ESP.getCycleCount() - c0) / ROUNDS;
+
+    out.printf("%-5s scale %6lu ns (%lu)%s  blend %6lu ns (%lu)%s\n", v.name,
+               (unsigned long)(scaleCyc * 1000 / mhz), (unsigned long)scaleCyc, scaleOk ? "" : " MISMATCH",
+               (unsigned long)(blendCyc * 1000 / mhz), (unsigned long)blendCyc, blendOk ? "" : " MISMATCH");
+  }
+}
+
+// Serial command 'p' = kernel benchmark; returns false for other characters
+inline bool pixels_serial_cmd(int c) {
+  if (c != 'p') return false;
+  pixels_bench(Serial);
+  return true;
+}
+
+} // namespace h2h
+#endif // ARDUINO
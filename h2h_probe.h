@@ -0,0 +1,302 @@
+// ============================================================
+// h2h_probe.h  —  RTT / clock offset between houses (NTP-style)
+// - request:  h2h/<self>/sys/probe          "<seq> <t1>"
+//   reply:    h2h/<peer>/sys/probe/<self>   "<seq> <t1> <t2> <t3>"
+//   t = wall clock in us (gettimeofday; without SNTP: time since boot).
+//   Every node answers every other node's request, so each pair is
+//   measured from both sides; the host tool (broker/h2h_probe.cpp) is
+//   just another peer
+// - per sample: delay = (t4 - t1) - (t3 - t2), offset = ((t2 - t1) +
+//   (t3 - t4)) / 2 (peer clock minus ours). Broker queueing shows up in
+//   the delay, not in the offset, as long as both directions are equal
+// - NTP clock filter: the last PROBE_FILTER samples per peer, the one
+//   with the lowest delay gives the offset; jitter = RMS of the other
+//   offsets around it; skew = slope of the filtered offset (ppm)
+// - RTT distribution per peer in fixed buckets (p50 / p90 from them),
+//   min, smoothed, lost = requests without a reply from that peer (the
+//   newest one is still in flight, it does not count)
+// - PROBE_PEERS_MAX slots; a peer only gets one with a reply that passed
+//   the checks, and a full table gives up the peer silent for longest
+//   (a stopped host tool, forged names) instead of refusing real peers
+// - no metrics registry here (also built on the host): the sketch
+//   observes handle() results and publishes for_each_value()
+// ============================================================
+
+#pragma once
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <sys/time.h>
+#include "h2h_mqtt.h"
+
+#ifndef PROBE_PEERS_MAX
+  #define PROBE_PEERS_MAX 4
+#endif
+
+#ifndef PROBE_FILTER
+  #define PROBE_FILTER 8               // samples in the clock filter (NTP: 8)
+#endif
+
+#ifndef PROBE_SKEW_POINTS
+  #define PROBE_SKEW_POINTS 16         // filtered offsets kept for the slope
+#endif
+
+
+namespace h2h {
+
+inline int64_t probe_now_us() {
+  timeval tv;
+  gettimeofday(&tv, nullptr);
+  return (int64_t)tv.tv_sec * 1000000 + tv.tv_usec;
+}
+
+static const uint32_t PROBE_BUCKETS_MS[] = { 10, 25, 50, 100, 250, 500, 1000, 2500, 5000, 10000 };
+static const uint8_t  PROBE_NBUCKETS = sizeof(PROBE_BUCKETS_MS) / sizeof(PROBE_BUCKETS_MS[0]);
+
+struct ProbeSample {
+  int64_t delayUs;
+  int64_t offsetUs;
+  int64_t atUs;                        // t4, our clock
+};
+
+struct ProbePeer {
+  char     name[16] = {};              // house id, "" = free
+  uint32_t firstSeq = 0;               // our first request it answered
+  uint32_t replies = 0;
+  uint32_t lastSeq = 0;
+  int64_t  lastReplyUs = 0;            // our clock, for eviction
+
+  ProbeSample filter[PROBE_FILTER];
+  uint8_t  filterN = 0;
+  uint8_t  filterHead = 0;
+
+  // estimates (valid once replies > 0)
+  int64_t  offsetUs = 0;               // peer clock - our clock
+  int64_t  selectedAtUs = 0;           // sample the offset came from
+  uint32_t jitterUs = 0;
+  uint32_t minRttUs = UINT32_MAX;
+  uint32_t srttUs = 0;
+  float    skewPpm = 0;
+
+  ProbeSample skew[PROBE_SKEW_POINTS];
+  uint8_t  skewN = 0;
+  uint8_t  skewHead = 0;
+
+  uint32_t buckets[PROBE_NBUCKETS + 1] = {};
+
+  // sentSeq itself only counts once it was answered
+  uint32_t lost(uint32_t sentSeq) const {
+    if (!replies) return 0;
+    const uint32_t last = lastSeq == sentSeq ? sentSeq : sentSeq - 1;
+    const uint32_t asked = last - firstSeq + 1;
+    return asked > replies ? asked - replies : 0;
+  }
+
+  // bucket upper bound below which q (0..100) % of the RTTs lie; 0 = none
+  uint32_t rtt_percentile_ms(uint8_t q) const {
+    uint32_t total = 0;
+    for (uint32_t c : buckets) total += c;
+    if (!total) return 0;
+    const uint32_t want = (total * q + 99) / 100;
+    uint32_t cum = 0;
+    for (uint8_t i = 0; i < PROBE_NBUCKETS; i++) {
+      cum += buckets[i];
+      if (cum >= want) return PROBE_BUCKETS_MS[i];
+    }
+    return PROBE_BUCKETS_MS[PROBE_NBUCKETS - 1] * 2;   // beyond the last bucket
+  }
+
+  void add(const ProbeSample& s) {
+    const uint32_t rtt = s.delayUs > 0xFFFFFFFFLL ? UINT32_MAX : (uint32_t)s.delayUs;
+    if (rtt < minRttUs) minRttUs = rtt;
+    srttUs = srttUs ? (uint32_t)(((uint64_t)srttUs * 7 + rtt) / 8) : rtt;
+    uint8_t b = 0;
+    while (b < PROBE_NBUCKETS && rtt / 1000 > PROBE_BUCKETS_MS[b]) b++;
+    buckets[b]++;
+
+    filter[filterHead] = s;
+    filterHead = (filterHead + 1) % PROBE_FILTER;
+    if (filterN < PROBE_FILTER) filterN++;
+
+    // lowest delay in the filter = least queueing = best offset
+    const ProbeSample* best = &filter[0];
+    for (uint8_t i = 1; i < filterN; i++) {
+      if (filter[i].delayUs < best->delayUs) best = &filter[i];
+    }
+    double sq = 0;
+    for (uint8_t i = 0; i < filterN; i++) {
+      const double d = (double)(filter[i].offsetUs - best->offsetUs);
+      sq += d * d;
+    }
+    jitterUs = filterN > 1 ? (uint32_t)sqrt(sq / (filterN - 1)) : 0;
+
+    // like NTP: only a newer selection moves the estimate
+    if (best->atUs <= selectedAtUs) return;
+    selectedAtUs = best->atUs;
+    offsetUs = best->offsetUs;
+
+    skew[skewHead] = *best;
+    skewHead = (skewHead + 1) % PROBE_SKEW_POINTS;
+    if (skewN < PROBE_SKEW_POINTS) skewN++;
+    const ProbeSample& oldest = skew[(skewHead + PROBE_SKEW_POINTS - skewN) % PROBE_SKEW_POINTS];
+    const int64_t spanUs = best->atUs - oldest.atUs;
+    if (spanUs >= 60LL * 1000000) {    // below a minute the jitter dominates
+      skewPpm = (float)((double)(best->offsetUs - oldest.offsetUs) * 1e6 / (double)spanUs);
+    }
+  }
+};
+
+enum ProbeResult : uint8_t { PROBE_NONE, PROBE_REQUEST, PROBE_REPLY, PROBE_BAD };
+
+class ProbeService {
+public:
+  explicit ProbeService(const char* house) : house_(house), houseLen_(strlen(house)) {}
+
+  // subscribe both on every (re)connect
+  template <class Client>
+  void subscribe(Client& mqtt) {
+    char filter[64];
+    mqtt.subscribe("h2h/+/sys/probe", 0);
+    snprintf(filter, sizeof(filter), "h2h/+/sys/probe/%s", house_);
+    mqtt.subscribe(filter, 0);
+  }
+
+  template <class Client>
+  bool send(Client& mqtt) {
+    char topic[64], payload[40];
+    snprintf(topic, sizeof(topic), "h2h/%s/sys/probe", house_);
+    snprintf(payload, sizeof(payload), "%lu %lld", (unsigned long)(seq_ + 1), (long long)probe_now_us());
+    if (!mqtt.publish(topic, payload, false)) return false;
+    seq_++;
+    return true;
+  }
+
+  // rxUs: probe_now_us() as early as possible after the message arrived
+  template <class Client>
+  ProbeResult handle(Client& mqtt, const MqttMessage& m, int64_t rxUs) {
+    const char* peer;
+    size_t peerLen;
+    bool reply;
+    if (!parse_topic(m, peer, peerLen, reply)) return PROBE_NONE;
+    if (peerLen == houseLen_ && memcmp(peer, house_, peerLen) == 0) return PROBE_NONE;   // our own request
+
+    char* end;
+    const unsigned long seq = strtoul(m.payload, &end, 10);
+    const long long t1 = strtoll(end, &end, 10);
+    if (!reply) {
+      char topic[64], payload[96];
+      snprintf(topic, sizeof(topic), "h2h/%s/sys/probe/%.*s", house_, (int)peerLen, peer);
+      snprintf(payload, sizeof(payload), "%lu %lld %lld %lld", seq, t1, (long long)rxUs, (long long)probe_now_us());
+      mqtt.publish(topic, payload, false);
+      return PROBE_REQUEST;
+    }
+
+    const long long t2 = strtoll(end, &end, 10);
+    const long long t3 = strtoll(end, &end, 10);
+    if (!seq || seq > seq_ || !t1) return PROBE_BAD;
+    ProbeSample s;
+    s.delayUs  = (rxUs - t1) - (t3 - t2);
+    s.offsetUs = ((t2 - t1) + (t3 - rxUs)) / 2;
+    s.atUs     = rxUs;
+    if (s.delayUs < 0) return PROBE_BAD;       // clock stepped between t1 and t4
+    ProbePeer* p = find_peer(peer, peerLen);
+    if (p && (uint32_t)seq <= p->lastSeq) return PROBE_BAD;   // duplicate / reordered
+    if (!p) p = claim_peer(peer, peerLen);
+    if (!p->replies) p->firstSeq = (uint32_t)seq;
+    p->lastSeq = (uint32_t)seq;
+    p->lastReplyUs = rxUs;
+    p->replies++;
+    p->add(s);
+    last_ = s;
+    return PROBE_REPLY;
+  }
+
+  const ProbeSample& last_sample() const { return last_; }
+  uint32_t sent() const { return seq_; }
+
+  // fn(const ProbePeer&), peers with at least one reply
+  template <typename Fn>
+  void for_each_peer(Fn fn) const {
+    for (const ProbePeer& p : peers_) if (p.name[0] && p.replies) fn(p);
+  }
+
+  // fn(const char* metric, const char* peer, long long value), one call
+  // per number and peer: h2h/<house>/sys/<metric>/<peer>
+  template <typename Fn>
+  void for_each_value(Fn fn) const {
+    for_each_peer([&](const ProbePeer& p) {
+      fn("probe_rtt_min_ms", p.name, (long long)(p.minRttUs / 1000));
+      fn("probe_rtt_p50_ms", p.name, (long long)p.rtt_percentile_ms(50));
+      fn("probe_rtt_p90_ms", p.name, (long long)p.rtt_percentile_ms(90));
+      fn("probe_jitter_us",  p.name, (long long)p.jitterUs);
+      fn("probe_offset_ms",  p.name, (long long)(p.offsetUs / 1000));   // epoch vs. boot clock: ~1.8e12
+      fn("probe_skew_ppm",   p.name, (long long)p.skewPpm);
+      fn("probe_lost",       p.name, (long long)p.lost(seq_));
+    });
+  }
+
+  // table for serial / the host tool; Out needs printf (Arduino Print)
+  template <class Out>
+  void report(Out& out) const {
+    out.printf("peer          replies  lost  rtt_min  rtt_p50  rtt_p90   srtt  jitter     offset_ms  skew_ppm\n");
+    for_each_peer([&](const ProbePeer& p) {
+      out.printf("%-12s %8lu %5lu %6lums %6lums %6lums %4lums %5luus %13lld %9.2f\n", p.name,
+                 (unsigned long)p.replies, (unsigned long)p.lost(seq_), (unsigned long)(p.minRttUs / 1000),
+                 (unsigned long)p.rtt_percentile_ms(50), (unsigned long)p.rtt_percentile_ms(90),
+                 (unsigned long)(p.srttUs / 1000), (unsigned long)p.jitterUs,
+                 (long long)(p.offsetUs / 1000), p.skewPpm);
+    });
+  }
+
+private:
+  // h2h/<peer>/sys/probe (request) or h2h/<peer>/sys/probe/<us> (reply)
+  bool parse_topic(const MqttMessage& m, const char*& peer, size_t& peerLen, bool& reply) const {
+    const char* t = m.topic;
+    const size_t n = m.topicLen;
+    if (n < 4 || memcmp(t, "h2h/", 4) != 0) return false;
+    const char* slash = (const char*)memchr(t + 4, '/', n - 4);
+    if (!slash) return false;
+    peer = t + 4;
+    peerLen = (size_t)(slash - peer);
+    if (!peerLen || peerLen >= sizeof(ProbePeer::name)) return false;
+    const char* rest = slash;
+    const size_t restLen = n - (size_t)(rest - t);
+    static const char SUFFIX[] = "/sys/probe";
+    const size_t sl = sizeof(SUFFIX) - 1;
+    if (restLen < sl || memcmp(rest, SUFFIX, sl) != 0) return false;
+    if (restLen == sl) { reply = false; return true; }
+    reply = true;
+    return restLen == sl + 1 + houseLen_ && rest[sl] == '/' && memcmp(rest + sl + 1, house_, houseLen_) == 0;
+  }
+
+  ProbePeer* find_peer(const char* name, size_t len) {
+    for (ProbePeer& p : peers_) {
+      if (p.name[0] && strlen(p.name) == len && memcmp(p.name, name, len) == 0) return &p;
+    }
+    return nullptr;
+  }
+
+  // free slot, else the one with the oldest reply
+  ProbePeer* claim_peer(const char* name, size_t len) {
+    ProbePeer* victim = &peers_[0];
+    for (ProbePeer& p : peers_) {
+      if (!p.name[0]) { victim = &p; break; }
+      if (p.lastReplyUs < victim->lastReplyUs) victim = &p;
+    }
+    *victim = ProbePeer();
+    memcpy(victim->name, name, len);
+    victim->name[len] = '\0';
+    return victim;
+  }
+
+  const char* house_;
+  size_t      houseLen_;
+  uint32_t    seq_ = 0;
+  ProbeSample last_ = {};
+  ProbePeer   peers_[PROBE_PEERS_MAX];
+};
+
+} // namespace h2h
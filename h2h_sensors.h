@@ -0,0 +1,454 @@
+// ============================================================
+// h2h_sensors.h  —  non-blocking I2C environment sensors (header-only)
+// - start() triggers a conversion and returns the wait in ms,
+//   read() fetches the result later: no delay() in the sampling path
+// - drivers: SHT3x (0x44/0x45), SHT4x (0x44), BME280 (0x76/0x77)
+// - sensor_detect(): probes the bus once at boot (may block a few ms)
+// - I2cBus: WireBus on the ESP32, MockI2cBus on the host
+//   (broker/h2h_sensors_test.cpp)
+// ============================================================
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#ifdef ARDUINO
+  #include <Arduino.h>
+  #include <Wire.h>
+#endif
+
+
+namespace h2h {
+
+// ---------- Bus ----------
+
+class I2cBus {
+public:
+  virtual ~I2cBus() {}
+  virtual bool write(uint8_t addr, const uint8_t* data, size_t len) = 0;   // false = NACK
+  virtual bool read(uint8_t addr, uint8_t* data, size_t len) = 0;
+  virtual void delay_ms(uint32_t ms) = 0;                                   // probing only
+
+  bool write_reg(uint8_t addr, uint8_t reg, uint8_t val) {
+    const uint8_t b[2] = { reg, val };
+    return write(addr, b, 2);
+  }
+
+  bool read_regs(uint8_t addr, uint8_t reg, uint8_t* out, size_t len) {
+    return write(addr, &reg, 1) && read(addr, out, len);
+  }
+
+  bool command(uint8_t addr, uint16_t cmd) {
+    const uint8_t b[2] = { (uint8_t)(cmd >> 8), (uint8_t)cmd };
+    return write(addr, b, 2);
+  }
+};
+
+#ifdef ARDUINO
+class WireBus : public I2cBus {
+public:
+  explicit WireBus(TwoWire& w) : w_(w) {}
+
+  bool write(uint8_t addr, const uint8_t* data, size_t len) override {
+    w_.beginTransmission(addr);
+    w_.write(data, len);
+    return w_.endTransmission() == 0;
+  }
+
+  bool read(uint8_t addr, uint8_t* data, size_t len) override {
+    if (w_.requestFrom(addr, (uint8_t)len) != len) return false;
+    for (size_t i = 0; i < len; i++) data[i] = (uint8_t)w_.read();
+    return true;
+  }
+
+  void delay_ms(uint32_t ms) override { delay(ms); }
+
+private:
+  TwoWire& w_;
+};
+#endif
+
+
+// ---------- Sensor interface ----------
+
+struct SensorReading {
+  float tempC;
+  float humid;       // %RH
+  float pressHpa;    // only if hasPress
+  bool  hasPress;
+};
+
+class EnvSensor {
+public:
+  virtual ~EnvSensor() {}
+  virtual const char* name() const = 0;
+  virtual bool begin() = 0;                     // probe + configure
+  virtual uint32_t start() = 0;                 // ms until read(); 0 = bus error
+  virtual bool read(SensorReading& out) = 0;    // result of the last start()
+};
+
+// Sensirion CRC-8: poly 0x31, init 0xFF
+static inline uint8_t sht_crc(const uint8_t* d, size_t n) {
+  uint8_t crc = 0xFF;
+  for (size_t i = 0; i < n; i++) {
+    crc ^= d[i];
+    for (uint8_t b = 0; b < 8; b++) crc = (crc & 0x80) ? (uint8_t)((crc << 1) ^ 0x31) : (uint8_t)(crc << 1);
+  }
+  return crc;
+}
+
+// 6-byte Sensirion frame: word0 crc word1 crc
+static inline bool sht_words(const uint8_t* f, uint16_t& w0, uint16_t& w1) {
+  if (sht_crc(f, 2) != f[2] || sht_crc(f + 3, 2) != f[5]) return false;
+  w0 = (uint16_t)((f[0] << 8) | f[1]);
+  w1 = (uint16_t)((f[3] << 8) | f[4]);
+  return true;
+}
+
+
+// ---------- SHT3x ----------
+
+class Sht3x : public EnvSensor {
+public:
+  explicit Sht3x(I2cBus& bus, uint8_t addr = 0x44) : bus_(bus), addr_(addr) {}
+
+  const char* name() const override { return "SHT3x"; }
+
+  bool begin() override {
+    uint8_t f[6];
+    uint16_t a, b;
+    if (!bus_.command(addr_, 0x3780)) return false;   // read serial number
+    bus_.delay_ms(1);
+    return bus_.read(addr_, f, 6) && sht_words(f, a, b);
+  }
+
+  uint32_t start() override {
+    return bus_.command(addr_, 0x2400) ? 16 : 0;       // single shot, high rep., no stretching; 15.5 ms max
+  }
+
+  bool read(SensorReading& out) override {
+    uint8_t f[6];
+    uint16_t t, rh;
+    if (!bus_.read(addr_, f, 6) || !sht_words(f, t, rh)) return false;
+    out.tempC = -45.0f + 175.0f * t / 65535.0f;
+    out.humid = 100.0f * rh / 65535.0f;
+    out.hasPress = false;
+    return true;
+  }
+
+private:
+  I2cBus& bus_;
+  uint8_t addr_;
+};
+
+
+// ---------- SHT4x ----------
+
+class Sht4x : public EnvSensor {
+public:
+  explicit Sht4x(I2cBus& bus, uint8_t addr = 0x44) : bus_(bus), addr_(addr) {}
+
+  const char* name() const override { return "SHT4x"; }
+
+  bool begin() override {
+    const uint8_t cmd = 0x89;                          // read serial number
+    uint8_t f[6];
+    uint16_t a, b;
+    if (!bus_.write(addr_, &cmd, 1)) return false;
+    bus_.delay_ms(1);
+    return bus_.read(addr_, f, 6) && sht_words(f, a, b);
+  }
+
+  uint32_t start() override {
+    const uint8_t cmd = 0xFD;                          // high precision; 8.3 ms max
+    return bus_.write(addr_, &cmd, 1) ? 10 : 0;
+  }
+
+  bool read(SensorReading& out) override {
+    uint8_t f[6];
+    uint16_t t, rh;
+    if (!bus_.read(addr_, f, 6) || !sht_words(f, t, rh)) return false;
+    float h = -6.0f + 125.0f * rh / 65535.0f;
+    out.tempC = -45.0f + 175.0f * t / 65535.0f;
+    out.humid = h < 0.0f ? 0.0f : (h > 100.0f ? 100.0f : h);
+    out.hasPress = false;
+    return true;
+  }
+
+private:
+  I2cBus& bus_;
+  uint8_t addr_;
+};
+
+
+// ---------- BME280 (forced mode, x1 oversampling, integer compensation) ----------
+
+class Bme280 : public EnvSensor {
+public:
+  explicit Bme280(I2cBus& bus, uint8_t addr = 0x76) : bus_(bus), addr_(addr) {}
+
+  const char* name() const override { return "BME280"; }
+
+  bool begin() override {
+    uint8_t id = 0;
+    if (!bus_.read_regs(addr_, 0xD0, &id, 1) || id != 0x60) return false;
+
+    uint8_t c[26], h[7];
+    if (!bus_.read_regs(addr_, 0x88, c, 26) || !bus_.read_regs(addr_, 0xE1, h, 7)) return false;
+    T1 = u16(c + 0);  T2 = s16(c + 2);  T3 = s16(c + 4);
+    P1 = u16(c + 6);  P2 = s16(c + 8);  P3 = s16(c + 10); P4 = s16(c + 12); P5 = s16(c + 14);
+    P6 = s16(c + 16); P7 = s16(c + 18); P8 = s16(c + 20); P9 = s16(c + 22);
+    H1 = c[25];
+    H2 = s16(h + 0);
+    H3 = h[2];
+    H4 = (int16_t)(((int8_t)h[3] << 4) | (h[4] & 0x0F));
+    H5 = (int16_t)(((int8_t)h[5] << 4) | (h[4] >> 4));
+    H6 = (int8_t)h[6];
+
+    return bus_.write_reg(addr_, 0xF2, 0x01)           // ctrl_hum: osrs_h x1 (latched by ctrl_meas)
+        && bus_.write_reg(addr_, 0xF5, 0x00);          // config: no IIR, no standby
+  }
+
+  uint32_t start() override {
+    // ctrl_meas: osrs_t x1, osrs_p x1, forced mode; 9.3 ms max
+    return bus_.write_reg(addr_, 0xF4, (1 << 5) | (1 << 2) | 1) ? 10 : 0;
+  }
+
+  bool read(SensorReading& out) override {
+    uint8_t d[8];
+    if (!bus_.read_regs(addr_, 0xF7, d, 8)) return false;
+    const int32_t adcP = ((int32_t)d[0] << 12) | ((int32_t)d[1] << 4) | (d[2] >> 4);
+    const int32_t adcT = ((int32_t)d[3] << 12) | ((int32_t)d[4] << 4) | (d[5] >> 4);
+    const int32_t adcH = ((int32_t)d[6] << 8)  | d[7];
+    if (adcT == 0x80000) return false;                 // skipped / not yet measured
+
+    out.tempC    = comp_t(adcT) / 100.0f;
+    out.pressHpa = comp_p(adcP) / 25600.0f;
+    out.humid    = comp_h(adcH) / 1024.0f;
+    out.hasPress = true;
+    return true;
+  }
+
+private:
+  static uint16_t u16(const uint8_t* p) { return (uint16_t)(p[0] | (p[1] << 8)); }
+  static int16_t  s16(const uint8_t* p) { return (int16_t)u16(p); }
+
+  // Bosch datasheet 4.2.3; 0.01 degC
+  int32_t comp_t(int32_t adc) {
+    int32_t v1 = ((((adc >> 3) - ((int32_t)T1 << 1))) * T2) >> 11;
+    int32_t v2 = (((((adc >> 4) - (int32_t)T1) * ((adc >> 4) - (int32_t)T1)) >> 12) * T3) >> 14;
+    tFine_ = v1 + v2;
+    return (tFine_ * 5 + 128) >> 8;
+  }
+
+  // Pa in Q24.8
+  uint32_t comp_p(int32_t adc) {
+    int64_t v1 = (int64_t)tFine_ - 128000;
+    int64_t v2 = v1 * v1 * P6;
+    v2 += (v1 * P5) << 17;
+    v2 += (int64_t)P4 << 35;
+    v1 = ((v1 * v1 * P3) >> 8) + ((v1 * P2) << 12);
+    v1 = ((((int64_t)1) << 47) + v1) * P1 >> 33;
+    if (v1 == 0) return 0;
+    int64_t p = 1048576 - adc;
+    p = (((p << 31) - v2) * 3125) / v1;
+    v1 = ((int64_t)P9 * (p >> 13) * (p >> 13)) >> 25;
+    v2 = ((int64_t)P8 * p) >> 19;
+    return (uint32_t)(((p + v1 + v2) >> 8) + ((int64_t)P7 << 4));
+  }
+
+  // %RH in Q22.10
+  uint32_t comp_h(int32_t adc) {
+    int32_t v = tFine_ - 76800;
+    v = (((((adc << 14) - ((int32_t)H4 << 20) - ((int32_t)H5 * v)) + 16384) >> 15)
+         * (((((((v * H6) >> 10) * (((v * (int32_t)H3) >> 11) + 32768)) >> 10) + 2097152) * H2 + 8192) >> 14));
+    v -= (((((v >> 15) * (v >> 15)) >> 7) * (int32_t)H1) >> 4);
+    if (v < 0) v = 0;
+    if (v > 419430400) v = 419430400;
+    return (uint32_t)(v >> 12);
+  }
+
+  I2cBus& bus_;
+  uint8_t addr_;
+  int32_t tFine_ = 0;
+  uint16_t T1 = 0, P1 = 0;
+  int16_t  T2 = 0, T3 = 0, P2 = 0, P3 = 0, P4 = 0, P5 = 0, P6 = 0, P7 = 0, P8 = 0, P9 = 0;
+  uint8_t  H1 = 0, H3 = 0;
+  int16_t  H2 = 0, H4 = 0, H5 = 0;
+  int8_t   H6 = 0;
+};
+
+
+// First sensor that answers, nullptr if none. Static instances: call once.
+static inline EnvSensor* sensor_detect(I2cBus& bus) {
+  static Bme280 bme76(bus, 0x76), bme77(bus, 0x77);
+  static Sht4x  sht4(bus, 0x44);
+  static Sht3x  sht3a(bus, 0x44), sht3b(bus, 0x45);
+  EnvSensor* order[] = { &bme76, &bme77, &sht4, &sht3a, &sht3b };   // SHT3x NACKs the SHT4x probe
+  for (EnvSensor* s : order) {
+    if (s->begin()) return s;
+  }
+  return nullptr;
+}
+
+
+#ifndef ARDUINO
+// ---------- Host-side mock bus ----------
+// SHT-style command devices answer with configured values (valid CRC) once
+// the conversion time has passed and NACK the read before that; register
+// devices expose a 256-byte register file, a BME280 in forced mode latches
+// the staged ADC values after its conversion time. Time only moves with
+// advance_ms() / delay_ms(). Faults: nack_next(), bad_crc_next().
+class MockI2cBus : public I2cBus {
+public:
+  void add_sht(uint8_t addr, bool sht4x, float tempC, float humid) {
+    Dev& d = add(addr, sht4x ? SHT4 : SHT3);
+    d.tempC = tempC;
+    d.humid = humid;
+  }
+
+  uint8_t* add_regs(uint8_t addr) { return add(addr, REGS).regs; }
+
+  // chip id and reset values of the data registers; calibration is the caller's
+  uint8_t* add_bme280(uint8_t addr) {
+    Dev& d = add(addr, BME);
+    d.regs[0xD0] = 0x60;
+    d.regs[0xF7] = 0x80;                                 // press 0x80000
+    d.regs[0xFA] = 0x80;                                 // temp  0x80000
+    d.regs[0xFD] = 0x80;                                 // hum   0x8000
+    return d.regs;
+  }
+
+  // raw values the next forced conversion produces
+  void set_bme_adc(uint8_t addr, int32_t adcP, int32_t adcT, int32_t adcH) {
+    Dev* d = find(addr);
+    if (!d) return;
+    d->adc[0] = (uint8_t)(adcP >> 12); d->adc[1] = (uint8_t)(adcP >> 4); d->adc[2] = (uint8_t)(adcP << 4);
+    d->adc[3] = (uint8_t)(adcT >> 12); d->adc[4] = (uint8_t)(adcT >> 4); d->adc[5] = (uint8_t)(adcT << 4);
+    d->adc[6] = (uint8_t)(adcH >> 8);  d->adc[7] = (uint8_t)adcH;
+  }
+
+  void nack_next(uint8_t addr)    { if (Dev* d = find(addr)) d->nack++; }       // next transfer
+  void bad_crc_next(uint8_t addr) { if (Dev* d = find(addr)) d->badCrc = true; } // next SHT frame
+
+  void advance_ms(uint32_t ms) { nowUs_ += (uint64_t)ms * 1000; }
+
+  bool write(uint8_t addr, const uint8_t* data, size_t len) override {
+    writes++;
+    Dev* d = find(addr);
+    if (!d || len == 0 || fault(*d)) return false;
+    if (d->kind == REGS || d->kind == BME) {
+      latch(*d);
+      d->ptr = data[0];
+      for (size_t i = 1; i < len; i++) d->regs[(uint8_t)(d->ptr + i - 1)] = data[i];
+      if (d->kind == BME && len > 1 && d->ptr == 0xF4 && (data[1] & 3)) {
+        d->readyUs = nowUs_ + 9300;                      // forced: 9.3 ms max at x1/x1/x1
+        d->regs[0xF3] |= 0x08;                           // status: measuring
+      }
+      return true;
+    }
+    const uint16_t cmd = (d->kind == SHT4) ? data[0] : (uint16_t)((data[0] << 8) | (len > 1 ? data[1] : 0));
+    if (cmd == 0x89 || cmd == 0x3780) return frame(*d, 0x1234, 0x5678, 0);
+    if (cmd == 0xFD && d->kind == SHT4) {
+      return frame(*d, raw((d->tempC + 45.0f) / 175.0f), raw((d->humid + 6.0f) / 125.0f), 8300);
+    }
+    if (cmd == 0x2400 && d->kind == SHT3) {
+      return frame(*d, raw((d->tempC + 45.0f) / 175.0f), raw(d->humid / 100.0f), 15500);
+    }
+    return false;                                      // unknown command: NACK
+  }
+
+  bool read(uint8_t addr, uint8_t* data, size_t len) override {
+    reads++;
+    Dev* d = find(addr);
+    if (!d || fault(*d)) return false;
+    if (d->kind == REGS || d->kind == BME) {
+      latch(*d);
+      for (size_t i = 0; i < len; i++) data[i] = d->regs[d->ptr++];
+      return true;
+    }
+    // still converting (no clock stretching) or nothing to read: NACK
+    if (d->pending == 0 || len > d->pending || nowUs_ < d->readyUs) return false;
+    memcpy(data, d->out, len);
+    d->pending = 0;
+    return true;
+  }
+
+  void delay_ms(uint32_t ms) override {
+    sleptMs += ms;
+    advance_ms(ms);
+  }
+
+  size_t   writes = 0;
+  size_t   reads = 0;
+  uint32_t sleptMs = 0;
+
+private:
+  enum Kind : uint8_t { SHT3, SHT4, REGS, BME };
+
+  struct Dev {
+    uint8_t  addr;
+    Kind     kind;
+    float    tempC, humid;
+    uint8_t  regs[256];
+    uint8_t  ptr;
+    uint8_t  adc[8];                                   // BME: next conversion, 0xF7..0xFE
+    uint8_t  out[6];
+    uint8_t  pending;
+    uint64_t readyUs;
+    uint8_t  nack;
+    bool     badCrc;
+  };
+
+  Dev& add(uint8_t addr, Kind kind) {
+    Dev& d = devs_[n_ < 4 ? n_++ : 3];
+    memset(&d, 0, sizeof(d));
+    d.addr = addr;
+    d.kind = kind;
+    return d;
+  }
+
+  Dev* find(uint8_t addr) {
+    for (uint8_t i = 0; i < n_; i++) if (devs_[i].addr == addr) return &devs_[i];
+    return nullptr;
+  }
+
+  static bool fault(Dev& d) {
+    if (!d.nack) return false;
+    d.nack--;
+    return true;
+  }
+
+  // BME280: conversion done -> data registers, back to sleep mode
+  void latch(Dev& d) {
+    if (d.kind != BME || !d.readyUs || nowUs_ < d.readyUs) return;
+    memcpy(d.regs + 0xF7, d.adc, sizeof(d.adc));
+    d.regs[0xF4] &= (uint8_t)~3;
+    d.regs[0xF3] &= (uint8_t)~0x08;
+    d.readyUs = 0;
+  }
+
+  static uint16_t raw(float f) {
+    if (f < 0.0f) f = 0.0f;
+    if (f > 1.0f) f = 1.0f;
+    return (uint16_t)(f * 65535.0f + 0.5f);
+  }
+
+  bool frame(Dev& d, uint16_t w0, uint16_t w1, uint32_t convUs) {
+    d.out[0] = w0 >> 8; d.out[1] = (uint8_t)w0; d.out[2] = sht_crc(d.out, 2);
+    d.out[3] = w1 >> 8; d.out[4] = (uint8_t)w1; d.out[5] = sht_crc(d.out + 3, 2);
+    if (d.badCrc) { d.out[5] ^= 0x01; d.badCrc = false; }
+    d.pending = 6;
+    d.readyUs = nowUs_ + convUs;
+    return true;
+  }
+
+  Dev      devs_[4];
+  uint8_t  n_ = 0;
+  uint64_t nowUs_ = 0;
+};
+#endif
+
+} // namespace h2h
@@ -0,0 +1,55 @@
+// ============================================================
+// h2h_seqlock.h  —  versioned single-writer state block (seqlock)
+// - writer never waits: write() is two counter bumps + one copy
+// - readers take consistent snapshots and retry on a torn read
+// - version() lets a reader skip work when nothing changed
+// - T must be trivially copyable (plain values, no pointers owned)
+// ============================================================
+
+#pragma once
+
+#include <stdint.h>
+#include <string.h>
+#include <atomic>
+#include <type_traits>
+
+
+namespace h2h {
+
+template <typename T>
+class SeqLock {
+  static_assert(std::is_trivially_copyable<T>::value, "SeqLock<T> needs a trivially copyable T");
+
+public:
+  SeqLock() { memset(&data_, 0, sizeof(data_)); }
+
+  // single writer only
+  void write(const T& v) {
+    const uint32_t s = seq_.load(std::memory_order_relaxed);
+    seq_.store(s + 1, std::memory_order_relaxed);          // odd: write in progress
+    std::atomic_thread_fence(std::memory_order_release);
+    memcpy(&data_, &v, sizeof(T));
+    std::atomic_thread_fence(std::memory_order_release);
+    seq_.store(s + 2, std::memory_order_release);          // even: stable
+  }
+
+  // any number of readers; returns the version of the snapshot
+  uint32_t read(T& out) const {
+    for (;;) {
+      const uint32_t s1 = seq_.load(std::memory_order_acquire);
+      if (s1 & 1) continue;                                // writer active
+      memcpy(&out, &data_, sizeof(T));
+      std::atomic_thread_fence(std::memory_order_acquire);
+      if (seq_.load(std::memory_order_relaxed) == s1) return s1 >> 1;
+    }
+  }
+
+  // increments once per completed write()
+  uint32_t version() const { return seq_.load(std::memory_order_acquire) >> 1; }
+
+private:
+  std::atomic<uint32_t> seq_{0};
+  T data_;
+};
+
+} // namespace h2h
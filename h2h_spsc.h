@@ -0,0 +1,57 @@
+// ============================================================
+// h2h_spsc.h  —  lock-free single-producer/single-consumer ring
+// - exactly one task pushes, exactly one task pops
+// - no locks, no allocation; N must be a power of two
+// - T is copied in and out (use small, immutable descriptions)
+// ============================================================
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <atomic>
+
+
+namespace h2h {
+
+template <typename T, size_t N>
+class SpscQueue {
+  static_assert(N >= 2 && (N & (N - 1)) == 0, "SpscQueue size must be a power of two");
+
+public:
+  // producer side; false = full (item not queued)
+  bool push(const T& item) {
+    const uint32_t h = head_.load(std::memory_order_relaxed);
+    if (h - tail_.load(std::memory_order_acquire) == N) return false;
+    buf_[h & (N - 1)] = item;
+    head_.store(h + 1, std::memory_order_release);
+    return true;
+  }
+
+  // consumer side; false = empty
+  bool pop(T& out) {
+    const uint32_t t = tail_.load(std::memory_order_relaxed);
+    if (head_.load(std::memory_order_acquire) == t) return false;
+    out = buf_[t & (N - 1)];
+    tail_.store(t + 1, std::memory_order_release);
+    return true;
+  }
+
+  // consumer side; drains everything, keeps only the newest item
+  bool pop_latest(T& out) {
+    bool any = false;
+    while (pop(out)) any = true;
+    return any;
+  }
+
+  size_t size() const {
+    return head_.load(std::memory_order_acquire) - tail_.load(std::memory_order_acquire);
+  }
+
+private:
+  T buf_[N];
+  std::atomic<uint32_t> head_{0};   // written by producer only
+  std::atomic<uint32_t> tail_{0};   // written by consumer only
+};
+
+} // namespace h2h
@@ -0,0 +1,212 @@
+// ============================================================
+// h2h_stall.h  —  loop-stall detector with trace-scope attribution
+// - one StallMonitor per task loop; StallScope around the work of one
+//   iteration (the sleep until the next deadline stays outside)
+// - iteration longer than the monitor's threshold = stall:
+//   stall_total, stall_ms, stall_max_ms + a table per monitor
+//   (scope -> stalls, total ms, worst ms)
+// - attribution: an esp_timer samples every H2H_STALL_SAMPLE_MS which
+//   H2H_TRACE_SCOPE the monitored task is in (h2h_trace.h keeps the
+//   innermost one per task, also with tracing off); the scope open when
+//   the threshold passed gets the stall, so a blocked delay() or HTTP
+//   timeout is named by the scope around it
+// - report: serial 's', Prometheus lines with loop/scope labels,
+//   stall_for_each_site() for MQTT
+//
+// Include from the sketch itself (one translation unit).
+// ============================================================
+
+#pragma once
+
+#include <Arduino.h>
+#include <atomic>
+#include "esp_timer.h"
+#include "h2h_metrics.h"
+#include "h2h_trace.h"
+
+#ifndef H2H_STALL_SITES
+  #define H2H_STALL_SITES 8          // scopes per monitor, the last one collects the rest
+#endif
+
+#ifndef H2H_STALL_SAMPLE_MS
+  #define H2H_STALL_SAMPLE_MS 5
+#endif
+
+
+namespace h2h {
+
+static Counter   stallTotal ("stall_total",  "Loop iterations longer than their stall threshold");
+static Histogram stallMs    ("stall_ms",     "Duration of stalled loop iterations (ms)", BUCKETS_MS);
+static Gauge     stallMaxMs ("stall_max_ms", "Longest loop iteration since boot (ms)");
+
+struct StallSite {
+  const char* scope = nullptr;
+  std::atomic<uint32_t> count{0};
+  std::atomic<uint32_t> totalMs{0};
+  std::atomic<uint32_t> maxMs{0};
+};
+
+struct StallMonitor;
+
+// list head; only written during static init, read-only afterwards
+inline StallMonitor*& stall_monitors_head() {
+  static StallMonitor* head = nullptr;
+  return head;
+}
+
+inline bool stall_start();
+
+struct StallMonitor {
+  const char*   name;
+  uint32_t      thresholdUs;
+  StallMonitor* next;
+  TraceCurrent  cur;                          // innermost scope of the task
+  std::atomic<bool>        busy{false};
+  std::atomic<uint32_t>    startUs{0};
+  std::atomic<const char*> caught{nullptr};   // open when the threshold passed
+  std::atomic<const char*> seen{nullptr};     // last sample of this iteration
+  uint32_t iterations = 0;
+  uint32_t maxUs = 0;
+  StallSite sites[H2H_STALL_SITES];
+
+  StallMonitor(const char* n, uint32_t thresholdMs)
+    : name(n), thresholdUs(thresholdMs * 1000), next(stall_monitors_head()) {
+    stall_monitors_head() = this;
+  }
+
+  // From the monitored task, before its loop
+  void attach() {
+    trace_track_current(&cur);
+    stall_start();
+  }
+
+  void begin() {
+    caught.store(nullptr, std::memory_order_relaxed);
+    seen.store(nullptr, std::memory_order_relaxed);
+    startUs.store(micros(), std::memory_order_relaxed);
+    busy.store(true, std::memory_order_release);
+  }
+
+  void end() {
+    busy.store(false, std::memory_order_release);
+    const uint32_t us = micros() - startUs.load(std::memory_order_relaxed);
+    iterations++;
+    if (us > maxUs) maxUs = us;
+    const uint32_t ms = us / 1000;
+    if ((int32_t)ms > stallMaxMs.get()) stallMaxMs.set((int32_t)ms);
+    if (us < thresholdUs) return;
+
+    stallTotal.inc();
+    stallMs.observe(ms);
+    // stall shorter than one sample past the threshold: last scope seen
+    const char* scope = caught.load(std::memory_order_relaxed);
+    if (!scope) scope = seen.load(std::memory_order_relaxed);
+    StallSite& s = site(scope ? scope : "(none)");
+    s.count.fetch_add(1, std::memory_order_relaxed);
+    s.totalMs.fetch_add(ms, std::memory_order_relaxed);
+    if (ms > s.maxMs.load(std::memory_order_relaxed)) s.maxMs.store(ms, std::memory_order_relaxed);
+  }
+
+  StallSite& site(const char* scope) {
+    for (int i = 0; i < H2H_STALL_SITES - 1; i++) {
+      if (sites[i].scope == scope) return sites[i];     // literals: pointer compare
+      if (!sites[i].scope) {
+        sites[i].scope = scope;
+        return sites[i];
+      }
+    }
+    StallSite& rest = sites[H2H_STALL_SITES - 1];
+    rest.scope = "(other)";
+    return rest;
+  }
+};
+
+// Measures the enclosing scope as one loop iteration
+struct StallScope {
+  StallMonitor& m;
+  explicit StallScope(StallMonitor& mon) : m(mon) { m.begin(); }
+  ~StallScope() { m.end(); }
+};
+
+// esp_timer task: look at every monitored loop that is inside an iteration
+inline void stall_sample(void*) {
+  const uint32_t now = micros();
+  for (StallMonitor* m = stall_monitors_head(); m; m = m->next) {
+    if (!m->busy.load(std::memory_order_acquire)) continue;
+    const char* s = m->cur.name.load(std::memory_order_relaxed);
+    if (!s) s = "(none)";
+    m->seen.store(s, std::memory_order_relaxed);
+    if (now - m->startUs.load(std::memory_order_relaxed) >= m->thresholdUs &&
+        !m->caught.load(std::memory_order_relaxed)) {
+      m->caught.store(s, std::memory_order_relaxed);
+    }
+  }
+}
+
+inline bool stall_start() {
+  static esp_timer_handle_t timer = nullptr;
+  if (timer) return true;
+  esp_timer_create_args_t args = {};
+  args.callback = stall_sample;
+  args.name     = "h2h_stall";
+  if (esp_timer_create(&args, &timer) != ESP_OK) {
+    timer = nullptr;
+    return false;
+  }
+  return esp_timer_start_periodic(timer, H2H_STALL_SAMPLE_MS * 1000) == ESP_OK;
+}
+
+
+// ============================================================
+//  REPORTS
+// ============================================================
+
+inline void stall_report(Print& out) {
+  out.print("loop        thresh_ms  iterations   max_ms\n");
+  for (const StallMonitor* m = stall_monitors_head(); m; m = m->next) {
+    out.printf("%-10s %10lu %11lu %8lu\n", m->name, (unsigned long)(m->thresholdUs / 1000),
+               (unsigned long)m->iterations, (unsigned long)(m->maxUs / 1000));
+  }
+  out.print("\nloop       scope                     stalls  total_ms  worst_ms\n");
+  for (const StallMonitor* m = stall_monitors_head(); m; m = m->next) {
+    for (const StallSite& s : m->sites) {
+      if (!s.scope) continue;
+      out.printf("%-10s %-24s %7lu %9lu %9lu\n", m->name, s.scope, (unsigned long)s.count.load(),
+                 (unsigned long)s.totalMs.load(), (unsigned long)s.maxMs.load());
+    }
+  }
+}
+
+// Per-scope lines for /metrics (labels, so they cannot live in the registry)
+inline void stall_write_prometheus(Print& out) {
+  out.print("# TYPE h2h_stall_site_total counter\n"
+            "# TYPE h2h_stall_site_ms_total counter\n"
+            "# TYPE h2h_stall_site_max_ms gauge\n");
+  for (const StallMonitor* m = stall_monitors_head(); m; m = m->next) {
+    for (const StallSite& s : m->sites) {
+      if (!s.scope) continue;
+      out.printf("h2h_stall_site_total{loop=\"%s\",scope=\"%s\"} %lu\n", m->name, s.scope, (unsigned long)s.count.load());
+      out.printf("h2h_stall_site_ms_total{loop=\"%s\",scope=\"%s\"} %lu\n", m->name, s.scope, (unsigned long)s.totalMs.load());
+      out.printf("h2h_stall_site_max_ms{loop=\"%s\",scope=\"%s\"} %lu\n", m->name, s.scope, (unsigned long)s.maxMs.load());
+    }
+  }
+}
+
+// fn(const char* loop, const char* scope, const StallSite& site), used sites only
+template <typename Fn>
+inline void stall_for_each_site(Fn fn) {
+  for (const StallMonitor* m = stall_monitors_head(); m; m = m->next) {
+    for (const StallSite& s : m->sites) {
+      if (s.scope) fn(m->name, s.scope, s);
+    }
+  }
+}
+
+// Serial command 's' = stall report; returns false for other characters
+inline bool stall_serial_cmd(int c) {
+  if (c != 's') return false;
+  stall_report(Serial);
+  return true;
+}
+
+} // namespace h2h
@@ -0,0 +1,193 @@
+// ============================================================
+// h2h_timer.h  —  hierarchical timer wheel (header-only)
+// - intrusive nodes: no allocation, O(1) schedule / cancel
+// - LEVELS x 64 slots; level L holds timers due in < 64^(L+1) ticks
+//   and cascades them down when its slot comes up (Linux style)
+// - advance(now) jumps over empty ticks; work is per timer, not per tick
+// - next_ms(now): how long the caller may sleep
+// - tick counter and millis() wraparound safe (only differences are used)
+// - single task only (no locking)
+// ============================================================
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+
+namespace h2h {
+
+struct TimerLink {
+  TimerLink* prev = nullptr;     // nullptr = not armed
+  TimerLink* next = nullptr;
+};
+
+struct TimerNode : TimerLink {
+  void     (*fn)(TimerNode&) = nullptr;   // called on expiry
+  uint32_t periodMs = 0;         // != 0: re-armed before fn runs (no drift)
+  uint32_t expires = 0;          // absolute tick (wheel internal)
+  uint32_t id = 0;               // free for the owner (index, enum, ...)
+
+  bool armed() const { return prev != nullptr; }
+};
+
+// 3 levels = 2^18 ticks span (43 min at 10 ms), 64 * 3 list heads
+template <uint8_t LEVELS = 3>
+class TimerWheel {
+  static_assert(LEVELS >= 1 && LEVELS <= 5, "TimerWheel: 1..5 levels");
+
+public:
+  static const uint32_t SPAN_TICKS = (1UL << (6 * LEVELS)) - 1;   // longer delays are clamped
+
+  explicit TimerWheel(uint32_t tickMs) : tickMs_(tickMs ? tickMs : 1) {
+    for (auto& lvl : slots_)
+      for (auto& s : lvl) s.prev = s.next = &s;
+  }
+
+  uint32_t tick_ms() const { return tickMs_; }
+
+  void start(uint32_t nowMs) { lastTickMs_ = nowMs; }
+
+  // (re)arm n to fire delayMs from the current tick (at least one tick)
+  void schedule(TimerNode& n, uint32_t delayMs) {
+    cancel(n);
+    n.expires = now_ + to_ticks(delayMs);
+    add(n);
+  }
+
+  // periodic: first expiry after firstMs, then every periodMs
+  void every(TimerNode& n, uint32_t periodMs, uint32_t firstMs) {
+    n.periodMs = periodMs;
+    schedule(n, firstMs);
+  }
+
+  void cancel(TimerNode& n) {
+    if (!n.armed()) return;
+    unlink(n);
+  }
+
+  // fire everything due up to nowMs; returns the number of expiries
+  size_t advance(uint32_t nowMs) {
+    uint32_t due = (nowMs - lastTickMs_) / tickMs_;
+    lastTickMs_ += due * tickMs_;
+
+    size_t fired = 0;
+    while (due > 0) {
+      const uint32_t k = next_ticks();
+      if (k > due) { now_ += due; break; }
+      now_ += k - 1;               // skip empty ticks
+      due  -= k;
+      fired += tick();
+    }
+    return fired;
+  }
+
+  // ms until the next expiry (or cascade), UINT32_MAX if nothing is armed.
+  // Never late, may be early: waking up and calling advance() is always safe.
+  uint32_t next_ms(uint32_t nowMs) const {
+    const uint32_t k = next_ticks();
+    if (k == UINT32_MAX) return UINT32_MAX;
+    const uint64_t at = (uint64_t)k * tickMs_;
+    const uint32_t since = nowMs - lastTickMs_;
+    return at > since ? (uint32_t)(at - since) : 0;
+  }
+
+  bool empty() const {
+    for (uint8_t l = 0; l < LEVELS; l++) if (used_[l]) return false;
+    return true;
+  }
+
+private:
+  uint32_t to_ticks(uint32_t ms) const {
+    uint32_t t = ms / tickMs_ + ((ms % tickMs_) ? 1 : 0);
+    return t == 0 ? 1 : t;
+  }
+
+  void add(TimerNode& n) {
+    uint32_t delta = n.expires - now_;           // 0 only when cascading: fires this tick
+    if ((int32_t)delta < 0)   { delta = 1; n.expires = now_ + 1; }
+    if (delta > SPAN_TICKS)               { delta = SPAN_TICKS; n.expires = now_ + delta; }
+
+    uint8_t l = 0;
+    while (l + 1 < LEVELS && delta >= (1UL << (6 * (l + 1)))) l++;
+    const uint8_t idx = (n.expires >> (6 * l)) & 63;
+
+    TimerLink& head = slots_[l][idx];
+    n.prev = head.prev;
+    n.next = &head;
+    head.prev->next = &n;
+    head.prev = &n;
+    used_[l] |= 1ULL << idx;
+  }
+
+  void unlink(TimerNode& n) {
+    n.prev->next = n.next;
+    n.next->prev = n.prev;
+    // the neighbours tell whether the slot became empty
+    if (n.next == n.prev && is_head(n.next)) clear_used(n.next);
+    n.prev = n.next = nullptr;
+  }
+
+  bool is_head(const TimerLink* p) const {
+    const TimerLink* first = &slots_[0][0];
+    return p >= first && p < first + LEVELS * 64;
+  }
+
+  void clear_used(const TimerLink* head) {
+    const size_t i = head - &slots_[0][0];
+    used_[i / 64] &= ~(1ULL << (i % 64));
+  }
+
+  // one tick: cascade higher levels at their slot boundaries, then fire level 0
+  size_t tick() {
+    now_++;
+    for (uint8_t l = LEVELS - 1; l >= 1; l--) {
+      if (now_ & ((1UL << (6 * l)) - 1)) continue;        // not a level-l boundary
+      TimerLink& head = slots_[l][(now_ >> (6 * l)) & 63];
+      while (head.next != &head) {
+        TimerNode& n = *static_cast<TimerNode*>(head.next);
+        unlink(n);
+        add(n);
+      }
+    }
+
+    size_t fired = 0;
+    TimerLink& head = slots_[0][now_ & 63];
+    while (head.next != &head) {                           // nothing new lands in this slot
+      TimerNode& n = *static_cast<TimerNode*>(head.next);
+      unlink(n);
+      if (n.periodMs) {
+        n.expires += to_ticks(n.periodMs);
+        add(n);                                            // behind schedule: next tick
+      }
+      fired++;
+      if (n.fn) n.fn(n);
+    }
+    return fired;
+  }
+
+  // ticks from now_ to the next non-empty level-0 slot or cascade
+  uint32_t next_ticks() const {
+    uint32_t best = UINT32_MAX;
+    for (uint8_t l = 0; l < LEVELS; l++) {
+      const uint64_t m = used_[l];
+      if (!m) continue;
+      const uint8_t  shift = 6 * l;
+      const uint32_t cur   = (now_ >> shift) & 63;
+      const uint8_t  r     = (cur + 1) & 63;
+      const uint64_t rot   = r ? ((m >> r) | (m << (64 - r))) : m;
+      const uint32_t k     = __builtin_ctzll(rot) + 1;     // 1..64 slots ahead
+      const uint32_t at    = (((now_ >> shift) + k) << shift) - now_;
+      if (at < best) best = at;
+    }
+    return best;
+  }
+
+  TimerLink slots_[LEVELS][64];  // list heads
+  uint64_t  used_[LEVELS] = {};  // non-empty slots per level
+  uint32_t  tickMs_;
+  uint32_t  lastTickMs_ = 0;
+  uint32_t  now_ = 0;            // current tick
+};
+
+} // namespace h2h
@@ -0,0 +1,403 @@
+// ============================================================
+// h2h_tls.h  —  TLS transport for MqttClient (mbedTLS, port 8883)
+// - drop-in Net for h2h::MqttClient<TlsClient>: connect / write /
+//   available / read / connected / stop / fd, like WiFiClient
+// - cipher suites chosen for the ESP32 crypto units: ECDHE on P-256
+//   (bignum/MPI unit), AES-128-GCM (AES unit), SHA-256 (SHA unit);
+//   ECDSA server certificate preferred, RSA only as a fallback
+// - session resumption: the session (ticket or session ID) of the last
+//   handshake is offered on the next connect; a resumed handshake has
+//   no certificate chain and no ECDHE/ECDSA math, one round trip less
+// - the handshake blocks (with a timeout) in the caller's task, the
+//   socket is non-blocking afterwards
+// - counters: full/resumed handshakes, handshake time, heap held by a
+//   connection, bytes on the wire vs. plaintext (record overhead)
+// - tls_bench(): TCP connect vs. full vs. resumed handshake, heap,
+//   against the real broker
+// ============================================================
+
+#pragma once
+
+#include <Arduino.h>
+#include <lwip/sockets.h>
+#include <lwip/netdb.h>
+#include <fcntl.h>
+#include <errno.h>
+#include "esp_heap_caps.h"
+
+#include <mbedtls/version.h>
+#include <mbedtls/ssl.h>
+#include <mbedtls/ctr_drbg.h>
+#include <mbedtls/entropy.h>
+#include <mbedtls/x509_crt.h>
+#include <mbedtls/platform_util.h>
+
+#if MBEDTLS_VERSION_NUMBER >= 0x03000000
+  #define H2H_TLS_P(x) MBEDTLS_PRIVATE(x)
+#else
+  #define H2H_TLS_P(x) x
+#endif
+
+
+namespace h2h {
+
+static const int TLS_SUITES[] = {
+  MBEDTLS_TLS_ECDHE_ECDSA_WITH_AES_128_GCM_SHA256,   // ECDSA P-256 cert: cheapest verify
+  MBEDTLS_TLS_ECDHE_RSA_WITH_AES_128_GCM_SHA256,     // brokers with RSA certs
+  0
+};
+
+class TlsClient {
+public:
+  TlsClient() {
+    mbedtls_ssl_init(&ssl_);
+    mbedtls_ssl_config_init(&conf_);
+    mbedtls_x509_crt_init(&ca_);
+    mbedtls_ctr_drbg_init(&drbg_);
+    mbedtls_entropy_init(&entropy_);
+    mbedtls_ssl_session_init(&session_);
+  }
+
+  ~TlsClient() {
+    stop();
+    mbedtls_ssl_session_free(&session_);
+    mbedtls_ssl_free(&ssl_);
+    mbedtls_ssl_config_free(&conf_);
+    mbedtls_x509_crt_free(&ca_);
+    mbedtls_ctr_drbg_free(&drbg_);
+    mbedtls_entropy_free(&entropy_);
+  }
+
+  // broker CA (PEM); read on the first connect. nullptr = no verification (tests only)
+  void set_ca(const char* pem) { caPem_ = pem; }
+  // SNI + certificate name; needed when connect() gets an IP address (DNS cache)
+  void set_server_name(const char* name) { serverName_ = name; }
+  void set_timeout(uint32_t ms) { timeoutMs_ = ms; }
+  // next connect does a full handshake
+  void forget_session() {
+    mbedtls_ssl_session_free(&session_);
+    mbedtls_ssl_session_init(&session_);
+    haveSession_ = false;
+  }
+
+  int connect(const char* host, uint16_t port) {
+    stop();
+    if (!setup()) return 0;
+
+    const uint32_t t0 = millis();
+    if (!tcp_connect(host, port, t0)) return 0;
+    const uint32_t t1 = millis();
+    tcpMs_ = t1 - t0;
+
+    const size_t heap0 = heap_caps_get_free_size(MALLOC_CAP_8BIT);
+    heapMin_ = heap0;
+    mbedtls_ssl_session_reset(&ssl_);
+    mbedtls_ssl_set_hostname(&ssl_, serverName_ ? serverName_ : host);
+    mbedtls_ssl_set_bio(&ssl_, this, bio_send, bio_recv, nullptr);
+
+    // resumed = same master secret as the offered session
+    uint8_t offered[48];
+    const bool offer = haveSession_;
+    if (offer) {
+      memcpy(offered, session_.H2H_TLS_P(master), sizeof(offered));
+      mbedtls_ssl_set_session(&ssl_, &session_);
+    }
+
+    for (;;) {
+      const int r = mbedtls_ssl_handshake(&ssl_);
+      if (r == 0) break;
+      const bool again = r == MBEDTLS_ERR_SSL_WANT_READ || r == MBEDTLS_ERR_SSL_WANT_WRITE;
+      if (!again || !wait(r == MBEDTLS_ERR_SSL_WANT_WRITE, t1)) {
+        lastError_ = r;
+        failed_++;
+        if (offer) forget_session();      // server may have dropped it; next time full
+        mbedtls_platform_zeroize(offered, sizeof(offered));
+        stop();
+        return 0;
+      }
+    }
+    handshakeMs_ = millis() - t1;
+    heapPeak_ = heap0 - heapMin_;
+    heapHeld_ = heap0 - heap_caps_get_free_size(MALLOC_CAP_8BIT);
+
+    forget_session();
+    haveSession_ = mbedtls_ssl_get_session(&ssl_, &session_) == 0;
+    lastResumed_ = offer && haveSession_ &&
+                   memcmp(offered, session_.H2H_TLS_P(master), sizeof(offered)) == 0;
+    mbedtls_platform_zeroize(offered, sizeof(offered));
+    if (lastResumed_) resumed_++;
+    else              full_++;
+
+    open_ = true;
+    return 1;
+  }
+
+  size_t write(const uint8_t* p, size_t n) {
+    if (!open_) return 0;
+    const uint32_t t0 = millis();
+    const uint32_t c0 = micros();
+    size_t off = 0;
+    while (off < n) {
+      const int r = mbedtls_ssl_write(&ssl_, p + off, n - off);
+      if (r > 0) { off += (size_t)r; continue; }
+      if ((r != MBEDTLS_ERR_SSL_WANT_WRITE && r != MBEDTLS_ERR_SSL_WANT_READ) ||
+          !wait(r == MBEDTLS_ERR_SSL_WANT_WRITE, t0)) {
+        lastError_ = r;
+        closed_ = true;
+        break;
+      }
+    }
+    plainTx_ += off;
+    writes_++;
+    writeUs_ += micros() - c0;
+    return off;
+  }
+
+  int available() {
+    if (!open_) return 0;
+    if (rxPos_ == rxLen_) fill();
+    return (int)(rxLen_ - rxPos_ + mbedtls_ssl_get_bytes_avail(&ssl_));
+  }
+
+  int read(uint8_t* p, size_t n) {
+    if (!open_) return -1;
+    if (rxPos_ == rxLen_) fill();
+    size_t got = 0;
+    if (rxPos_ < rxLen_) {
+      got = rxLen_ - rxPos_;
+      if (got > n) got = n;
+      memcpy(p, rxBuf_ + rxPos_, got);
+      rxPos_ += got;
+    }
+    // rest of a decrypted record straight into the caller's buffer
+    if (got < n && mbedtls_ssl_get_bytes_avail(&ssl_) > 0) {
+      const int r = mbedtls_ssl_read(&ssl_, p + got, n - got);
+      if (r > 0) got += (size_t)r;
+    }
+    return (int)got;
+  }
+
+  uint8_t connected() {
+    if (!open_) return 0;
+    return (rxPos_ < rxLen_ || !closed_) ? 1 : 0;
+  }
+
+  void stop() {
+    if (open_ && !closed_) mbedtls_ssl_close_notify(&ssl_);   // best effort, non-blocking
+    if (fd_ >= 0) ::close(fd_);
+    fd_ = -1;
+    open_ = false;
+    closed_ = false;
+    rxPos_ = rxLen_ = 0;
+  }
+
+  int fd() const { return fd_; }
+
+  // ---------- counters ----------
+  uint32_t handshakes_full()    const { return full_; }
+  uint32_t handshakes_resumed() const { return resumed_; }
+  uint32_t handshakes_failed()  const { return failed_; }
+  bool     last_resumed()       const { return lastResumed_; }
+  uint32_t last_tcp_ms()        const { return tcpMs_; }
+  uint32_t last_handshake_ms()  const { return handshakeMs_; }
+  uint32_t heap_held()          const { return heapHeld_; }   // by the open connection
+  uint32_t heap_peak()          const { return heapPeak_; }   // during the handshake (sampled at I/O)
+  uint32_t wire_tx_bytes()      const { return wireTx_; }     // TLS records incl. handshakes
+  uint32_t wire_rx_bytes()      const { return wireRx_; }
+  uint32_t plain_tx_bytes()     const { return plainTx_; }
+  uint32_t writes()             const { return writes_; }
+  uint32_t write_us()           const { return writeUs_; }    // encrypt + send, all writes
+  int      last_error()         const { return lastError_; }  // mbedTLS error code
+
+private:
+  bool setup() {
+    if (ready_) return true;
+    static const char pers[] = "h2h_tls";
+    if (mbedtls_ctr_drbg_seed(&drbg_, mbedtls_entropy_func, &entropy_,
+                              (const unsigned char*)pers, sizeof(pers) - 1) != 0) return false;
+    if (mbedtls_ssl_config_defaults(&conf_, MBEDTLS_SSL_IS_CLIENT, MBEDTLS_SSL_TRANSPORT_STREAM,
+                                    MBEDTLS_SSL_PRESET_DEFAULT) != 0) return false;
+    if (caPem_) {
+      if (mbedtls_x509_crt_parse(&ca_, (const unsigned char*)caPem_, strlen(caPem_) + 1) != 0) return false;
+      mbedtls_ssl_conf_ca_chain(&conf_, &ca_, nullptr);
+      mbedtls_ssl_conf_authmode(&conf_, MBEDTLS_SSL_VERIFY_REQUIRED);
+    } else {
+      mbedtls_ssl_conf_authmode(&conf_, MBEDTLS_SSL_VERIFY_NONE);
+    }
+    mbedtls_ssl_conf_rng(&conf_, mbedtls_ctr_drbg_random, &drbg_);
+    mbedtls_ssl_conf_ciphersuites(&conf_, TLS_SUITES);
+#if MBEDTLS_VERSION_NUMBER >= 0x03000000
+    static const uint16_t groups[] = { MBEDTLS_SSL_IANA_TLS_GROUP_SECP256R1, MBEDTLS_SSL_IANA_TLS_GROUP_NONE };
+    mbedtls_ssl_conf_groups(&conf_, groups);
+    mbedtls_ssl_conf_max_tls_version(&conf_, MBEDTLS_SSL_VERSION_TLS1_2);   // resumption as below
+#else
+    static const mbedtls_ecp_group_id curves[] = { MBEDTLS_ECP_DP_SECP256R1, MBEDTLS_ECP_DP_NONE };
+    mbedtls_ssl_conf_curves(&conf_, curves);
+#endif
+#if defined(MBEDTLS_SSL_SESSION_TICKETS)
+    mbedtls_ssl_conf_session_tickets(&conf_, MBEDTLS_SSL_SESSION_TICKETS_ENABLED);
+#endif
+    if (mbedtls_ssl_setup(&ssl_, &conf_) != 0) return false;
+    ready_ = true;
+    return true;
+  }
+
+  bool tcp_connect(const char* host, uint16_t port, uint32_t t0) {
+    addrinfo hints = {}, *res = nullptr;
+    hints.ai_family = AF_INET;
+    hints.ai_socktype = SOCK_STREAM;
+    char service[8];
+    snprintf(service, sizeof(service), "%u", port);
+    if (getaddrinfo(host, service, &hints, &res) != 0 || !res) return false;
+
+    fd_ = ::socket(res->ai_family, res->ai_socktype, res->ai_protocol);
+    if (fd_ >= 0) {
+      fcntl(fd_, F_SETFL, fcntl(fd_, F_GETFL, 0) | O_NONBLOCK);
+      int r = ::connect(fd_, res->ai_addr, res->ai_addrlen);
+      if (r != 0 && errno == EINPROGRESS && wait(true, t0)) {
+        int err = 0;
+        socklen_t len = sizeof(err);
+        getsockopt(fd_, SOL_SOCKET, SO_ERROR, &err, &len);
+        r = err ? -1 : 0;
+      }
+      if (r != 0) {
+        ::close(fd_);
+        fd_ = -1;
+      }
+    }
+    freeaddrinfo(res);
+    if (fd_ < 0) return false;
+
+    const int one = 1;
+    setsockopt(fd_, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    return true;
+  }
+
+  // until the socket is readable/writable or timeoutMs_ since t0 is used up
+  bool wait(bool forWrite, uint32_t t0) {
+    const uint32_t used = millis() - t0;
+    if (used >= timeoutMs_) return false;
+    const uint32_t ms = timeoutMs_ - used;
+    fd_set fds;
+    FD_ZERO(&fds);
+    FD_SET(fd_, &fds);
+    struct timeval tv;
+    tv.tv_sec  = ms / 1000;
+    tv.tv_usec = (ms % 1000) * 1000;
+    return ::select(fd_ + 1, forWrite ? nullptr : &fds, forWrite ? &fds : nullptr, nullptr, &tv) > 0;
+  }
+
+  // one non-blocking record read into rxBuf_
+  void fill() {
+    rxPos_ = rxLen_ = 0;
+    if (closed_) return;
+    const int r = mbedtls_ssl_read(&ssl_, rxBuf_, sizeof(rxBuf_));
+    if (r > 0) { rxLen_ = (size_t)r; return; }
+    if (r == MBEDTLS_ERR_SSL_WANT_READ || r == MBEDTLS_ERR_SSL_WANT_WRITE) return;
+    lastError_ = r;
+    closed_ = true;                      // close_notify, EOF or error
+  }
+
+  static int bio_send(void* ctx, const unsigned char* p, size_t n) {
+    TlsClient* c = (TlsClient*)ctx;
+    c->sample_heap();
+    const int r = (int)::send(c->fd_, p, n, 0);
+    if (r < 0) return (errno == EAGAIN || errno == EWOULDBLOCK) ? MBEDTLS_ERR_SSL_WANT_WRITE : -1;
+    c->wireTx_ += (uint32_t)r;
+    return r;
+  }
+
+  static int bio_recv(void* ctx, unsigned char* p, size_t n) {
+    TlsClient* c = (TlsClient*)ctx;
+    c->sample_heap();
+    const int r = (int)::recv(c->fd_, p, n, 0);
+    if (r < 0) return (errno == EAGAIN || errno == EWOULDBLOCK) ? MBEDTLS_ERR_SSL_WANT_READ : -1;
+    c->wireRx_ += (uint32_t)r;
+    return r;                            // 0 = EOF
+  }
+
+  void sample_heap() {
+    if (open_) return;                   // only while the handshake runs
+    const size_t f = heap_caps_get_free_size(MALLOC_CAP_8BIT);
+    if (f < heapMin_) heapMin_ = f;
+  }
+
+  mbedtls_ssl_context      ssl_;
+  mbedtls_ssl_config       conf_;
+  mbedtls_x509_crt         ca_;
+  mbedtls_ctr_drbg_context drbg_;
+  mbedtls_entropy_context  entropy_;
+  mbedtls_ssl_session      session_;
+
+  const char* caPem_      = nullptr;
+  const char* serverName_ = nullptr;
+  uint32_t    timeoutMs_  = 5000;
+  int         fd_         = -1;
+  bool        ready_      = false;
+  bool        open_       = false;
+  bool        closed_     = false;
+  bool        haveSession_ = false;
+  bool        lastResumed_ = false;
+
+  uint8_t     rxBuf_[128];
+  size_t      rxPos_ = 0, rxLen_ = 0;
+
+  uint32_t full_ = 0, resumed_ = 0, failed_ = 0;
+  uint32_t tcpMs_ = 0, handshakeMs_ = 0, heapHeld_ = 0, heapPeak_ = 0;
+  size_t   heapMin_ = 0;
+  uint32_t wireTx_ = 0, wireRx_ = 0, plainTx_ = 0, writes_ = 0, writeUs_ = 0;
+  int      lastError_ = 0;
+};
+
+
+// ============================================================
+//  ON-DEVICE BENCHMARK
+// ============================================================
+
+// rounds x (TCP only, TLS full, TLS resumed) against host:port; plus the
+// record overhead of one small write (MQTT PINGREQ, 2 bytes)
+inline void tls_bench(Print& out, const char* host, uint16_t port, const char* ca,
+                      const char* serverName, int rounds = 5) {
+  TlsClient c;
+  c.set_ca(ca);
+  c.set_server_name(serverName);
+  const size_t heap0 = heap_caps_get_free_size(MALLOC_CAP_8BIT);
+
+  uint32_t tcpMs = 0, fullMs = 0, resMs = 0, fullPeak = 0, resPeak = 0, held = 0;
+  int fullN = 0, resN = 0, fail = 0;
+  for (int i = 0; i < rounds; i++) {
+    for (int resume = 0; resume < 2; resume++) {
+      if (!resume) c.forget_session();
+      if (!c.connect(host, port)) { fail++; continue; }
+      tcpMs += c.last_tcp_ms();
+      if (c.last_resumed()) { resN++; resMs += c.last_handshake_ms(); resPeak += c.heap_peak(); }
+      else                  { fullN++; fullMs += c.last_handshake_ms(); fullPeak += c.heap_peak(); }
+      held = c.heap_held();
+      c.stop();
+    }
+  }
+
+  uint32_t overhead = 0, writeUs = 0;
+  if (c.connect(host, port)) {
+    static const uint8_t ping[2] = { 0xC0, 0 };
+    const uint32_t w0 = c.wire_tx_bytes(), u0 = c.write_us();
+    c.write(ping, sizeof(ping));
+    overhead = c.wire_tx_bytes() - w0 - sizeof(ping);
+    writeUs = c.write_us() - u0;
+    c.stop();
+  }
+
+  const int conns = fullN + resN;
+  out.printf("tls %s:%u, %d rounds, %d failed (mbedTLS %d)\n", host, port, rounds, fail, c.last_error());
+  out.printf("tcp connect        %5lu ms\n", (unsigned long)(conns ? tcpMs / conns : 0));
+  out.printf("handshake full     %5lu ms  peak heap %6lu B  (%d)\n",
+             (unsigned long)(fullN ? fullMs / fullN : 0), (unsigned long)(fullN ? fullPeak / fullN : 0), fullN);
+  out.printf("handshake resumed  %5lu ms  peak heap %6lu B  (%d)\n",
+             (unsigned long)(resN ? resMs / resN : 0), (unsigned long)(resN ? resPeak / resN : 0), resN);
+  out.printf("heap %lu B once (record buffers, CA, DRBG) + %lu B per open connection\n",
+             (unsigned long)(heap0 - heap_caps_get_free_size(MALLOC_CAP_8BIT)), (unsigned long)held);
+  out.printf("per write          %5lu B record overhead, %lu us encrypt + send (plaintext: 0 B)\n",
+             (unsigned long)overhead, (unsigned long)writeUs);
+}
+
+} // namespace h2h
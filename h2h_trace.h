@@ -0,0 +1,172 @@
+// ============================================================
+// h2h_trace.h  —  scoped hot-path tracing into a RAM ring buffer
+// - H2H_TRACE_SCOPE("name") records start (us) + duration (CPU cycles)
+// - runtime switch (off by default) -> profile production units
+//   without reflashing: trace_enable(true), dump, trace_enable(false)
+// - dump as Chrome trace-event JSON (chrome://tracing, Perfetto)
+// - innermost open scope per task, kept also while tracing is off, for
+//   tasks that asked for it (trace_track_current(), h2h_stall.h)
+// - build with -DH2H_TRACE=0 and every macro compiles to nothing
+//
+// Include from the sketch itself (one translation unit).
+// ============================================================
+
+#pragma once
+
+#include <Arduino.h>
+#include <atomic>
+
+#ifndef H2H_TRACE
+  #define H2H_TRACE 1
+#endif
+
+#ifndef H2H_TRACE_RING_SIZE
+  #define H2H_TRACE_RING_SIZE 512     // events, power of two (16 B each)
+#endif
+
+
+#define H2H_TRACE_CAT2(a, b) a##b
+#define H2H_TRACE_CAT(a, b)  H2H_TRACE_CAT2(a, b)
+
+#if H2H_TRACE
+  #define H2H_TRACE_SCOPE(name) h2h::TraceScope H2H_TRACE_CAT(_h2hTrace, __LINE__)(name)
+#else
+  #define H2H_TRACE_SCOPE(name) do{}while(0)
+#endif
+
+
+namespace h2h {
+
+#if H2H_TRACE
+
+static_assert((H2H_TRACE_RING_SIZE & (H2H_TRACE_RING_SIZE - 1)) == 0,
+              "H2H_TRACE_RING_SIZE must be a power of two");
+
+struct TraceEvent {
+  const char* name;     // string literal, never copied
+  uint32_t    startUs;  // micros() at scope entry
+  uint32_t    cycles;   // duration in CPU cycles (same core)
+  uint8_t     core;
+};
+
+struct TraceRing {
+  TraceEvent ev[H2H_TRACE_RING_SIZE];
+  std::atomic<uint32_t> head{0};       // total events ever written
+  std::atomic<bool> enabled{false};
+};
+
+inline TraceRing& trace_ring() {
+  static TraceRing ring;
+  return ring;
+}
+
+inline void trace_enable(bool on) { trace_ring().enabled.store(on, std::memory_order_relaxed); }
+inline bool trace_enabled()       { return trace_ring().enabled.load(std::memory_order_relaxed); }
+
+inline void trace_clear() { trace_ring().head.store(0, std::memory_order_relaxed); }
+
+// Name of the innermost open scope of one task; written by that task only,
+// read from anywhere (a sampler sees the scope the task is blocked in).
+struct TraceCurrent {
+  std::atomic<const char*> name{nullptr};
+};
+
+inline TraceCurrent*& trace_current_slot() {
+  static thread_local TraceCurrent* slot = nullptr;
+  return slot;
+}
+
+// From the task itself; scopes of other tasks cost one TLS load
+inline void trace_track_current(TraceCurrent* cur) { trace_current_slot() = cur; }
+
+// Several tasks may record concurrently: the slot is claimed with one
+// atomic add; a dump racing a writer can show one torn event at most.
+inline void trace_record(const char* name, uint32_t startUs, uint32_t cycles) {
+  TraceRing& r = trace_ring();
+  uint32_t i = r.head.fetch_add(1, std::memory_order_relaxed) & (H2H_TRACE_RING_SIZE - 1);
+  TraceEvent& e = r.ev[i];
+  e.name    = name;
+  e.startUs = startUs;
+  e.cycles  = cycles;
+  e.core    = (uint8_t)xPortGetCoreID();
+}
+
+struct TraceScope {
+  const char* name;
+  uint32_t startUs;
+  uint32_t startCycles;
+  bool on;
+  TraceCurrent* cur;
+  const char* outer;
+
+  explicit TraceScope(const char* n) : name(n), on(trace_enabled()), cur(trace_current_slot()) {
+    if (cur) {
+      outer = cur->name.load(std::memory_order_relaxed);
+      cur->name.store(n, std::memory_order_relaxed);
+    }
+    if (!on) return;
+    startUs = micros();
+    startCycles = ESP.getCycleCount();
+  }
+  ~TraceScope() {
+    if (on) trace_record(name, startUs, ESP.getCycleCount() - startCycles);
+    if (cur) cur->name.store(outer, std::memory_order_relaxed);
+  }
+};
+
+// Chrome trace-event JSON ("X" = complete events, tid = CPU core).
+// Tracing is paused while dumping so the ring stays consistent.
+inline void trace_dump_chrome(Print& out) {
+  TraceRing& r = trace_ring();
+  const bool wasOn = trace_enabled();
+  trace_enable(false);
+
+  const uint32_t head  = r.head.load(std::memory_order_relaxed);
+  const uint32_t count = head < H2H_TRACE_RING_SIZE ? head : H2H_TRACE_RING_SIZE;
+  const uint32_t mhz   = ESP.getCpuFreqMHz();
+
+  out.print("{\"displayTimeUnit\":\"ms\",\"traceEvents\":[");
+  for (uint32_t k = 0; k < count; k++) {
+    const TraceEvent& e = r.ev[(head - count + k) & (H2H_TRACE_RING_SIZE - 1)];
+    const uint32_t durNs = (uint32_t)(((uint64_t)e.cycles * 1000) / mhz);
+    out.printf("%s{\"name\":\"%s\",\"ph\":\"X\",\"pid\":1,\"tid\":%u,\"ts\":%lu,\"dur\":%lu.%03lu}",
+               k ? "," : "", e.name, (unsigned)e.core, (unsigned long)e.startUs,
+               (unsigned long)(durNs / 1000), (unsigned long)(durNs % 1000));
+  }
+  out.print("]}\n");
+
+  trace_enable(wasOn);
+}
+
+// Serial commands: 't' = tracing on/off, 'd' = dump, 'c' = clear.
+// Returns false for characters that are not trace commands.
+inline bool trace_serial_cmd(int c) {
+  if (c == 't') {
+    trace_enable(!trace_enabled());
+    Serial.printf("TRACE: %s\n", trace_enabled() ? "on" : "off");
+  } else if (c == 'd') {
+    trace_dump_chrome(Serial);
+  } else if (c == 'c') {
+    trace_clear();
+  } else {
+    return false;
+  }
+  return true;
+}
+
+#else  // !H2H_TRACE
+
+struct TraceCurrent {
+  std::atomic<const char*> name{nullptr};
+};
+
+inline void trace_enable(bool) {}
+inline bool trace_enabled() { return false; }
+inline void trace_clear() {}
+inline void trace_track_current(TraceCurrent*) {}
+inline void trace_dump_chrome(Print& out) { out.print("{\"traceEvents\":[]}\n"); }
+inline bool trace_serial_cmd(int) { return false; }
+
+#endif // H2H_TRACE
+
+} // namespace h2h
@@ -0,0 +1,269 @@
+// ============================================================
+// h2h_wifi.h  —  fast WiFi (re)connect from a cached association
+// - after a successful connect the AP (SSID, BSSID, channel) and the
+//   DHCP lease (IP, gateway, mask, DNS) are kept in RTC memory and NVS
+// - fast path: WiFi.begin() with channel + BSSID skips the scan, the
+//   cached lease as static IP skips DHCP (~ few hundred ms instead of s)
+// - the lease is only reused from RTC memory (deep sleep wake, same
+//   power cycle) and at most WIFI_LEASE_USES times, then DHCP again;
+//   after a cold boot NVS still gives BSSID + channel (no scan)
+// - any failure: the caller falls back to a normal connect (scan + DHCP)
+// - NVS is only written when the AP changes, not on every connect
+// - no password in the cache: the caller passes it, or (ssid == nullptr)
+//   it is read from the WiFi driver's own NVS copy for that one connect
+//
+// Include from the sketch itself (one translation unit).
+// ============================================================
+
+#pragma once
+
+#include <Arduino.h>
+#include <WiFi.h>
+#include <esp_wifi.h>
+#include <Preferences.h>
+#include <stddef.h>
+#include <string.h>
+#include "h2h_metrics.h"
+
+#ifndef H2H_WIFI_FAST_TIMEOUT_MS
+  #define H2H_WIFI_FAST_TIMEOUT_MS 1500   // fast path gives up after this
+#endif
+
+#ifndef H2H_WIFI_LEASE_USES
+  #define H2H_WIFI_LEASE_USES 32          // static-IP connects before DHCP runs again
+#endif
+
+
+namespace h2h {
+
+// ============================================================
+//  CACHE
+// ============================================================
+
+static const uint32_t WIFI_CACHE_MAGIC = 0x48325702;   // bump when the layout changes
+
+struct WifiCache {
+  uint32_t magic;
+  char     ssid[33];
+  uint8_t  bssid[6];
+  uint8_t  channel;
+  uint8_t  leaseUses;       // fast connects on the cached lease since the last DHCP
+  uint32_t ip, gw, mask, dns;   // 0 = no lease
+  uint32_t sum;             // over everything above
+};
+
+static inline uint32_t wifi_cache_sum(const WifiCache& c) {
+  // FNV-1a; RTC memory is garbage after power-on, NVS may hold an old layout
+  const uint8_t* p = (const uint8_t*)&c;
+  uint32_t h = 2166136261u;
+  for (size_t i = 0; i < offsetof(WifiCache, sum); i++) h = (h ^ p[i]) * 16777619u;
+  return h;
+}
+
+static inline bool wifi_cache_ok(const WifiCache& c) {
+  return c.magic == WIFI_CACHE_MAGIC && c.channel && c.sum == wifi_cache_sum(c);
+}
+
+// survives deep sleep (not power loss)
+static RTC_DATA_ATTR WifiCache wifiRtcCache;
+
+struct WifiState {
+  WifiCache cache;
+  bool loaded    = false;
+  bool fromRtc   = false;   // lease is only trusted when it comes from RTC memory
+  bool leaseUsed = false;   // current connection runs on the cached lease
+};
+
+inline WifiState& wifi_state() {
+  static WifiState s;
+  return s;
+}
+
+static Histogram wifiConnectMs ("wifi_connect_ms",        "WiFi begin to connected (fast path or full)", BUCKETS_MS);
+static Counter   wifiFast      ("wifi_fast_total",        "Connects via cached BSSID/channel");
+static Counter   wifiFastFail  ("wifi_fast_fail_total",   "Fast-path connects that fell back to a full scan");
+
+// cache from RTC memory, else NVS; false = nothing usable
+inline bool wifi_cache_load() {
+  WifiState& s = wifi_state();
+  if (s.loaded) return wifi_cache_ok(s.cache);
+  s.loaded = true;
+
+  if (wifi_cache_ok(wifiRtcCache)) {
+    s.cache = wifiRtcCache;
+    s.fromRtc = true;
+    return true;
+  }
+
+  Preferences p;
+  bool ok = false;
+  if (p.begin("h2h_wifi", true)) {
+    ok = p.getBytes("cache", &s.cache, sizeof(s.cache)) == sizeof(s.cache) && wifi_cache_ok(s.cache);
+    p.end();
+  }
+  if (!ok) memset(&s.cache, 0, sizeof(s.cache));
+  return ok;
+}
+
+inline void wifi_cache_clear() {
+  WifiState& s = wifi_state();
+  memset(&s.cache, 0, sizeof(s.cache));
+  wifiRtcCache = s.cache;
+  s.loaded = true;
+  s.fromRtc = false;
+
+  Preferences p;
+  if (p.begin("h2h_wifi", false)) {
+    p.remove("cache");
+    p.end();
+  }
+}
+
+// remember the current association; call once WL_CONNECTED
+inline void wifi_cache_save() {
+  if (WiFi.status() != WL_CONNECTED) return;
+  wifi_cache_load();
+  WifiState& s = wifi_state();
+  WifiCache c = s.cache;
+  const bool hadAp = wifi_cache_ok(c);
+
+  WifiCache n;
+  memset(&n, 0, sizeof(n));
+  n.magic = WIFI_CACHE_MAGIC;
+  strncpy(n.ssid, WiFi.SSID().c_str(), sizeof(n.ssid) - 1);
+  const uint8_t* b = WiFi.BSSID();
+  if (b) memcpy(n.bssid, b, sizeof(n.bssid));
+  n.channel = (uint8_t)WiFi.channel();
+  if (s.leaseUsed) {
+    // static IP: nothing new learned about the lease
+    n.leaseUses = c.leaseUses;
+    n.ip = c.ip; n.gw = c.gw; n.mask = c.mask; n.dns = c.dns;
+  } else {
+    n.ip   = (uint32_t)WiFi.localIP();
+    n.gw   = (uint32_t)WiFi.gatewayIP();
+    n.mask = (uint32_t)WiFi.subnetMask();
+    n.dns  = (uint32_t)WiFi.dnsIP();
+  }
+  n.sum = wifi_cache_sum(n);
+
+  s.cache = n;
+  s.fromRtc = true;          // from now on RTC memory holds this lease
+  wifiRtcCache = n;
+
+  // NVS only when the AP itself changed (flash wear); the lease stays RTC-only
+  const bool apChanged = !hadAp || strcmp(c.ssid, n.ssid) != 0 ||
+                         memcmp(c.bssid, n.bssid, sizeof(n.bssid)) != 0 || c.channel != n.channel;
+  if (!apChanged) return;
+  Preferences p;
+  if (p.begin("h2h_wifi", false)) {
+    p.putBytes("cache", &n, sizeof(n));
+    p.end();
+  }
+}
+
+// SSID/password from the driver's NVS (WiFiManager saved them there).
+// Only works before the driver was started with persistent(false): that
+// start skips loading the stored config, the caller then scans as usual.
+static inline bool wifi_driver_credentials(char ssid[33], char pass[65]) {
+  if (WiFi.getMode() == WIFI_OFF) {
+    WiFi.persistent(true);
+    WiFi.mode(WIFI_STA);
+  }
+  wifi_config_t conf;
+  if (esp_wifi_get_config(WIFI_IF_STA, &conf) != ESP_OK || !conf.sta.ssid[0]) return false;
+  memcpy(ssid, conf.sta.ssid, 32);
+  ssid[32] = '\0';
+  memcpy(pass, conf.sta.password, 64);
+  pass[64] = '\0';
+  memset(&conf, 0, sizeof(conf));
+  return true;
+}
+
+
+// ============================================================
+//  CONNECT
+// ============================================================
+
+static inline bool wifi_wait_connected(uint32_t t0, uint32_t timeoutMs) {
+  while (WiFi.status() != WL_CONNECTED) {
+    if (millis() - t0 >= timeoutMs) return false;
+    delay(10);
+  }
+  return true;
+}
+
+// Fast path only. ssid == nullptr: the credentials the driver has stored.
+// false = no cache, other SSID configured, or not connected within timeoutMs;
+// the station is then idle again with DHCP enabled.
+inline bool wifi_fast_connect(const char* ssid, const char* pass,
+                              uint32_t timeoutMs = H2H_WIFI_FAST_TIMEOUT_MS) {
+  WifiState& s = wifi_state();
+  s.leaseUsed = false;
+  if (!wifi_cache_load()) return false;
+  WifiCache& c = s.cache;
+  char drvSsid[33], drvPass[65] = {};         // stack only, wiped below
+  if (!ssid) {
+    if (!wifi_driver_credentials(drvSsid, drvPass)) return false;
+    ssid = drvSsid;
+    pass = drvPass;
+  }
+  if (strcmp(ssid, c.ssid) != 0) {
+    memset(drvPass, 0, sizeof(drvPass));
+    return false;
+  }
+
+  const bool lease = s.fromRtc && c.ip && c.leaseUses < H2H_WIFI_LEASE_USES;
+  const uint32_t t0 = millis();
+
+  WiFi.persistent(false);
+  WiFi.mode(WIFI_STA);
+  if (lease) WiFi.config(IPAddress(c.ip), IPAddress(c.gw), IPAddress(c.mask), IPAddress(c.dns));
+  else       WiFi.config(IPAddress(), IPAddress(), IPAddress());   // 0.0.0.0 = DHCP
+  // no NVS write inside WiFi.begin() (the driver may run with NVS from
+  // wifi_driver_credentials): the stored config must not get our BSSID lock
+  esp_wifi_set_storage(WIFI_STORAGE_RAM);
+  WiFi.begin(ssid, pass, c.channel, c.bssid);
+  esp_wifi_set_storage(WIFI_STORAGE_FLASH);
+  memset(drvPass, 0, sizeof(drvPass));
+
+  if (!wifi_wait_connected(t0, timeoutMs)) {
+    wifiFastFail.inc();
+    WiFi.disconnect();
+    if (lease) WiFi.config(IPAddress(), IPAddress(), IPAddress());
+    // AP moved or lease gone: next try goes through DHCP
+    c.ip = 0;
+    c.sum = wifi_cache_sum(c);
+    wifiRtcCache = c;
+    return false;
+  }
+
+  if (lease) {
+    s.leaseUsed = true;
+    c.leaseUses++;
+    c.sum = wifi_cache_sum(c);
+    wifiRtcCache = c;
+  }
+  wifiFast.inc();
+  wifiConnectMs.observe(millis() - t0);
+  return true;
+}
+
+// Fast path, then full scan + DHCP; saves the cache when connected.
+inline bool wifi_connect(const char* ssid, const char* pass, uint32_t timeoutMs) {
+  if (wifi_fast_connect(ssid, pass)) {
+    wifi_cache_save();
+    return true;
+  }
+
+  const uint32_t t0 = millis();
+  WiFi.persistent(false);
+  WiFi.mode(WIFI_STA);
+  WiFi.begin(ssid, pass);
+  if (!wifi_wait_connected(t0, timeoutMs)) return false;
+
+  wifiConnectMs.observe(millis() - t0);
+  wifi_cache_save();
+  return true;
+}
+
+} // namespace h2h
@@ -5,6 +5,35 @@
 // - Separate 1-pixel WS2812 "WiFi Ampel" on GPIO5
 // - House LEDs (rooms/tree) on GPIO16
 // - MQTT subscribes numeric-only topics from haus1
+// - Own counters/timings published to h2h/haus2/sys/<metric>
+// - Loop tracing over serial ('t' on/off, 'd' dump Chrome JSON)
+// - Heap report over serial ('h'), pixel kernel benchmark ('p'),
+//   TLS handshake benchmark ('l', only with MQTT_TLS),
+//   MAC sign/verify benchmark ('m', only with MQTT_MAC),
+//   stall report ('s': loop iterations over STALL_*_MS per trace scope),
+//   probe report ('r': RTT / clock offset to the other houses)
+// - Delta OTA (h2h_ota.h): "1" on h2h/haus2/sys/ota (MAC-checked, only
+//   with MQTT_MAC) or serial 'u' fetches OTA_DELTA_URL, verifies it
+//   against OTA_KEY, patches into the other slot and restarts
+// - RTT / clock-offset probe (h2h_probe.h) to every other house every
+//   PROBE_MS, per-peer min/p50/p90/jitter/offset/skew under sys/probe_*
+// - Network (WiFi/MQTT) task on core 0, render task on core 1;
+//   MQTT only publishes raw values into a seqlock state block,
+//   the render task snapshots it and decides colors
+// - Net task work runs from a timer wheel; between deadlines it sleeps
+//   in select() on the MQTT socket
+// - Effects: crossfade on change, pulse when stale, breathing when occupied
+// - Per-topic freshness: last-seen slots + timer wheel mark stale topics
+// - Bursts (reconnect, bridge backlog) coalesce: the callback only keeps
+//   the newest payload per topic slot, one drain per net iteration parses
+//   them and writes the state once; mqtt.loop() reads MQTT_RX_BUDGET
+//   bytes per iteration, so a backlog of any size is worked off in slices
+// - MQTT via h2h_mqtt.h: non-blocking, payload views straight from the
+//   receive buffer (no copy in the callback)
+// - MQTT host from a DNS cache (h2h_dns.h): refreshed in the background
+//   before the TTL runs out, last good address kept when DNS fails
+// - WiFi fast path via h2h_wifi.h: cached BSSID/channel/lease first,
+//   WiFiManager only when that fails
 // ============================================================
 
 
@@ -13,11 +42,37 @@
 // ============================================================
 
 #include <WiFi.h>
-#include <PubSubClient.h>
+#include <lwip/sockets.h>  // select()
 
 #include <FastLED.h>
 #include <WiFiManager.h>   // tzapu
 
+#include "h2h_metrics.h"
+#include "h2h_trace.h"
+#include "h2h_heap.h"
+#include "h2h_seqlock.h"
+#include "h2h_pixels.h"
+#include "h2h_timer.h"
+#include "h2h_mqtt.h"
+#include "h2h_wifi.h"
+#include "h2h_dns.h"
+#include "h2h_ota.h"
+#include "h2h_stall.h"
+#include "h2h_probe.h"
+
+#ifndef MQTT_TLS
+  #define MQTT_TLS 0         // 1: MQTT over TLS on 8883 (h2h_tls.h), see MQTT_CA_PEM
+#endif
+#if MQTT_TLS
+  #include "h2h_tls.h"
+#endif
+#ifndef MQTT_MAC
+  #define MQTT_MAC 0         // 1: only accept haus1 messages with a valid MAC (h2h_mac.h), see MQTT_MAC_KEY
+#endif
+#if MQTT_MAC
+  #include "h2h_mac.h"
+#endif
+
 
 // ============================================================
 //  DEBUG (optional)
@@ -46,6 +101,22 @@
 #define HOUSE_LED_PIN        16      // official LED strip (rooms/tree)
 
 
+// ============================================================
+//  TASKS
+// ============================================================
+
+#define NET_CORE             0       // WiFi/lwIP live here anyway
+#define RENDER_CORE          1
+#define NET_TASK_STACK       8192
+#define RENDER_TASK_STACK    4096
+#define RENDER_INTERVAL_MS   20      // 50 fps frame clock
+#define NET_TIMER_TICK_MS    10      // net task timer wheel resolution
+#define NET_MAX_WAIT_MS      1000    // upper bound for one sleep (link loss, MQTT keepalive)
+#define SERIAL_POLL_MS       100
+#define STALL_NET_MS         250     // net task iteration longer than this = stall
+#define STALL_RENDER_MS      (2 * RENDER_INTERVAL_MS)   // a dropped frame
+
+
 // ============================================================
 //  MQTT CONFIG (no secrets in repo)
 // ============================================================
@@ -53,20 +124,46 @@
 // For initial testing you can use test.mosquitto.org (no auth, public).
 // For real use: set to your broker and configure auth accordingly.
 static const char* MQTT_HOST = "test.mosquitto.org";
-static const uint16_t MQTT_PORT = 1883;
+static const uint16_t MQTT_PORT = MQTT_TLS ? 8883 : 1883;
+static const uint8_t  MQTT_PROTOCOL = 5;   // 5: topic aliases (less per sample); falls back to 3.1.1
+
+// Broker CA for MQTT_TLS (PEM). Own broker: ECDSA P-256 certificate (README).
+// nullptr = no certificate check, for testing against test.mosquitto.org only.
+static const char* MQTT_CA_PEM = nullptr;
 
 // If your broker needs auth, fill these (or leave empty for none).
 static const char* MQTT_USER = "";    // e.g. "mqttuser"
 static const char* MQTT_PASS = "";    // e.g. "mqttpass"
 
+// MQTT_MAC: 128-bit key as 32 hex chars, same as on the sending node (keep it out of the repo)
+static const char* MQTT_MAC_KEY = "00000000000000000000000000000000";
+
 // Make this unique per device
 static const char* CLIENT_ID = "haus2-esp32";
+static const char* HOUSE_ID  = "haus2";
 
 // Topics (numeric-only)
 static const char* TOP_STATUS    = "h2h/haus1/sys/status";       // "1"/"0" retained
 static const char* TOP_WC_HUMID  = "h2h/haus1/wc/humid";         // float (%)
 static const char* TOP_STUBE_ADC = "h2h/haus1/stube/light_adc";  // int (0..4095)
 
+// Delta OTA: "1" here fetches OTA_DELTA_URL (broker/h2h_delta.cpp), result -> TOP_OTA_STATUS.
+// The trigger needs a valid MAC (MQTT_MAC, `h2h_delta trigger`), without it only serial 'u'.
+// OTA_KEY: 32 hex chars = H2H_OTA_KEY of `h2h_delta diff`; all zero = no OTA (keep it out of the repo)
+static const char* OTA_KEY        = "00000000000000000000000000000000";
+static const char* TOP_OTA        = "h2h/haus2/sys/ota";
+static const char* TOP_OTA_STATUS = "h2h/haus2/sys/ota_status";
+static const char* OTA_DELTA_URL  = "http://broker.local:8000/haus2.h2hd";
+
+// Own metrics -> h2h/haus2/sys/<metric>
+static const uint32_t METRICS_PUBLISH_MS = 60000;
+
+// RTT / clock probe: request on h2h/haus2/sys/probe, replies on .../probe/<peer>
+static const uint32_t PROBE_MS = 10000;
+
+static const uint32_t MQTT_RETRY_MS = 2000;   // between failed connect attempts
+static const size_t   MQTT_RX_BUDGET = 2048;  // bytes per net iteration (~60 samples), rest waits in the socket
+
 
 // ============================================================
 //  LED CONFIG (house strip layout)
@@ -80,19 +177,106 @@ static const int WC_LED_COUNT    = 10;
 static const int STUBE_LED_START = 10;
 static const int STUBE_LED_COUNT = 10;
 
+// Interpretation happens here (receiver), never on the sensor node
+static const float WC_HUMID_WET      = 65.0f;  // >= : blue, else orange
+static const int   STUBE_ADC_BRIGHT  = 2000;   // >= : yellow, else off
+static const uint32_t STALE_MS       = 60000;  // no new value for 12 publish periods (4 heartbeats)
+
+// Effects (render task)
+static const uint32_t FX_FADE_MS     = 600;    // crossfade to a new color
+static const uint32_t FX_PULSE_MS    = 1200;   // stale: quick dim pulse
+static const uint32_t FX_BREATHE_MS  = 4000;   // occupied: slow breathing
+static const uint32_t FX_BUDGET_US   = 2000;   // per frame; leftovers carry over
+
 
 // ============================================================
 //  GLOBALS
 // ============================================================
 
-WiFiClient wifiClient;
-PubSubClient mqtt(wifiClient);
+#if MQTT_TLS
+h2h::TlsClient mqttNet;           // keeps the TLS session across reconnects
+#else
+WiFiClient mqttNet;
+#endif
+h2h::MqttClient<decltype(mqttNet)> mqtt(mqttNet);
+#if MQTT_MAC
+static h2h::MacVerifier<> macVerifier;
+#endif
+WiFiUDP dnsUdp;
+h2h::DnsCache<WiFiUDP> dnsCache(dnsUdp);
 
 CRGB wifiLed[WIFI_LED_COUNT];     // private status pixel
 CRGB leds[NUM_LEDS];              // house strip
 
 static bool sourceOnline = false;
 
+// Subscribed topics; the index doubles as the bit in HouseState::staleMask
+enum TopicId : uint8_t { TOPIC_STATUS, TOPIC_WC_HUMID, TOPIC_STUBE_ADC, TOPIC_COUNT };
+
+// Latest raw values from haus1. Written only by the MQTT side (net task),
+// snapshotted by the render task; no locks, the callback never waits.
+struct HouseState {
+  bool    online;
+  bool    hasHumid;
+  bool    hasAdc;
+  uint8_t staleMask; // bit (1 << TopicId): no update for STALE_MS
+  float   humid;     // %
+  int32_t adc;       // 0..4095
+};
+
+static h2h::SeqLock<HouseState> houseState;
+static HouseState netState = {};   // writer-side working copy
+
+// Deadlines of the net task (staleness, retries, publishing); net task only
+static h2h::TimerWheel<> netTimers(NET_TIMER_TICK_MS);
+
+static TaskHandle_t netTaskHandle    = nullptr;
+static TaskHandle_t renderTaskHandle = nullptr;
+
+
+// ============================================================
+//  METRICS
+// ============================================================
+
+static h2h::Counter   mMqttRx        ("mqtt_rx_total",        "MQTT messages handled in mqtt_callback");
+static h2h::Counter   mMqttReconnect ("mqtt_reconnect_total", "MQTT (re)connect attempts");
+static h2h::Counter   mMqttConnFail  ("mqtt_connect_fail_total", "Failed MQTT connect attempts");
+static h2h::Histogram mMqttCbUs      ("mqtt_callback_us",     "mqtt_callback duration", h2h::BUCKETS_US);
+static h2h::Counter   mMqttRxBytes   ("mqtt_rx_bytes_total",  "Bytes received by the MQTT client; / mqtt_rx_total = bytes per sample");
+#if MQTT_TLS
+static h2h::Histogram mTlsHandshakeMs("tls_handshake_ms",     "TLS handshake of an MQTT connect (full or resumed)", h2h::BUCKETS_MS);
+static h2h::Counter   mTlsFull       ("tls_handshakes_full_total", "Full TLS handshakes (certificate + ECDHE)");
+static h2h::Counter   mTlsResumed    ("tls_handshakes_resumed_total", "TLS handshakes resumed from the previous session");
+static h2h::Gauge     mTlsHeap       ("tls_heap_bytes",       "Heap held by the open TLS connection");
+static h2h::Counter   mTlsOverhead   ("tls_tx_overhead_bytes_total", "TLS bytes sent minus MQTT bytes (records + handshakes)");
+#endif
+#if MQTT_MAC
+static h2h::Counter   mMacOk         ("mac_ok_total",         "Messages with a valid MAC");
+static h2h::Counter   mMacBad        ("mac_bad_total",        "Messages dropped: MAC does not match");
+static h2h::Counter   mMacReplay     ("mac_replay_total",     "Messages dropped: valid MAC, counter already seen or too old");
+static h2h::Counter   mMacMissing    ("mac_missing_total",    "Messages dropped: no MAC property");
+static h2h::Histogram mMacVerifyUs   ("mac_verify_us",        "MAC check per received message", h2h::BUCKETS_US);
+#endif
+static h2h::Counter   mDnsQueries    ("dns_queries_total",    "DNS queries sent by the cache (refresh + retry)");
+static h2h::Counter   mDnsFailures   ("dns_failures_total",   "DNS timeouts / errors (last good address kept)");
+static h2h::Counter   mDnsStale      ("dns_stale_served_total", "Connects on a last-known-good address past its TTL");
+static h2h::Histogram mShowUs        ("led_show_us",          "FastLED.show duration (house strip)", h2h::BUCKETS_US);
+static h2h::Gauge     mWifiRssi      ("wifi_rssi_dbm",        "WiFi RSSI");
+static h2h::Counter   mFrames        ("render_frames_total",  "Frames shown by the render task");
+static h2h::Counter   mStateStale    ("state_superseded_total", "State updates that arrived while a snapshot was drawn");
+static h2h::Counter   mFxOverBudget  ("fx_over_budget_total", "Effect frames cut short by FX_BUDGET_US");
+static h2h::Histogram mFxUs          ("fx_frame_us",          "Effect engine time per frame", h2h::BUCKETS_US);
+static h2h::Counter   mRenderLate    ("render_late_total",    "Render ticks more than one period late");
+static h2h::Histogram mRenderJitter  ("render_jitter_us",     "Deviation of the render period from RENDER_INTERVAL_MS", h2h::BUCKETS_US);
+static h2h::Counter   mTopicExpired  ("topic_stale_total",    "Topics that went stale (no update for STALE_MS)");
+static h2h::Gauge     mTopicsStale   ("topics_stale",         "Topics currently stale");
+static h2h::Counter   mTopicCoalesced("topic_coalesced_total", "Values overwritten in their topic slot before the drain (burst)");
+static h2h::Histogram mProbeRttMs    ("probe_rtt_ms",         "Probe round trip to another house, broker hold time removed", h2h::BUCKETS_MS);
+static h2h::Counter   mProbeBad      ("probe_bad_total",      "Probe replies dropped (unknown seq, duplicate, clock step, peer table full)");
+
+static h2h::StallMonitor stallNet    ("net",    STALL_NET_MS);
+static h2h::StallMonitor stallRender ("render", STALL_RENDER_MS);
+
 
 // ============================================================
 //  WIFI STATUS LED (private pixel)
@@ -119,13 +303,15 @@ void wifi_led_set(const CRGB& c) {
 // ============================================================
 
 void fillRange(int start, int count, const CRGB& c) {
-  for (int i = 0; i < count; i++) {
-    int idx = start + i;
-    if (idx >= 0 && idx < NUM_LEDS) leds[idx] = c;
-  }
+  if (start < 0) { count += start; start = 0; }
+  if (start + count > NUM_LEDS) count = NUM_LEDS - start;
+  if (count <= 0) return;
+  h2h::px_fill3(leds[start].raw, count, c.r, c.g, c.b);   // CRGB = 3 packed bytes
 }
 
 void house_show() {
+  H2H_TRACE_SCOPE("house_show");
+  h2h::ScopedTimerUs t(mShowUs);
   FastLED.show();
 }
 
@@ -136,6 +322,101 @@ void setOfflineVisual() {
 }
 
 
+
+// ============================================================
+//  EFFECTS (render task only)
+// ============================================================
+
+enum FxKind : uint8_t { FX_SOLID, FX_PULSE, FX_BREATHE };
+
+struct FxSegment {
+  int      start;
+  int      count;
+  CRGB     from;          // crossfade start
+  CRGB     to;            // target color
+  CRGB     shown;         // what is in leds[] right now
+  uint32_t fadeStartMs;
+  FxKind   fx;
+  bool     dirty;         // fading, animated or new target
+};
+
+enum { SEG_WC, SEG_STUBE, SEG_COUNT };
+
+static FxSegment fxSeg[SEG_COUNT] = {
+  { WC_LED_START,    WC_LED_COUNT,    CRGB(10,10,10), CRGB(10,10,10), CRGB(10,10,10), 0, FX_SOLID, false },
+  { STUBE_LED_START, STUBE_LED_COUNT, CRGB(10,10,10), CRGB(10,10,10), CRGB(10,10,10), 0, FX_SOLID, false },
+};
+
+void fx_set(FxSegment& s, const CRGB& target, FxKind fx, uint32_t now) {
+  if (target == s.to && fx == s.fx) return;
+  if (target != s.to) {
+    s.from = s.shown;
+    s.to = target;
+    s.fadeStartMs = now;
+  }
+  s.fx = fx;
+  s.dirty = true;
+}
+
+// 8-bit fixed point only (blend / sin8 / scale8), no float per frame
+CRGB fx_color(const FxSegment& s, uint32_t now, bool& animating) {
+  CRGB c = s.to;
+  animating = false;
+
+  const uint32_t dt = now - s.fadeStartMs;
+  if (dt < FX_FADE_MS) {
+    c = blend(s.from, s.to, (uint8_t)((dt << 8) / FX_FADE_MS));
+    animating = true;
+  }
+
+  if (s.fx == FX_PULSE) {
+    uint8_t w = sin8((uint8_t)(((now % FX_PULSE_MS) << 8) / FX_PULSE_MS));
+    c.nscale8(64 + scale8(w, 191));          // 25..100 %
+    animating = true;
+  } else if (s.fx == FX_BREATHE) {
+    uint8_t w = sin8((uint8_t)(((now % FX_BREATHE_MS) << 8) / FX_BREATHE_MS));
+    c.nscale8(160 + scale8(w, 95));          // 63..100 %
+    animating = true;
+  }
+  return c;
+}
+
+// state snapshot -> segment targets (staleness arrives as bits, no clock here)
+void apply_state(const HouseState& s, uint32_t now) {
+  const CRGB gray = CRGB(10,10,10);
+
+  if (!s.online) {
+    fx_set(fxSeg[SEG_WC],    gray, FX_SOLID, now);
+    fx_set(fxSeg[SEG_STUBE], gray, FX_SOLID, now);
+    return;
+  }
+
+  // a silent heartbeat makes every value suspect
+  const uint8_t statusStale = s.staleMask & (1 << TOPIC_STATUS);
+
+  // segments stay gray until the first value after (re)connect
+  CRGB wc = gray;
+  FxKind wcFx = FX_SOLID;
+  if (s.hasHumid) {
+    const bool wet = s.humid >= WC_HUMID_WET;
+    wc = wet ? CRGB(0,0,255) : CRGB(255,80,0);                 // blue / orange
+    if (statusStale || (s.staleMask & (1 << TOPIC_WC_HUMID))) wcFx = FX_PULSE;
+    else if (wet) wcFx = FX_BREATHE;                           // shower running
+  }
+  fx_set(fxSeg[SEG_WC], wc, wcFx, now);
+
+  CRGB stube = gray;
+  FxKind stubeFx = FX_SOLID;
+  if (s.hasAdc) {
+    const bool bright = s.adc >= STUBE_ADC_BRIGHT;
+    stube = bright ? CRGB(255,255,0) : CRGB::Black;            // yellow / off
+    if (statusStale || (s.staleMask & (1 << TOPIC_STUBE_ADC))) stubeFx = FX_PULSE;
+    else if (bright) stubeFx = FX_BREATHE;                     // someone there
+  }
+  fx_set(fxSeg[SEG_STUBE], stube, stubeFx, now);
+}
+
+
 // ============================================================
 //  LED INIT / LOOP
 // ============================================================
@@ -149,8 +430,36 @@ void leds_init() {
   house_show();
 }
 
-void leds_loop() {
-  // currently nothing time-based here
+// One effect frame: only dirty segments, bounded by FX_BUDGET_US.
+// Returns true if leds[] changed (caller shows).
+bool leds_loop() {
+  static uint8_t first = 0;      // round robin: an overrun cannot starve a segment
+  h2h::ScopedTimerUs t(mFxUs);
+  const uint32_t t0  = micros();
+  const uint32_t now = millis();
+  bool changed = false;
+
+  for (uint8_t k = 0; k < SEG_COUNT; k++) {
+    const uint8_t i = (first + k) % SEG_COUNT;
+    FxSegment& s = fxSeg[i];
+    if (!s.dirty) continue;
+    if (micros() - t0 > FX_BUDGET_US) {
+      mFxOverBudget.inc();
+      first = i;
+      return changed;
+    }
+
+    bool animating;
+    const CRGB c = fx_color(s, now, animating);
+    if (c != s.shown) {
+      fillRange(s.start, s.count, c);
+      s.shown = c;
+      changed = true;
+    }
+    s.dirty = animating;
+  }
+  first = 0;
+  return changed;
 }
 
 
@@ -181,14 +490,21 @@ void wifi_init() {
     DPRINTLN("WIFI: normal boot (no portal)");
   }
 
-  // Clean WiFi state (prevents "sta is connecting, cannot set config")
+  // Fast path: last AP (BSSID + channel) and lease, no scan / DHCP / portal.
+  // Credentials come from the WiFi driver's NVS, WiFiManager saved them there.
+  if (!forcePortal && h2h::wifi_fast_connect(nullptr, nullptr)) {
+    h2h::wifi_cache_save();
+    wifi_led_set(CRGB::Green);
+    DPRINT("WIFI: fast connect, IP=");
+    DPRINTLN(WiFi.localIP());
+    return;
+  }
+
+  // No WiFi.disconnect(true, true) / mode cycling: a failed fast path already
+  // leaves the station idle, so WiFiManager can set its config right away.
   WiFi.persistent(false);
-  WiFi.disconnect(true, true);
-  delay(200);
-  WiFi.mode(WIFI_OFF);
-  delay(200);
   WiFi.mode(WIFI_STA);
-  delay(200);
+  const uint32_t t0 = millis();
 
   WiFiManager wm;
   wm.setDebugOutput(DEBUG_SERIAL ? true : false);
@@ -201,6 +517,7 @@ void wifi_init() {
 
   if (forcePortal) {
     wm.resetSettings(); // ONLY here (manual wipe)
+    h2h::wifi_cache_clear();
     wm.startConfigPortal("h2h-haus2-setup");
   } else {
     // autoConnect tries saved credentials; if none, it will start portal.
@@ -214,6 +531,8 @@ void wifi_init() {
   }
 
   if (WiFi.status() == WL_CONNECTED) {
+    h2h::wifiConnectMs.observe(millis() - t0);
+    h2h::wifi_cache_save();
     wifi_led_set(CRGB::Green);
     DPRINT("WIFI: connected, IP=");
     DPRINTLN(WiFi.localIP());
@@ -233,44 +552,202 @@ void wifi_loop() {
 
 
 // ============================================================
-//  MQTT CALLBACK
+//  TOPIC SLOTS: LATEST VALUE + FRESHNESS (net task only)
 // ============================================================
 
-void mqtt_callback(char* topic, byte* payload, unsigned int length) {
-  static char msg[64];
-  unsigned int n = (length < sizeof(msg)-1) ? length : (sizeof(msg)-1);
-  memcpy(msg, payload, n);
-  msg[n] = 0;
+// One slot per subscribed topic. A message only overwrites the slot's
+// value and sets its dirty bit (latest value wins); topics_drain() parses
+// the dirty slots once per net iteration and re-arms their timers. When a
+// timer fires, the topic's stale bit is set. Cost per message and per
+// expiry is O(1), no loop scans the topics.
+struct TopicSlot {
+  const char*    topic;
+  uint32_t       lastSeenMs;
+  h2h::TimerNode timer;      // timer.id = TopicId
+  char           value[16];  // newest payload, NUL-terminated
+};
+
+static TopicSlot topicSlots[TOPIC_COUNT];
+static uint8_t   topicsDirty = 0;       // bit (1 << TopicId): value not drained yet
+static bool      topicsReset = false;   // status "0" in this burst: drop values first
+
+void topic_expired(h2h::TimerNode& n);
+
+void topics_init() {
+  const char* names[TOPIC_COUNT] = { TOP_STATUS, TOP_WC_HUMID, TOP_STUBE_ADC };
+  for (uint8_t i = 0; i < TOPIC_COUNT; i++) {
+    topicSlots[i].topic = names[i];
+    topicSlots[i].lastSeenMs = 0;
+    topicSlots[i].timer.id = i;
+    topicSlots[i].timer.fn = topic_expired;
+  }
+}
 
-  if (strcmp(topic, TOP_STATUS) == 0) {
-    sourceOnline = (atoi(msg) == 1);
-    if (!sourceOnline) setOfflineVisual();
-    return;
+static void topic_set_stale(uint8_t id, bool stale) {
+  const uint8_t bit = 1 << id;
+  const uint8_t old = netState.staleMask;
+  netState.staleMask = stale ? (old | bit) : (old & ~bit);
+  if (netState.staleMask == old) return;
+  mTopicsStale.add(stale ? 1 : -1);
+}
+
+// message received: fresh again, re-arm the expiry
+void topic_seen(uint8_t id) {
+  TopicSlot& t = topicSlots[id];
+  t.lastSeenMs = millis();
+  topic_set_stale(id, false);
+  netTimers.schedule(t.timer, STALE_MS);
+}
+
+// value dropped (source offline): neither fresh nor stale
+void topic_forget(uint8_t id) {
+  netTimers.cancel(topicSlots[id].timer);
+  topic_set_stale(id, false);
+}
+
+void topic_expired(h2h::TimerNode& n) {
+  topic_set_stale((uint8_t)n.id, true);
+  mTopicExpired.inc();
+  DPRINT("STALE: ");
+  DPRINTLN(topicSlots[n.id].topic);
+  houseState.write(netState);
+}
+
+int topic_lookup(const h2h::MqttMessage& m) {
+  for (uint8_t i = 0; i < TOPIC_COUNT; i++) {
+    if (m.topic_is(topicSlots[i].topic)) return i;
   }
+  return -1;
+}
 
-  if (!sourceOnline) return;
+// callback side: O(1), no parsing, no timers, no state write
+void topic_store(uint8_t id, const char* payload, size_t len) {
+  TopicSlot& t = topicSlots[id];
+  if (len >= sizeof(t.value)) len = sizeof(t.value) - 1;   // numbers only, never this long
+  memcpy(t.value, payload, len);
+  t.value[len] = '\0';
+  if (topicsDirty & (1 << id)) mTopicCoalesced.inc();
+  topicsDirty |= 1 << id;
+}
 
-  if (strcmp(topic, TOP_WC_HUMID) == 0) {
-    float rh = atof(msg);
-    if (rh >= 65.0f) {
-      fillRange(WC_LED_START, WC_LED_COUNT, CRGB(0,0,255));     // blue
-    } else {
-      fillRange(WC_LED_START, WC_LED_COUNT, CRGB(255,80,0));    // orange
-    }
-    house_show();
+// After mqtt.loop(): newest value per dirty topic, one state write per burst
+void topics_drain() {
+  if (!topicsDirty && !topicsReset) return;
+  H2H_TRACE_SCOPE("topics_drain");
+
+  if (topicsReset) {
+    netState.hasHumid = false;   // segments stay gray until new values
+    netState.hasAdc   = false;
+    topic_forget(TOPIC_STATUS);
+    topic_forget(TOPIC_WC_HUMID);
+    topic_forget(TOPIC_STUBE_ADC);
+    topicsReset = false;
+  }
+  netState.online = sourceOnline;
+  if (sourceOnline && (topicsDirty & (1 << TOPIC_STATUS))) topic_seen(TOPIC_STATUS);
+
+  if (topicsDirty & (1 << TOPIC_WC_HUMID)) {
+    netState.humid    = atof(topicSlots[TOPIC_WC_HUMID].value);
+    netState.hasHumid = true;
+    topic_seen(TOPIC_WC_HUMID);
+  }
+  if (topicsDirty & (1 << TOPIC_STUBE_ADC)) {
+    netState.adc    = atoi(topicSlots[TOPIC_STUBE_ADC].value);
+    netState.hasAdc = true;
+    topic_seen(TOPIC_STUBE_ADC);
+  }
+  topicsDirty = 0;
+  houseState.write(netState);
+}
+
+
+// ============================================================
+//  DELTA OTA
+// ============================================================
+
+static h2h::TimerNode tmrOta;
+
+// Net task (timer): the render task keeps the house lit while the patch streams in
+void ota_run(h2h::TimerNode&) {
+  H2H_TRACE_SCOPE("ota");
+  const h2h::DeltaStatus st = h2h::ota_delta_http(OTA_DELTA_URL, OTA_KEY, Serial);
+  char v[8];
+  snprintf(v, sizeof(v), "%d", (int)st);
+  mqtt.publish(TOP_OTA_STATUS, v);          // 1 = ok, rebooting; <= 0 see h2h_delta.h
+  if (st != h2h::DELTA_DONE) return;
+  mqtt.disconnect();
+  delay(200);
+  ESP.restart();
+}
+
+
+// ============================================================
+//  RTT / CLOCK PROBE
+// ============================================================
+
+static h2h::ProbeService probe(HOUSE_ID);
+
+void probe_send(h2h::TimerNode&) {
+  if (mqtt.connected()) probe.send(mqtt);
+}
+
+
+// ============================================================
+//  MQTT CALLBACK
+// ============================================================
+
+// payload is NUL-terminated in the client's receive buffer: parse in place
+void mqtt_callback(const h2h::MqttMessage& m) {
+  const int64_t rxUs = h2h::probe_now_us();   // t2 / t4 of a probe, before anything else
+  H2H_TRACE_SCOPE("mqtt_callback");
+  h2h::ScopedTimerUs t(mMqttCbUs);
+  mMqttRx.inc();
+
+  // no MAC check: the host tool is a probe peer, and a forged probe can
+  // only skew the probe_* diagnostics
+  switch (probe.handle(mqtt, m, rxUs)) {
+    case h2h::PROBE_NONE:    break;
+    case h2h::PROBE_REQUEST: return;
+    case h2h::PROBE_REPLY:   mProbeRttMs.observe((uint32_t)(probe.last_sample().delayUs / 1000)); return;
+    case h2h::PROBE_BAD:     mProbeBad.inc(); return;
+  }
+
+#if MQTT_MAC
+  // before anything acts on it: a forged "0" on status would blank the house
+  h2h::MacResult mac;
+  {
+    h2h::ScopedTimerUs tv(mMacVerifyUs);
+    mac = macVerifier.verify(m);
+  }
+  switch (mac) {
+    case h2h::MAC_OK:      mMacOk.inc(); break;
+    case h2h::MAC_BAD:     mMacBad.inc(); return;
+    case h2h::MAC_REPLAY:  mMacReplay.inc(); return;
+    case h2h::MAC_MISSING: mMacMissing.inc(); return;
+  }
+
+  // signed trigger only; the patch itself is checked against OTA_KEY
+  if (m.topic_is(TOP_OTA)) {
+    if (atoi(m.payload) == 1) netTimers.schedule(tmrOta, 0);   // not from inside the callback
     return;
   }
+#endif
 
-  if (strcmp(topic, TOP_STUBE_ADC) == 0) {
-    int adc = atoi(msg);
-    if (adc >= 2000) {
-      fillRange(STUBE_LED_START, STUBE_LED_COUNT, CRGB(255,255,0)); // yellow
-    } else {
-      fillRange(STUBE_LED_START, STUBE_LED_COUNT, CRGB::Black);     // off
+  const int id = topic_lookup(m);
+  if (id < 0) return;
+
+  // order across topics only matters around "offline": values before it
+  // are dropped here, values while offline never reach a slot
+  if (id == TOPIC_STATUS) {
+    sourceOnline = (atoi(m.payload) == 1);
+    if (!sourceOnline) {
+      topicsDirty = 0;
+      topicsReset = true;
     }
-    house_show();
+  } else if (!sourceOnline) {
     return;
   }
+  topic_store((uint8_t)id, m.payload, m.payloadLen);
 }
 
 
@@ -278,42 +755,235 @@ void mqtt_callback(char* topic, byte* payload, unsigned int length) {
 //  MQTT INIT / LOOP
 // ============================================================
 
+// CONNACK accepted (from mqtt.loop())
+void mqtt_on_connect() {
+#if MQTT_MAC
+  mqtt.subscribe(TOP_OTA, 0);
+#endif
+  probe.subscribe(mqtt);
+  mqtt.subscribe(TOP_STATUS, 1);
+  mqtt.subscribe(TOP_WC_HUMID, 1);
+  mqtt.subscribe(TOP_STUBE_ADC, 1);
+}
+
+// Starts the handshake; true = CONNECT sent, CONNACK comes through mqtt_loop()
 bool mqtt_connect() {
-  mqtt.setServer(MQTT_HOST, MQTT_PORT);
-  mqtt.setCallback(mqtt_callback);
+  H2H_HEAP_SITE("mqtt_connect");
+  // cached address (fresh or last good): no DNS round trip on the reconnect path
+  mqtt.set_server(dnsCache.address(MQTT_HOST), MQTT_PORT);
+#if MQTT_TLS
+  mqttNet.set_ca(MQTT_CA_PEM);
+  mqttNet.set_server_name(MQTT_HOST);   // SNI + cert name; connect() may only see the IP
+#endif
+  mqtt.set_handler(mqtt_callback);
+  mqtt.set_on_connect(mqtt_on_connect);
 
   if (WiFi.status() != WL_CONNECTED) return false;
 
-  bool ok;
-  if (MQTT_USER[0] != 0) ok = mqtt.connect(CLIENT_ID, MQTT_USER, MQTT_PASS);
-  else                  ok = mqtt.connect(CLIENT_ID);
-
-  if (ok) {
-    mqtt.subscribe(TOP_STATUS, 1);
-    mqtt.subscribe(TOP_WC_HUMID, 1);
-    mqtt.subscribe(TOP_STUBE_ADC, 1);
-  }
+  mMqttReconnect.inc();
+  const bool ok = mqtt.connect(CLIENT_ID, MQTT_USER, MQTT_PASS);
+  if (!ok) mMqttConnFail.inc();
+#if MQTT_TLS
+  else mTlsHandshakeMs.observe(mqttNet.last_handshake_ms());
+#endif
   return ok;
 }
 
 void mqtt_init() {
   // Optional: set WiFi LED to purple when MQTT is connected later.
   // For now, keep WiFi green as "WiFi OK".
-  mqtt.setBufferSize(256);
+  mqtt.set_protocol(MQTT_PROTOCOL);
+  mqtt.set_rx_budget(MQTT_RX_BUDGET);
+#if MQTT_MAC
+  if (!macVerifier.begin(MQTT_MAC_KEY)) DPRINTLN("MQTT_MAC_KEY: expected 32 hex chars");
+#endif
+  if (WiFi.status() == WL_CONNECTED) dnsCache.set_server(WiFi.dnsIP().toString().c_str());
+  dnsCache.add(MQTT_HOST);
   mqtt_connect();
 }
 
+static h2h::TimerNode tmrMqttRetry;
+
+void mqtt_retry(h2h::TimerNode&) {
+  if (mqtt.active()) return;
+  H2H_TRACE_SCOPE("mqtt_connect");
+  if (!mqtt_connect()) netTimers.schedule(tmrMqttRetry, MQTT_RETRY_MS);
+}
+
 void mqtt_loop() {
-  static uint32_t lastTry = 0;
+  if (!mqtt.active()) {
+    // first attempt on the next tick, then every MQTT_RETRY_MS
+    if (!tmrMqttRetry.armed()) netTimers.schedule(tmrMqttRetry, 0);
+    return;
+  }
+
+  H2H_TRACE_SCOPE("mqtt.loop");
+  mqtt.loop();
+}
+
+
+// ============================================================
+//  SERIAL COMMANDS (diagnostics)
+// ============================================================
+
+void serial_poll(h2h::TimerNode&) {
+  while (Serial.available() > 0) {
+    int c = Serial.read();
+#if MQTT_TLS
+    if (c == 'l') { h2h::tls_bench(Serial, MQTT_HOST, MQTT_PORT, MQTT_CA_PEM, MQTT_HOST); continue; }
+#endif
+#if MQTT_MAC
+    if (c == 'm') { h2h::mac_bench(Serial, MQTT_MAC_KEY); continue; }
+#endif
+    if (c == 'u') { netTimers.schedule(tmrOta, 0); continue; }
+    if (c == 'r') { probe.report(Serial); continue; }
+    if (h2h::stall_serial_cmd(c)) continue;
+    if (!h2h::trace_serial_cmd(c) && !h2h::heap_serial_cmd(c)) h2h::pixels_serial_cmd(c);
+  }
+}
+
+
+// ============================================================
+//  METRICS PUBLISH (h2h/haus2/sys/<metric>)
+// ============================================================
+
+void metrics_publish(h2h::TimerNode&) {
+  h2h::metrics_sample_system();
+  mWifiRssi.set(WiFi.RSSI());
+  mMqttRxBytes.follow(mqtt.rx_bytes());
+  mDnsQueries.follow(dnsCache.queries());
+  mDnsFailures.follow(dnsCache.failures());
+  mDnsStale.follow(dnsCache.stale());
+#if MQTT_TLS
+  mTlsFull.follow(mqttNet.handshakes_full());
+  mTlsResumed.follow(mqttNet.handshakes_resumed());
+  mTlsHeap.set(mqttNet.heap_held());
+  mTlsOverhead.follow(mqttNet.wire_tx_bytes() - mqttNet.plain_tx_bytes());
+#endif
+
+  if (!mqtt.connected()) return;
+
+  H2H_HEAP_SITE("metrics_publish");
+
+  h2h::metrics_for_each_value([](const char* name, const char* suffix, long value) {
+    char topic[96];
+    snprintf(topic, sizeof(topic), "h2h/%s/sys/%s%s", HOUSE_ID, name, suffix);
+    char payload[16];
+    snprintf(payload, sizeof(payload), "%ld", value);
+    mqtt.publish(topic, payload, false);
+  });
+  // which scope the stalls were in: h2h/haus2/sys/stall_site_total/<loop>/<scope>
+  h2h::stall_for_each_site([](const char* loop, const char* scope, const h2h::StallSite& s) {
+    char topic[96];
+    char payload[16];
+    snprintf(topic, sizeof(topic), "h2h/%s/sys/stall_site_total/%s/%s", HOUSE_ID, loop, scope);
+    snprintf(payload, sizeof(payload), "%lu", (unsigned long)s.count.load());
+    mqtt.publish(topic, payload, false);
+    snprintf(topic, sizeof(topic), "h2h/%s/sys/stall_site_max_ms/%s/%s", HOUSE_ID, loop, scope);
+    snprintf(payload, sizeof(payload), "%lu", (unsigned long)s.maxMs.load());
+    mqtt.publish(topic, payload, false);
+  });
+  // per peer, one number each: h2h/haus2/sys/probe_rtt_p50_ms/<peer>
+  probe.for_each_value([](const char* metric, const char* peer, long long value) {
+    char topic[96];
+    char payload[24];
+    snprintf(topic, sizeof(topic), "h2h/%s/sys/%s/%s", HOUSE_ID, metric, peer);
+    snprintf(payload, sizeof(payload), "%lld", value);
+    mqtt.publish(topic, payload, false);
+  });
+}
+
+
+// ============================================================
+//  NETWORK TASK (core 0) / RENDER TASK (core 1)
+// ============================================================
+
+// Sleep until the next deadline or until MQTT data arrives, whichever is first
+void net_wait(uint32_t ms) {
+  if (ms > NET_MAX_WAIT_MS) ms = NET_MAX_WAIT_MS;
 
-  if (!mqtt.connected()) {
-    if (millis() - lastTry > 2000) {
-      lastTry = millis();
-      mqtt_connect();
+  const int fd = mqtt.active() ? mqttNet.fd() : -1;
+  if (fd < 0) {
+    vTaskDelay(pdMS_TO_TICKS(ms) ? pdMS_TO_TICKS(ms) : 1);
+    return;
+  }
+  if (mqttNet.available() > 0) return;   // already buffered (or decrypted), mqtt_loop() again
+
+  fd_set rfds;
+  FD_ZERO(&rfds);
+  FD_SET(fd, &rfds);
+  struct timeval tv;
+  tv.tv_sec  = ms / 1000;
+  tv.tv_usec = (ms % 1000) * 1000;
+  select(fd + 1, &rfds, nullptr, nullptr, &tv);
+}
+
+void net_task(void*) {
+  static h2h::TimerNode tmrMetrics, tmrSerial, tmrProbe;
+  tmrOta.fn       = ota_run;
+  tmrMqttRetry.fn = mqtt_retry;
+  tmrMetrics.fn   = metrics_publish;
+  tmrSerial.fn    = serial_poll;
+  tmrProbe.fn     = probe_send;
+
+  netTimers.start(millis());
+  netTimers.every(tmrMetrics, METRICS_PUBLISH_MS, METRICS_PUBLISH_MS);
+  netTimers.every(tmrProbe, PROBE_MS, PROBE_MS);
+#if DEBUG_SERIAL
+  netTimers.every(tmrSerial, SERIAL_POLL_MS, SERIAL_POLL_MS);
+#endif
+
+  stallNet.attach();
+  for (;;) {
+    {
+      h2h::StallScope iteration(stallNet);
+      H2H_TRACE_SCOPE("net");
+      wifi_loop();
+      mqtt_loop();
+      topics_drain();
+      dnsCache.loop();
+      netTimers.advance(millis());
+      h2h::heap_loop();
     }
+    net_wait(netTimers.next_ms(millis()));
   }
+}
 
-  mqtt.loop();
+// Fixed frame clock: a stalled network task can delay data, never frames.
+void render_task(void*) {
+  const int32_t periodUs = RENDER_INTERVAL_MS * 1000;
+  TickType_t wake = xTaskGetTickCount();
+  uint32_t lastUs = micros();
+  uint32_t shownVersion = 0;
+  HouseState snap = {};
+
+  stallRender.attach();
+  for (;;) {
+    vTaskDelayUntil(&wake, pdMS_TO_TICKS(RENDER_INTERVAL_MS));
+
+    const uint32_t nowUs = micros();
+    const int32_t period = (int32_t)(nowUs - lastUs);
+    lastUs = nowUs;
+    mRenderJitter.observe((uint32_t)abs(period - periodUs));
+    if (period > 2 * periodUs) mRenderLate.inc();
+
+    h2h::StallScope iteration(stallRender);
+    H2H_TRACE_SCOPE("render");
+    if (houseState.version() != shownVersion) {
+      shownVersion = houseState.read(snap);
+      if (houseState.version() != shownVersion) mStateStale.inc();  // picked up next tick
+    }
+    apply_state(snap, millis());
+    if (leds_loop()) {
+      house_show();
+      mFrames.inc();
+    }
+  }
+}
+
+void tasks_start() {
+  xTaskCreatePinnedToCore(render_task, "render", RENDER_TASK_STACK, nullptr, 2, &renderTaskHandle, RENDER_CORE);
+  xTaskCreatePinnedToCore(net_task,    "net",    NET_TASK_STACK,    nullptr, 1, &netTaskHandle,    NET_CORE);
 }
 
 
@@ -334,12 +1004,13 @@ void setup() {
   setOfflineVisual();
 
   wifi_init();
+  topics_init();
   mqtt_init();
+
+  tasks_start();       // from here on only render_task touches the LEDs
 }
 
 void loop() {
-  wifi_loop();
-  mqtt_loop();
-  leds_loop();
-  delay(10);
+  // all work runs in net_task / render_task
+  vTaskDelete(nullptr);
 }